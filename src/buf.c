@@ -1,15 +1,39 @@
 #include "color.h"
 #include "fuzzy.h"
 #include "lang.h"
+#include "scan.h"
 #include "xalloc.h"
 
 #include <ctype.h>
 #include <errno.h>
+#include <limits.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdint.h>
+#include <time.h>
 #include <unistd.h>
 
+/* the number of lines added at once while a file is loading */
+#define LOAD_CHUNK_LINES 16384
+
+/* the number of lines highlighted at once while idle */
+#define HIGHLIGHT_CHUNK_LINES 2048
+
+/* milliseconds spent loading or highlighting before checking for user input
+ * again
+ */
+#define UPDATE_TIME_SLICE 20
+
+/* milliseconds between two checks of the mapped files while idle */
+#define MAPPING_CHECK_INTERVAL 500
+
+/* the most threads used to search a buffer */
+#define SEARCH_MAX_THREADS 8
+
+/* the fewest lines a thread searches */
+#define SEARCH_CHUNK_LINES 16384
+
 struct buf *FirstBuffer;
 
 struct buf *create_buffer(const char *path)
@@ -64,28 +88,32 @@ size_t detect_language(struct buf *buf)
     line_t                  i;
     col_t                   j;
     int                     l;
+    struct line             *line;
     char                    *name;
+    struct arena            arena;
     struct regex_group      *group;
+    struct text             name_text;
     struct regex_matcher    matcher;
 
     if (buf->text.num_lines > 4) {
-        if (buf->text.lines[0].n == 0) {
-            if (buf->text.lines[1].n > (col_t) strlen(commit_detect) &&
-                    memcmp(buf->text.lines[1].s, commit_detect,
+        if (get_text_line(&buf->text, 0)->n == 0) {
+            line = get_text_line(&buf->text, 1);
+            if (line->n > (col_t) strlen(commit_detect) &&
+                    memcmp(line->s, commit_detect,
                            strlen(commit_detect)) == 0) {
                 return COMMIT_LANG;
             }
         }
     }
     for (i = 0; i < buf->text.num_lines; i++) {
-        for (j = 0; j < buf->text.lines[i].n; j++) {
-            if (isspace(buf->text.lines[i].s[j])) {
+        line = get_text_line(&buf->text, i);
+        for (j = 0; j < line->n; j++) {
+            if (isspace(line->s[j])) {
                 continue;
             }
 
-            if (buf->text.lines[i].s[j] == '#') {
-                if (j + 1 == buf->text.lines[i].n ||
-                        buf->text.lines[i].s[j + 1] != ' ') {
+            if (line->s[j] == '#') {
+                if (j + 1 == line->n || line->s[j + 1] != ' ') {
                     return C_LANG;
                 }
             }
@@ -105,32 +133,32 @@ size_t detect_language(struct buf *buf)
         name++;
     }
     memset(&matcher, 0, sizeof(matcher));
-    matcher.num_lines = 1;
-    matcher.lines = xmalloc(sizeof(*matcher.lines));
-    matcher.lines[0].s = name;
-    matcher.lines[0].n = strlen(name);
+    make_text(&name_text, xmalloc(sizeof(*name_text.lines)), 1);
+    name_text.lines[0].s = name;
+    name_text.lines[0].n = strlen(name);
+    matcher.text = &name_text;
+    memset(&arena, 0, sizeof(arena));
     for (l = 1; l < NUM_LANGS; l++) {
-        group = parse_regex(Langs[l].file_exts);
+        group = parse_regex(Langs[l].file_exts, &arena);
         matcher.pos.col = 0;
         matcher.pos.line = 0;
         if (match_regex(group, &matcher) == 0) {
-            return l;
+            break;
         }
-        free_regex_group(group);
     }
-    free(matcher.lines);
-    return NO_LANG;
+    clear_arena(&arena);
+    free(name_text.lines);
+    return l == NUM_LANGS ? NO_LANG : l;
 }
 
 static void analyze_indent_rules(struct buf *buf)
 {
-    line_t          num;
+    line_t          i, num;
     struct line     *line;
 
     num = MIN(buf->text.num_lines, 300);
-    for (line = buf->text.lines;
-         line < &buf->text.lines[num];
-         line++) {
+    for (i = 0; i < num; i++) {
+        line = get_text_line(&buf->text, i);
         if (line->n == 0) {
             continue;
         }
@@ -143,8 +171,7 @@ static void analyze_indent_rules(struct buf *buf)
         }
         if (line->s[0] == ' ' && line->s[1] == ' ') {
             buf->rule.use_spaces = true;
-            buf->rule.tab_size = get_line_indent(buf, line - buf->text.lines,
-                                                 NULL);
+            buf->rule.tab_size = get_line_indent(buf, i, NULL);
             break;
         }
     }
@@ -154,8 +181,10 @@ int init_load_buffer(struct buf *buf)
 {
     FILE            *fp;
     char            *file;
+    size_t          num_bytes;
 
     buf->rule = Core.rule;
+    buf->load_hash = HASH_INIT;
 
 beg:
     if (buf->path == NULL || (fp = fopen(buf->path, "r")) == NULL) {
@@ -169,6 +198,7 @@ beg:
     }
 
     if (stat(buf->path, &buf->st) == 0 && (buf->st.st_mode & S_IFDIR)) {
+        fclose(fp);
         file = choose_file(buf->path);
         if (file != NULL) {
             free(buf->path);
@@ -178,13 +208,20 @@ beg:
         goto beg;
     }
 
-    if (read_text(fp, &buf->file, &buf->text, LINE_MAX) == 0) {
+    num_bytes = load_text(fp, &buf->file, &buf->text);
+    fclose(fp);
+    if (num_bytes == 0) {
+        free(buf->file.encoding);
         buf->file.encoding = xstrdup("utf-8");
         buf->file.eol = EOL_NL;
+        clear_text(&buf->text);
         init_text(&buf->text, 1);
         notice_line_growth(buf, 0, 1);
     } else {
-        notice_line_growth(buf, 0, buf->text.num_lines);
+        /* only load the first lines, the rest is loaded while idle */
+        buf->is_loading = true;
+        buf->load_off = 0;
+        load_buffer_lines(buf, LOAD_CHUNK_LINES);
         analyze_indent_rules(buf);
     }
 
@@ -195,21 +232,37 @@ beg:
 void destroy_buffer(struct buf *buf)
 {
     struct buf      *prev;
-    line_t          i;
+    size_t          e;
+    size_t          i;
 
     free(buf->path);
-    for (i = 0; i < buf->text.num_lines; i++) {
-        free(buf->attribs[i]);
-    }
+    clear_slab(&buf->attrib_slab);
     free(buf->attribs);
+    if (buf->layouts != NULL) {
+        for (i = 0; i < LAYOUT_CACHE_SIZE; i++) {
+            free(buf->layouts[i].runs);
+        }
+        free(buf->layouts);
+    }
+    if (buf->col_indexes != NULL) {
+        for (i = 0; i < COL_INDEX_CACHE_SIZE; i++) {
+            free(buf->col_indexes[i].points);
+        }
+        free(buf->col_indexes);
+    }
     free(buf->states);
     clear_text(&buf->text);
     free(buf->file.encoding);
+    for (e = 0; e < buf->num_history; e++) {
+        free(buf->history[e]);
+    }
+    free(buf->history);
     free(buf->events);
+    free(buf->history_refs);
     free(buf->parens);
     free(buf->matches);
     free(buf->search_pat);
-    free_regex_group(buf->search_group);
+    free_regex_prog(buf->search_prog);
 
     /* remove from linked list */
     if (FirstBuffer == buf) {
@@ -313,11 +366,16 @@ size_t get_buffer_count(void)
 void set_language(struct buf *buf, size_t lang)
 {
     buf->lang = lang;
-    rehighlight_lines(buf, 0, buf->text.num_lines);
+    /* all lines need to be highlighted again, this happens on demand */
+    buf->hl_line = 0;
+    buf->num_parens = 0;
 }
 
 size_t write_file(struct buf *buf, line_t from, line_t to, FILE *fp)
 {
+    finish_loading(buf);
+    commit_insertion(buf);
+
     /* clip arguments */
     to = MIN(to, buf->text.num_lines - 1);
     if (from > to) {
@@ -328,6 +386,89 @@ size_t write_file(struct buf *buf, line_t from, line_t to, FILE *fp)
     return write_text(fp, &buf->file, &buf->text, from, to);
 }
 
+void unmap_file(const char *path)
+{
+    struct stat     st;
+    struct buf      *buf;
+
+    if (stat(path, &st) != 0) {
+        return;
+    }
+    for (buf = FirstBuffer; buf != NULL; buf = buf->next) {
+        if (buf->text.is_mapped && buf->st.st_dev == st.st_dev &&
+                buf->st.st_ino == st.st_ino &&
+                !check_buffer_mapping(buf)) {
+            unmap_text(&buf->text);
+        }
+    }
+}
+
+bool check_buffer_mapping(struct buf *buf)
+{
+    if (check_mapping(&buf->text)) {
+        buf->is_stale = true;
+        /* the history belongs to the file as it was loaded */
+        buf->is_history_loaded = true;
+        set_error("'%s' was changed by another process, use  :e!  to read it"
+                  " again", buf->path);
+    }
+    return buf->is_stale;
+}
+
+void check_mapped_files(void)
+{
+    static struct timespec  last;
+
+    struct timespec         now;
+    struct buf              *buf;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if ((now.tv_sec - last.tv_sec) * 1000 +
+            (now.tv_nsec - last.tv_nsec) / 1000000 < MAPPING_CHECK_INTERVAL) {
+        return;
+    }
+    last = now;
+
+    for (buf = FirstBuffer; buf != NULL; buf = buf->next) {
+        (void) check_buffer_mapping(buf);
+    }
+}
+
+int reload_buffer(struct buf *buf)
+{
+    FILE            *fp;
+    struct text     text;
+    struct pos      from, to;
+
+    fp = fopen(buf->path, "r");
+    if (fp == NULL) {
+        set_error("could not open '%s': %s", buf->path, strerror(errno));
+        return -1;
+    }
+    (void) read_text(fp, NULL, &text, LINE_MAX);
+    fclose(fp);
+    stat(buf->path, &buf->st);
+
+    finish_loading(buf);
+    /* the old mapping would be seen as changed again */
+    unmap_text(&buf->text);
+    from.line = 0;
+    from.col = 0;
+    to.line = buf->text.num_lines - 1;
+    to.col = get_text_line(&buf->text, to.line)->n;
+    if (text.num_lines == 1 && get_text_line(&text, 0)->n == 0) {
+        /* the file is empty */
+        (void) delete_range(buf, &from, &to);
+    } else {
+        (void) replace_lines(buf, &from, &to, &text);
+    }
+    clear_text(&text);
+
+    buf->save_event_i = buf->event_i;
+    buf->is_stale = false;
+    return 0;
+}
+
 struct undo_event *read_file(struct buf *buf, const struct pos *pos, FILE *fp)
 {
     struct text         text;
@@ -347,7 +488,7 @@ col_t get_line_indent(struct buf *buf, line_t line_i, col_t *p_col)
     col_t           col;
     struct          line *line;
 
-    line = &buf->text.lines[line_i];
+    line = get_text_line(&buf->text, line_i);
     indent = 0;
     col = 0;
     for (col = 0; col < line->n; col++) {
@@ -394,6 +535,9 @@ struct undo_event *indent_line(struct buf *buf, line_t line_i)
 {
     col_t           new_indent;
 
+    /* the indentor needs the parentheses of the typed text */
+    commit_insertion(buf);
+    highlight_up_to(buf, line_i);
     new_indent = Langs[buf->lang].indentor(buf, line_i);
     return set_line_indent(buf, line_i, new_indent);
 }
@@ -401,6 +545,7 @@ struct undo_event *indent_line(struct buf *buf, line_t line_i)
 void insert_lines_no_event(struct buf *buf, const struct pos *pos,
                            const struct text *text)
 {
+    finish_loading(buf);
     insert_text(&buf->text, pos, text);
     if (text->num_lines > 1) {
         notice_line_growth(buf, pos->line + 1, text->num_lines - 1);
@@ -420,6 +565,7 @@ struct undo_event *insert_lines(struct buf *buf, const struct pos *pos,
 struct undo_event *_insert_lines(struct buf *buf, const struct pos *pos,
                                  struct text *text)
 {
+    commit_insertion(buf);
     insert_lines_no_event(buf, pos, text);
     return add_event(buf, IS_INSERTION, pos, text);
 }
@@ -427,6 +573,7 @@ struct undo_event *_insert_lines(struct buf *buf, const struct pos *pos,
 void insert_block_no_event(struct buf *buf, const struct pos *pos,
                            const struct text *text)
 {
+    finish_loading(buf);
     insert_text_block(&buf->text, pos, text);
     rehighlight_lines(buf, pos->line, text->num_lines);
 }
@@ -444,6 +591,7 @@ struct undo_event *_insert_block(struct buf *buf,
                    const struct pos *pos,
                    struct text *text)
 {
+    commit_insertion(buf);
     insert_block_no_event(buf, pos, text);
     return add_event(buf, IS_BLOCK | IS_INSERTION, pos, text);
 }
@@ -461,6 +609,7 @@ struct undo_event *break_line(struct buf *buf, const struct pos *pos)
     init_text(&text, 2);
     ev = _insert_lines(buf, &p, &text);
 
+    highlight_up_to(buf, pos->line + 1);
     indent = Langs[buf->lang].indentor(buf, pos->line + 1);
     if (indent == 0) {
         return ev;
@@ -524,6 +673,7 @@ size_t get_match_line(struct buf *buf, line_t line_i)
     size_t          l, m, r;
     struct match    *match;
 
+    flush_batch(buf);
     l = 0;
     r = buf->num_matches;
     while (l < r) {
@@ -546,10 +696,208 @@ size_t get_match_line(struct buf *buf, line_t line_i)
     return l;
 }
 
+/**
+ * Moves the highlighting of a line after a byte was typed into it.
+ *
+ * The typed byte joins the run before it, the parentheses and matches after it
+ * move one column to the right. The line is highlighted properly once the
+ * insertion is committed.
+ *
+ * @param buf   The buffer containing the line.
+ * @param pos   The position the byte was typed at.
+ */
+static void shift_line_marks(struct buf *buf, const struct pos *pos)
+{
+    struct hi_span  *spans;
+    size_t          i, num_spans;
+    col_t           end;
+    size_t          index;
+    struct paren    *paren;
+    struct match    *match;
+
+    spans = buf->attribs[pos->line];
+    if (pos->line < buf->hl_line && spans != NULL) {
+        for (i = 0, end = spans[0].n; spans[i + 1].n > 0; end += spans[++i].n) {
+            if (pos->col <= end) {
+                break;
+            }
+        }
+        if (spans[i].n < UCHAR_MAX) {
+            spans[i].n++;
+        } else {
+            for (num_spans = i + 1; spans[num_spans].n > 0; num_spans++) {
+                (void) 0;
+            }
+            /* +1 for the terminating run */
+            spans = slab_realloc(&buf->attrib_slab, spans,
+                                 sizeof(*spans) * (num_spans + 2));
+            memmove(&spans[i + 2], &spans[i + 1],
+                    sizeof(*spans) * (num_spans - i));
+            spans[i + 1].n = 1;
+            spans[i + 1].hi = spans[i].hi;
+            buf->attribs[pos->line] = spans;
+        }
+    }
+
+    /* go backwards from the next line, so that typing at the end of a line
+     * does not need to look at the other parentheses of the line
+     */
+    index = get_paren_line(buf, pos->line + 1);
+    for (; index > 0; index--) {
+        paren = &buf->parens[index - 1];
+        if (paren->pos.line != pos->line || paren->pos.col < pos->col) {
+            break;
+        }
+        paren->pos.col++;
+    }
+
+    index = get_match_line(buf, pos->line + 1);
+    for (; index > 0; index--) {
+        match = &buf->matches[index - 1];
+        if (match->to.line == pos->line && match->to.col >= pos->col) {
+            match->to.col++;
+        }
+        if (match->from.line != pos->line || match->from.col < pos->col) {
+            break;
+        }
+        match->from.col++;
+    }
+}
+
+/**
+ * Drops the layouts and column indexes of lines that changed or moved.
+ *
+ * @param buf   The buffer containing the lines.
+ * @param from  The first changed line.
+ * @param to    The end of the changed lines (exclusive).
+ */
+static void forget_lines(struct buf *buf, line_t from, line_t to)
+{
+    struct line_layout  *layout;
+    struct col_index    *index;
+    line_t              line_i;
+    size_t              i;
+
+    if (buf->layouts != NULL) {
+        if (to - from < LAYOUT_CACHE_SIZE) {
+            for (line_i = from; line_i < to; line_i++) {
+                layout = &buf->layouts[line_i % LAYOUT_CACHE_SIZE];
+                if (layout->line_i == line_i) {
+                    layout->line_i = -1;
+                }
+            }
+        } else {
+            for (i = 0; i < LAYOUT_CACHE_SIZE; i++) {
+                layout = &buf->layouts[i];
+                if (layout->line_i >= from && layout->line_i < to) {
+                    layout->line_i = -1;
+                }
+            }
+        }
+    }
+
+    if (buf->col_indexes != NULL) {
+        if (to - from < COL_INDEX_CACHE_SIZE) {
+            for (line_i = from; line_i < to; line_i++) {
+                index = &buf->col_indexes[line_i % COL_INDEX_CACHE_SIZE];
+                if (index->line_i == line_i) {
+                    index->line_i = -1;
+                }
+            }
+        } else {
+            for (i = 0; i < COL_INDEX_CACHE_SIZE; i++) {
+                index = &buf->col_indexes[i];
+                if (index->line_i >= from && index->line_i < to) {
+                    index->line_i = -1;
+                }
+            }
+        }
+    }
+}
+
+void type_char(struct buf *buf, const struct pos *pos, int c)
+{
+    struct line     *line;
+
+    if (buf->ins_n > 0 && (buf->ins_pos.line != pos->line ||
+                           buf->ins_pos.col + buf->ins_n != pos->col)) {
+        commit_insertion(buf);
+    }
+
+    line = get_text_line(&buf->text, pos->line);
+    if (buf->ins_n == 0) {
+        finish_loading(buf);
+        line = get_text_line(&buf->text, pos->line);
+        unshare_line(&buf->text, line);
+        buf->ins_pos = *pos;
+        buf->a_ins = line->n;
+    }
+
+    if (line->n == buf->a_ins) {
+        buf->a_ins *= 2;
+        buf->a_ins += 16;
+        line->s = xrealloc(line->s, buf->a_ins);
+    }
+    memmove(&line->s[pos->col + 1], &line->s[pos->col], line->n - pos->col);
+    line->s[pos->col] = c;
+    line->n++;
+    buf->ins_n++;
+
+    /* the marks must be at the current line numbers before moving them */
+    flush_batch(buf);
+    shift_line_marks(buf, pos);
+    forget_lines(buf, pos->line, pos->line + 1);
+    damage_lines(buf, pos->line - 1, pos->line + 2);
+}
+
+void commit_insertion(struct buf *buf)
+{
+    struct line         *line;
+    struct text         text;
+    struct undo_event   *ev;
+
+    if (buf->ins_n == 0) {
+        return;
+    }
+
+    line = get_text_line(&buf->text, buf->ins_pos.line);
+    /* give back the spare room */
+    line->s = xrealloc(line->s, line->n);
+
+    init_text(&text, 1);
+    text.lines[0].n = buf->ins_n;
+    text.lines[0].s = xmemdup(&line->s[buf->ins_pos.col], buf->ins_n);
+    buf->ins_n = 0;
+
+    rehighlight_lines(buf, buf->ins_pos.line, 1);
+    ev = add_event(buf, IS_INSERTION, &buf->ins_pos, &text);
+    ev->cur = buf->ins_pos;
+}
+
 void notice_line_growth(struct buf *buf, line_t line_i, line_t num_lines)
 {
     size_t          index;
 
+    forget_lines(buf, line_i, LINE_MAX);
+
+    if (buf->batch_depth > 0) {
+        if (buf->batch_from > buf->batch_to) {
+            buf->batch_from = line_i;
+            buf->batch_to = line_i + num_lines;
+        } else {
+            if (line_i < buf->batch_to) {
+                buf->batch_to += num_lines;
+            }
+            buf->batch_from = MIN(buf->batch_from, line_i);
+            buf->batch_to = MAX(buf->batch_to, line_i + num_lines);
+        }
+        buf->batch_shift += num_lines;
+        return;
+    }
+
+    /* the line before draws indent guides depending on the following line */
+    damage_lines(buf, line_i - 1, LINE_MAX);
+
     buf->states = xrealloc(buf->states, sizeof(*buf->states) *
                                 buf->text.num_lines);
     memmove(&buf->states[line_i + num_lines],
@@ -564,6 +912,10 @@ void notice_line_growth(struct buf *buf, line_t line_i, line_t num_lines)
             sizeof(*buf->attribs) * (buf->text.num_lines - line_i - num_lines));
     memset(&buf->attribs[line_i], 0, sizeof(*buf->attribs) * num_lines);
 
+    if (line_i < buf->hl_line) {
+        buf->hl_line += num_lines;
+    }
+
     index = get_paren_line(buf, line_i);
     for (; index < buf->num_parens; index++) {
         buf->parens[index].pos.line += num_lines;
@@ -582,12 +934,32 @@ void notice_line_removal(struct buf *buf, line_t line_i, line_t num_lines)
     size_t          index;
     size_t          end;
 
+    forget_lines(buf, line_i, LINE_MAX);
+
+    if (buf->batch_depth > 0) {
+        if (buf->batch_from > buf->batch_to) {
+            buf->batch_from = line_i;
+            buf->batch_to = line_i;
+        } else {
+            buf->batch_from = MIN(buf->batch_from, line_i);
+            buf->batch_to = buf->batch_to >= line_i + num_lines ?
+                buf->batch_to - num_lines : line_i;
+        }
+        buf->batch_shift -= num_lines;
+        return;
+    }
+
+    damage_lines(buf, line_i - 1, LINE_MAX);
+
     memmove(&buf->states[line_i],
             &buf->states[line_i + num_lines],
             sizeof(*buf->states) * (buf->text.num_lines - line_i));
 
     for (i = 0; i < num_lines; i++) {
-        free(buf->attribs[line_i + i]);
+        slab_free(&buf->attrib_slab, buf->attribs[line_i + i]);
+    }
+    if (line_i < buf->hl_line) {
+        buf->hl_line = MAX(line_i, buf->hl_line - num_lines);
     }
     memmove(&buf->attribs[line_i],
             &buf->attribs[line_i + num_lines],
@@ -639,6 +1011,8 @@ struct undo_event *delete_range(struct buf *buf,
     struct pos          r_from, r_to;
     struct text         text;
 
+    finish_loading(buf);
+    commit_insertion(buf);
     if (!clip_range(&buf->text, from, to, &r_from, &r_to)) {
         return NULL;
     }
@@ -663,6 +1037,8 @@ struct undo_event *delete_block(struct buf *buf,
     struct pos          r_from, r_to;
     struct text         text;
 
+    finish_loading(buf);
+    commit_insertion(buf);
     if (!clip_block(&buf->text, from, to, &r_from, &r_to)) {
         return NULL;
     }
@@ -694,6 +1070,9 @@ struct undo_event *change_block(struct buf *buf, const struct pos *pfrom,
     line_t              i;
     col_t               j;
 
+    finish_loading(buf);
+    commit_insertion(buf);
+
     from = *pfrom;
     to = *pto;
     text = &buf->text;
@@ -708,7 +1087,7 @@ struct undo_event *change_block(struct buf *buf, const struct pos *pfrom,
 
     ev = NULL;
     for (i = from.line; i <= to.line; i++) {
-        line = &text->lines[i];
+        line = get_text_line(text, i);
         if (from.col >= line->n) {
             continue;
         }
@@ -717,16 +1096,16 @@ struct undo_event *change_block(struct buf *buf, const struct pos *pfrom,
             continue;
         }
 
-        pos.line = line - text->lines;
+        pos.line = i;
         pos.col = from.col;
-        chg.lines = xmalloc(sizeof(*chg.lines));
+        make_text(&chg, xmalloc(sizeof(*chg.lines)), 1);
         init_line(&chg.lines[0], &line->s[from.col], to_col - from.col);
+        unshare_line(text, line);
         for (j = from.col; j < to_col; j++) {
             ch = (*conv)(line->s[j]);
             chg.lines[0].s[j - from.col] ^= ch;
             line->s[j] = ch;
         }
-        chg.num_lines = 1;
         ev = add_event(buf, IS_REPLACE, &pos, &chg);
     }
     rehighlight_lines(buf, from.line, to.line - from.line + 1);
@@ -746,6 +1125,9 @@ struct undo_event *change_range(struct buf *buf, const struct pos *pfrom,
     col_t           j;
     struct text     chg;
 
+    finish_loading(buf);
+    commit_insertion(buf);
+
     from = *pfrom;
     to = *pto;
     text = &buf->text;
@@ -763,12 +1145,12 @@ struct undo_event *change_range(struct buf *buf, const struct pos *pfrom,
     sort_positions(&from, &to);
 
     /* clip columns */
-    from.col = MIN(from.col, text->lines[from.line].n);
+    from.col = MIN(from.col, get_text_line(text, from.line)->n);
     if (to.line == text->num_lines) {
         to.line--;
-        to.col = text->lines[to.line].n;
+        to.col = get_text_line(text, to.line)->n;
     } else {
-        to.col = MIN(to.col, text->lines[to.line].n);
+        to.col = MIN(to.col, get_text_line(text, to.line)->n);
     }
 
     /* make sure there is text to change */
@@ -777,13 +1159,14 @@ struct undo_event *change_range(struct buf *buf, const struct pos *pfrom,
      * line, so this moves `from` as high up as possible where as the latter
      * moves `to` as much down as possible
      */
-    while (from.line < to.line && from.col == text->lines[from.line].n) {
+    while (from.line < to.line &&
+            from.col == get_text_line(text, from.line)->n) {
         from.line++;
         from.col = 0;
     }
     while (to.col == 0 && to.line > from.line) {
         to.line--;
-        to.col = text->lines[to.line].n;
+        to.col = get_text_line(text, to.line)->n;
     }
 
     if (from.line == to.line && from.col == to.col) {
@@ -794,8 +1177,9 @@ struct undo_event *change_range(struct buf *buf, const struct pos *pfrom,
         num_lines = to.line - from.line + 1;
         lines = xreallocarray(NULL, num_lines, sizeof(*lines));
 
-        line = &text->lines[from.line];
+        line = get_text_line(text, from.line);
         init_line(&lines[0], &line->s[from.col], line->n - from.col);
+        unshare_line(text, line);
         for (i = from.col; i < line->n; i++) {
             ch = (*conv)(line->s[i]);
             lines[0].s[i - from.col] ^= ch;
@@ -803,8 +1187,9 @@ struct undo_event *change_range(struct buf *buf, const struct pos *pfrom,
         }
 
         for (i = from.line + 1; i < to.line; i++) {
-            line = &text->lines[i];
+            line = get_text_line(text, i);
             init_line(&lines[i - from.line], &line->s[0], line->n);
+            unshare_line(text, line);
             for (j = 0; j < line->n; j++) {
                 ch = (*conv)(line->s[j]);
                 lines[i - from.line].s[j] ^= ch;
@@ -812,8 +1197,9 @@ struct undo_event *change_range(struct buf *buf, const struct pos *pfrom,
             }
         }
 
-        line = &text->lines[to.line];
+        line = get_text_line(text, to.line);
         init_line(&lines[to.line - from.line], &line->s[0], to.col);
+        unshare_line(text, line);
         for (i = 0; i < to.col; i++) {
             ch = (*conv)(line->s[i]);
             lines[to.line - from.line].s[i] ^= ch;
@@ -822,8 +1208,9 @@ struct undo_event *change_range(struct buf *buf, const struct pos *pfrom,
     } else {
         num_lines = 1;
         lines = xmalloc(sizeof(*lines));
-        line = &text->lines[from.line];
+        line = get_text_line(text, from.line);
         init_line(&lines[0], &line->s[from.col], to.col - from.col);
+        unshare_line(text, line);
         for (i = from.col; i < to.col; i++) {
             ch = (*conv)(line->s[i]);
             lines[0].s[i - from.col] ^= ch;
@@ -849,7 +1236,7 @@ struct undo_event *replace_lines(struct buf *buf,
     ev = delete_range(buf, from, to);
     ev2 = insert_lines(buf, from, text, 1);
 
-    return ev == NULL ? ev2 : ev2 == NULL ? ev : ev2 - 1;
+    return ev == NULL ? ev2 : ev;
 }
 
 struct undo_event *_replace_lines(struct buf *buf,
@@ -861,7 +1248,7 @@ struct undo_event *_replace_lines(struct buf *buf,
 
     /* TODO: optimize this */
     ev = delete_range(buf, from, to);
-    if (text->num_lines == 1 && text->lines[0].n == 0) {
+    if (text->num_lines == 1 && get_text_line(text, 0)->n == 0) {
         free(text->lines);
         return ev;
     }
@@ -869,8 +1256,37 @@ struct undo_event *_replace_lines(struct buf *buf,
     return ev;
 }
 
-static struct match *search_pattern(struct buf *buf, struct pos *from,
-                                    struct pos *to, size_t *p_num_matches)
+/**
+ * Moves a position one char forward, going to the next line at the end.
+ *
+ * @param buf   The buffer the position is in.
+ * @param p     The position to move.
+ */
+static void step_pos(struct buf *buf, struct pos *p)
+{
+    if (p->col == get_text_line(&buf->text, p->line)->n) {
+        p->col = 0;
+        p->line++;
+    } else {
+        p->col++;
+    }
+}
+
+/**
+ * Searches for a pattern in a range.
+ *
+ * @param buf           The buffer to search in.
+ * @param prog          The compiled pattern to search for.
+ * @param from          The position to start from, this is set to the position
+ *                      where the search would continue.
+ * @param to            The last position a match may start at.
+ * @param p_num_matches The pointer to store the number of matches in.
+ *
+ * @return The allocated matches.
+ */
+static struct match *search_pattern(struct buf *buf, struct regex_prog *prog,
+                                    struct pos *from, const struct pos *to,
+                                    size_t *p_num_matches)
 {
     struct match            *matches, match;
     size_t                  a_matches, num_matches;
@@ -880,43 +1296,165 @@ static struct match *search_pattern(struct buf *buf, struct pos *from,
     a_matches = 8;
     matches = xmalloc(sizeof(*matches) * a_matches);
     num_matches = 0;
-    matcher.lines = buf->text.lines;
-    matcher.num_lines = buf->text.num_lines;
+    matcher.text = &buf->text;
 
     p = *from;
-    while (1) {
-        if ((p.line == to->line && p.col > to->col) || p.line > to->line) {
+    while (!is_point_before(to, &p)) {
+        matcher.pos = p;
+        if (search_regex(prog, &matcher, to, &match.from) == 1) {
+            /* continue after the end */
+            p = *to;
+            step_pos(buf, &p);
             break;
         }
-        matcher.pos = p;
-        matcher.num = 0;
-        match.from = matcher.pos;
-        if (match_regex(buf->search_group, &matcher) == 1) {
-            if (p.col == buf->text.lines[p.line].n) {
-                p.col = 0;
-                p.line++;
-            } else {
-                p.col++;
-            }
+        match.to = matcher.pos;
+        match.num = matcher.num;
+        memcpy(match.sub, matcher.sub, match.num * sizeof(*match.sub));
+        if (num_matches == a_matches) {
+            a_matches *= 2;
+            matches = xreallocarray(matches, a_matches, sizeof(*matches));
+        }
+        matches[num_matches++] = match;
+        p = match.to;
+        if (is_point_equal(&match.from, &match.to)) {
+            step_pos(buf, &p);
+        }
+    }
+    *from = p;
+    *p_num_matches = num_matches;
+    return matches;
+}
+
+struct search_chunk {
+    /// the buffer to search in
+    struct buf *buf;
+    /// the pattern to use, each chunk has its own copy
+    struct regex_prog *prog;
+    /// the start of the chunk
+    struct pos start;
+    /// the position where searching would continue after the chunk
+    struct pos from;
+    /// the last position of the chunk
+    struct pos to;
+    /// the matches found in the chunk
+    struct match *matches;
+    /// the number of matches
+    size_t num_matches;
+};
+
+static void *search_chunk(void *arg)
+{
+    struct search_chunk *chunk;
+
+    chunk = arg;
+    chunk->matches = search_pattern(chunk->buf, chunk->prog, &chunk->from,
+                                    &chunk->to, &chunk->num_matches);
+    return NULL;
+}
+
+/**
+ * Appends matches to a growing match list.
+ */
+static void append_matches(struct match **p_matches, size_t *p_num,
+                           size_t *p_a, const struct match *matches,
+                           size_t num_matches)
+{
+    if (*p_num + num_matches > *p_a) {
+        *p_a *= 2;
+        *p_a += num_matches;
+        *p_matches = xreallocarray(*p_matches, *p_a, sizeof(**p_matches));
+    }
+    memcpy(&(*p_matches)[*p_num], matches, sizeof(*matches) * num_matches);
+    *p_num += num_matches;
+}
+
+/**
+ * Searches the whole buffer for its pattern.
+ *
+ * Large buffers are split into line chunks that are searched by multiple
+ * threads. Each chunk starts searching at its first line, while the serial
+ * search would start where the last match of the previous chunk ended. When
+ * a match reaches into the next chunk, that chunk is searched again from the
+ * end of the match until it lines up with its own matches.
+ *
+ * @param buf           The buffer to search.
+ * @param p_num_matches The pointer to store the number of matches in.
+ *
+ * @return The allocated matches.
+ */
+static struct match *search_buffer(struct buf *buf, size_t *p_num_matches)
+{
+    struct search_chunk chunks[SEARCH_MAX_THREADS];
+    pthread_t           threads[SEARCH_MAX_THREADS];
+    bool                is_started[SEARCH_MAX_THREADS];
+    long                num_chunks;
+    line_t              line_i;
+    long                i;
+    struct search_chunk *chunk;
+    struct match        *matches, *more;
+    size_t              num_matches, a_matches, num_more;
+    struct pos          p, to;
+    size_t              j;
+
+    num_chunks = sysconf(_SC_NPROCESSORS_ONLN);
+    num_chunks = MIN(num_chunks, SEARCH_MAX_THREADS);
+    num_chunks = MIN(num_chunks, buf->text.num_lines / SEARCH_CHUNK_LINES);
+    num_chunks = MAX(num_chunks, 1);
+
+    for (i = 0; i < num_chunks; i++) {
+        chunk = &chunks[i];
+        chunk->buf = buf;
+        chunk->prog = i == 0 ? buf->search_prog :
+            copy_regex_prog(buf->search_prog);
+        chunk->start.line = buf->text.num_lines * i / num_chunks;
+        chunk->start.col = 0;
+        chunk->from = chunk->start;
+        line_i = buf->text.num_lines * (i + 1) / num_chunks - 1;
+        chunk->to.line = line_i;
+        chunk->to.col = get_text_line(&buf->text, line_i)->n;
+        /* the calling thread takes the first chunk */
+        is_started[i] = i > 0 &&
+            pthread_create(&threads[i], NULL, search_chunk, chunk) == 0;
+    }
+    (void) search_chunk(&chunks[0]);
+    for (i = 1; i < num_chunks; i++) {
+        if (is_started[i]) {
+            pthread_join(threads[i], NULL);
         } else {
-            match.to = matcher.pos;
-            match.num = matcher.num;
-            memcpy(match.sub, matcher.sub, match.num * sizeof(*match.sub));
-            if (num_matches == a_matches) {
-                a_matches *= 2;
-                matches = xreallocarray(matches, a_matches, sizeof(*matches));
-            }
-            matches[num_matches++] = match;
-            if (is_point_equal(&p, &matcher.pos)) {
-                if (p.col == buf->text.lines[p.line].n) {
-                    p.col = 0;
-                    p.line++;
-                } else {
-                    p.col++;
+            (void) search_chunk(&chunks[i]);
+        }
+        free_regex_prog(chunks[i].prog);
+    }
+
+    matches = chunks[0].matches;
+    num_matches = chunks[0].num_matches;
+    a_matches = num_matches;
+    /* where the serial search would continue */
+    p = chunks[0].from;
+    for (i = 1; i < num_chunks; i++) {
+        chunk = &chunks[i];
+        j = 0;
+        while (is_point_before(&chunk->start, &p)) {
+            /* the serial search would have skipped these */
+            for (; j < chunk->num_matches; j++) {
+                if (!is_point_before(&chunk->matches[j].from, &p)) {
+                    break;
                 }
-            } else {
-                p = matcher.pos;
             }
+            if (j == 0 || !is_point_before(&p, &chunk->matches[j - 1].to)) {
+                break;
+            }
+            /* `p` is within a match the serial search would not have found */
+            to = chunk->matches[j - 1].to;
+            more = search_pattern(buf, buf->search_prog, &p, &to, &num_more);
+            append_matches(&matches, &num_matches, &a_matches, more, num_more);
+            free(more);
+        }
+        append_matches(&matches, &num_matches, &a_matches,
+                       &chunk->matches[j], chunk->num_matches - j);
+        free(chunk->matches);
+        if (is_point_before(&p, &chunk->from)) {
+            p = chunk->from;
         }
     }
     *p_num_matches = num_matches;
@@ -925,22 +1463,25 @@ static struct match *search_pattern(struct buf *buf, struct pos *from,
 
 size_t set_pattern(struct buf *buf, const char *pat)
 {
-    struct pos      from, to;
-    size_t          n;
-    struct match    *matches;
+    size_t              n;
+    struct match        *matches;
+    struct arena        arena;
+    struct regex_group  *group;
+
+    flush_batch(buf);
 
     free(buf->search_pat);
     buf->search_pat = xstrdup(pat);
-    free_regex_group(buf->search_group);
-    buf->search_group = parse_regex(pat);
+    free_regex_prog(buf->search_prog);
+    memset(&arena, 0, sizeof(arena));
+    group = parse_regex(pat, &arena);
+    buf->search_prog = compile_regex(group);
+    clear_arena(&arena);
 
     free(buf->matches);
+    damage_lines(buf, 0, LINE_MAX);
 
-    from.col = 0;
-    from.line = 0;
-    to.col = buf->text.lines[buf->text.num_lines - 1].n;
-    to.line = buf->text.num_lines - 1;
-    matches = search_pattern(buf, &from, &to, &n);
+    matches = search_buffer(buf, &n);
     matches = xreallocarray(matches, n, sizeof(*matches));
     buf->matches = matches;
     buf->num_matches = n;
@@ -957,20 +1498,19 @@ size_t set_pattern(struct buf *buf, const char *pat)
  */
 static void highlight_line(struct buf *buf, size_t line_i, unsigned state)
 {
+    static struct hi_span   *spans;
+    static size_t           a_spans;
+
     struct state_ctx    ctx;
     col_t               n;
     struct line         *line;
-    int                 *attribs;
+    size_t              num_spans;
+    struct hi_span      *last;
+    col_t               take;
 
     clear_parens(buf, line_i);
 
-    line = &buf->text.lines[line_i];
-
-    attribs = buf->attribs[line_i];
-    attribs = xreallocarray(attribs, line->n, sizeof(*attribs));
-    buf->attribs[line_i] = attribs;
-
-    memset(attribs, 0, sizeof(*attribs) * line->n);
+    line = get_text_line(&buf->text, line_i);
 
     ctx.buf = buf;
     ctx.pos.col = 0;
@@ -980,19 +1520,52 @@ static void highlight_line(struct buf *buf, size_t line_i, unsigned state)
     ctx.s = line->s;
     ctx.n = line->n;
 
+    num_spans = 0;
+    last = NULL;
     for (ctx.pos.col = 0; ctx.pos.col < ctx.n; ) {
         n = (*Langs[buf->lang].fsm[ctx.state & 0xff])(&ctx);
-        for (; n > 0; n--) {
-            attribs[ctx.pos.col] = ctx.hi;
-            ctx.pos.col++;
+        ctx.pos.col += n;
+        while (n > 0) {
+            /* extend the previous run if the group did not change */
+            if (last != NULL && last->hi == ctx.hi && last->n < UCHAR_MAX) {
+                take = MIN(n, (col_t) (UCHAR_MAX - last->n));
+                last->n += take;
+                n -= take;
+                continue;
+            }
+            /* +1 for the terminating run */
+            if (num_spans + 1 >= a_spans) {
+                a_spans *= 2;
+                a_spans += 16;
+                spans = xreallocarray(spans, a_spans, sizeof(*spans));
+            }
+            last = &spans[num_spans++];
+            last->n = 0;
+            last->hi = ctx.hi;
         }
     }
 
+    if (num_spans == 0) {
+        slab_free(&buf->attrib_slab, buf->attribs[line_i]);
+        buf->attribs[line_i] = NULL;
+    } else {
+        spans[num_spans].n = 0;
+        spans[num_spans].hi = HI_NORMAL;
+        num_spans++;
+        buf->attribs[line_i] = slab_realloc(&buf->attrib_slab,
+                                            buf->attribs[line_i],
+                                            sizeof(*spans) * num_spans);
+        memcpy(buf->attribs[line_i], spans, sizeof(*spans) * num_spans);
+    }
+
     if (!(ctx.state & (FSTATE_MULTI | FSTATE_FORCE_MULTI))) {
         ctx.state = STATE_START;
     }
 
     buf->states[line_i] = ctx.state & ~FSTATE_MULTI;
+
+    forget_lines(buf, line_i, line_i + 1);
+    damage_lines(buf, line_i, line_i + 1);
 }
 
 static void fuse_matches(struct buf *buf, size_t start, size_t end,
@@ -1014,39 +1587,640 @@ static void fuse_matches(struct buf *buf, size_t start, size_t end,
     buf->num_matches += num_matches - take;
 }
 
-void rehighlight_lines(struct buf *buf, line_t line_i, line_t num_lines)
+/**
+ * Highlights lines again after they changed.
+ *
+ * Only lines that were already highlighted are highlighted again, the others
+ * are highlighted on demand by `highlight_up_to()`. If the state at the end of
+ * the lines changed, the following lines are highlighted until their state is
+ * the same as before. When that takes too long, all following lines become
+ * invalid instead.
+ *
+ * @param buf       The buffer containing the lines.
+ * @param line_i    The first line to highlight.
+ * @param num_lines The number of lines to highlight.
+ */
+static void highlight_lines(struct buf *buf, line_t line_i, line_t num_lines)
 {
-    struct pos          from, to;
-    struct match        *matches;
-    size_t              num_matches;
     unsigned            state, prev_state;
+    line_t              end, limit;
+    size_t              first_i, tail_i;
+    struct paren        *tail;
+    size_t              num_tail;
+
+    if (line_i >= buf->hl_line) {
+        return;
+    }
+
+    /* take out all following parentheses, so that the parentheses of the
+     * highlighted lines are only appended and not inserted one by one
+     */
+    first_i = get_paren_line(buf, line_i);
+    num_tail = buf->num_parens - first_i;
+    tail = xmemdup(&buf->parens[first_i], sizeof(*tail) * num_tail);
+    buf->num_parens = first_i;
+
+    end = MIN(line_i + num_lines, buf->hl_line);
+    limit = end + HIGHLIGHT_CHUNK_LINES;
+    state = line_i == 0 ? STATE_START : buf->states[line_i - 1];
+    for (; line_i < end; line_i++) {
+        prev_state = buf->states[line_i];
+        highlight_line(buf, line_i, state);
+        state = buf->states[line_i];
+        if (line_i + 1 == end && prev_state != state &&
+                end < buf->hl_line) {
+            if (end == limit) {
+                /* parentheses of invalid lines are added again in order */
+                buf->hl_line = end;
+                free(tail);
+                return;
+            }
+            end++;
+        }
+    }
+
+    /* put back the parentheses of the lines that were not highlighted */
+    for (tail_i = 0; tail_i < num_tail; tail_i++) {
+        if (tail[tail_i].pos.line >= end) {
+            break;
+        }
+    }
+    num_tail -= tail_i;
+    if (num_tail > 0) {
+        if (buf->num_parens + num_tail > buf->a_parens) {
+            buf->a_parens = buf->num_parens + num_tail;
+            buf->parens = xreallocarray(buf->parens, buf->a_parens,
+                                        sizeof(*buf->parens));
+        }
+        memcpy(&buf->parens[buf->num_parens], &tail[tail_i],
+               sizeof(*tail) * num_tail);
+        buf->num_parens += num_tail;
+    }
+    free(tail);
+}
+
+void highlight_up_to(struct buf *buf, line_t line_i)
+{
+    unsigned            state;
+
+    flush_batch(buf);
+    line_i = MIN(line_i, buf->text.num_lines - 1);
+    state = buf->hl_line == 0 ? STATE_START : buf->states[buf->hl_line - 1];
+    for (; buf->hl_line <= line_i; buf->hl_line++) {
+        highlight_line(buf, buf->hl_line, state);
+        state = buf->states[buf->hl_line];
+    }
+}
+
+/**
+ * Searches the changed lines again and replaces the matches in them.
+ *
+ * Matches starting before the changed lines are only searched again if the
+ * pattern can span enough lines to reach into them. After the changed lines,
+ * searching continues until it lines up with the old matches again.
+ *
+ * @param buf       The buffer whose matches to update.
+ * @param line_i    The first changed line.
+ * @param num_lines The number of changed lines.
+ */
+static void update_matches(struct buf *buf, line_t line_i, line_t num_lines)
+{
+    size_t          span;
+    struct pos      from, to;
+    line_t          first;
+    size_t          index, end;
+    struct match    *matches, *more;
+    size_t          num_matches, a_matches, num_more;
+
+    span = buf->search_prog->line_span;
+    from.line = span >= (size_t) line_i ? 0 : line_i - (line_t) span;
+    from.col = 0;
+    index = get_match_line(buf, from.line);
+    /* a match before could reach into the first line */
+    if (index > 0 && is_point_before(&from, &buf->matches[index - 1].to)) {
+        from = buf->matches[index - 1].to;
+    }
+    first = from.line;
+
+    to.line = MIN(line_i + num_lines, buf->text.num_lines);
+    if (to.line > 0) {
+        to.line--;
+    }
+    to.col = get_text_line(&buf->text, to.line)->n;
+
+    matches = NULL;
+    num_matches = 0;
+    a_matches = 0;
+    end = index;
+    while (1) {
+        more = search_pattern(buf, buf->search_prog, &from, &to,
+                              &num_more);
+        if (num_matches + num_more > a_matches) {
+            a_matches = num_matches + num_more;
+            matches = xreallocarray(matches, a_matches, sizeof(*matches));
+        }
+        memcpy(&matches[num_matches], more, sizeof(*more) * num_more);
+        num_matches += num_more;
+        free(more);
+
+        /* all old matches starting before `from` are replaced, if `from` is
+         * in the middle of an old match, the old search never went there
+         * and it is not known what follows
+         */
+        for (; end < buf->num_matches; end++) {
+            if (!is_point_before(&buf->matches[end].from, &from)) {
+                break;
+            }
+        }
+        if (end == index ||
+                !is_point_before(&from, &buf->matches[end - 1].to)) {
+            break;
+        }
+        to = buf->matches[end - 1].to;
+    }
+
+    fuse_matches(buf, index, end, matches, num_matches);
+    free(matches);
+    damage_lines(buf, first, to.line + 1);
+}
+
+void begin_batch(struct buf *buf)
+{
+    if (buf->batch_depth++ == 0) {
+        buf->batch_from = 1;
+        buf->batch_to = 0;
+        buf->batch_shift = 0;
+    }
+}
+
+void flush_batch(struct buf *buf)
+{
+    line_t          from, to, shift;
+    unsigned        depth;
+
+    if (buf->batch_from > buf->batch_to) {
+        return;
+    }
+    from = buf->batch_from;
+    to = buf->batch_to;
+    shift = buf->batch_shift;
+    buf->batch_from = 1;
+    buf->batch_to = 0;
+    buf->batch_shift = 0;
+
+    /* everything after the changed lines only moved, so it is enough to move
+     * it once as if all lines were added or removed at the start
+     */
+    depth = buf->batch_depth;
+    buf->batch_depth = 0;
+    if (shift > 0) {
+        notice_line_growth(buf, from, shift);
+    } else if (shift < 0) {
+        notice_line_removal(buf, from, -shift);
+    }
+    from = MIN(from, buf->text.num_lines - 1);
+    to = MIN(to, buf->text.num_lines);
+    rehighlight_lines(buf, from, MAX(to - from, 1));
+    buf->batch_depth = depth;
+}
+
+void end_batch(struct buf *buf)
+{
+    if (--buf->batch_depth == 0) {
+        flush_batch(buf);
+    }
+}
+
+void rehighlight_lines(struct buf *buf, line_t line_i, line_t num_lines)
+{
+    /* lines after the highlighted ones may have changed as well and column
+     * indexes are also used within a batch
+     */
+    forget_lines(buf, line_i, line_i + num_lines);
+
+    if (buf->batch_depth > 0) {
+        if (buf->batch_from > buf->batch_to) {
+            buf->batch_from = line_i;
+            buf->batch_to = line_i + num_lines;
+        } else {
+            buf->batch_from = MIN(buf->batch_from, line_i);
+            buf->batch_to = MAX(buf->batch_to, line_i + num_lines);
+        }
+        return;
+    }
+
+    damage_lines(buf, line_i - 1, line_i + num_lines + 1);
 
     if (buf->search_pat != NULL) {
-        /* TODO: check if multi line match or not */
+        update_matches(buf, line_i, num_lines);
+    }
+
+    highlight_lines(buf, line_i, num_lines);
+}
+
+void damage_lines(struct buf *buf, line_t from, line_t to)
+{
+    size_t              i;
+    struct line_range   *range;
+
+    from = MAX(from, 0);
+    if (from >= to) {
+        return;
+    }
+
+    for (i = 0; i < buf->num_damage; ) {
+        range = &buf->damage[i];
+        if (range->from <= to && from <= range->to) {
+            from = MIN(from, range->from);
+            to = MAX(to, range->to);
+            *range = buf->damage[--buf->num_damage];
+        } else {
+            i++;
+        }
+    }
+
+    if (buf->num_damage == MAX_DAMAGE) {
+        for (i = 0; i < buf->num_damage; i++) {
+            from = MIN(from, buf->damage[i].from);
+            to = MAX(to, buf->damage[i].to);
+        }
+        buf->num_damage = 0;
+    }
+    buf->damage[buf->num_damage].from = from;
+    buf->damage[buf->num_damage].to = to;
+    buf->num_damage++;
+}
+
+struct line_layout *get_line_layout(struct buf *buf, line_t line_i)
+{
+    struct line_layout  *layout;
+    struct line         *line;
+    size_t              i;
+    col_t               sp_thres;
+    col_t               col, x;
+    struct hi_span      *span;
+    col_t               span_end;
+    col_t               end;
+    struct glyph        g;
+    bool                err;
+    char                ch;
+    int                 kind, hi;
+    struct layout_run   *run;
+
+    /* flushing drops the layouts of the changed lines */
+    flush_batch(buf);
+    if (buf->layouts == NULL) {
+        buf->layouts = xcalloc(LAYOUT_CACHE_SIZE, sizeof(*buf->layouts));
+        for (i = 0; i < LAYOUT_CACHE_SIZE; i++) {
+            buf->layouts[i].line_i = -1;
+        }
+    }
+
+    layout = &buf->layouts[line_i % LAYOUT_CACHE_SIZE];
+    if (layout->line_i == line_i &&
+            layout->tab_size == buf->rule.tab_size) {
+        return layout;
+    }
+    layout->line_i = line_i;
+    layout->tab_size = buf->rule.tab_size;
+    layout->num_runs = 0;
+
+    line = get_text_line(&buf->text, line_i);
+    for (sp_thres = line->n; sp_thres > 0; sp_thres--) {
+        if (!isblank(line->s[sp_thres - 1])) {
+            break;
+        }
+    }
+
+    for (col = 0, x = 0; col < sp_thres; col++) {
+        ch = line->s[col];
+        if (ch == ' ') {
+            x++;
+        } else if (ch == '\t') {
+            x += tab_adjust(x, layout->tab_size);
+        } else {
+            break;
+        }
+    }
+    layout->indent = x;
+
+    span = buf->attribs[line_i];
+    span_end = span == NULL ? 0 : span->n;
+    run = NULL;
+    for (col = 0, x = 0; col < line->n; col += g.n, x += g.w) {
+        ch = line->s[col];
+        if (ch == '\t') {
+            g.n = 1;
+            g.w = tab_adjust(x, layout->tab_size);
+            if (col < sp_thres) {
+                /* the next run can not be joined with the previous one */
+                run = NULL;
+                continue;
+            }
+            kind = RUN_TAB;
+            hi = HI_MAX;
+        } else if (col < sp_thres && ch >= ' ' && ch < 0x7f) {
+            while (span != NULL && span->n > 0 && col >= span_end) {
+                span++;
+                span_end += span->n;
+            }
+            /* take all printable ascii up to the next highlight group */
+            if (span == NULL || span->n == 0) {
+                hi = HI_NORMAL;
+                end = sp_thres;
+            } else {
+                hi = span->hi;
+                end = MIN(span_end, sp_thres);
+            }
+            g.n = skip_plain(&line->s[col], &line->s[end]) - &line->s[col];
+            g.w = g.n;
+            kind = RUN_TEXT;
+        } else {
+            err = get_glyph(&line->s[col], line->n - col, &g) == -1;
+            if (col >= sp_thres) {
+                kind = RUN_BLANK;
+                hi = HI_MAX;
+            } else if (err) {
+                kind = RUN_ERROR;
+                hi = HI_COMMENT;
+            } else if ((ch >= '\0' && ch < ' ') || ch == 0x7f) {
+                kind = RUN_CONTROL;
+                hi = HI_COMMENT;
+            } else {
+                /* columns only go forward, so the runs can be walked along */
+                while (span != NULL && span->n > 0 && col >= span_end) {
+                    span++;
+                    span_end += span->n;
+                }
+                kind = RUN_TEXT;
+                hi = span == NULL || span->n == 0 ? HI_NORMAL : span->hi;
+            }
+        }
+
+        /* only join glyphs that move forward, so that a run is visible as a
+         * whole when its ends are
+         */
+        if (run != NULL && run->kind == kind && run->hi == hi &&
+                (kind == RUN_TEXT || kind == RUN_BLANK) &&
+                run->w > 0 && g.w > 0) {
+            run->n += g.n;
+            run->w += g.w;
+            continue;
+        }
+
+        if (layout->num_runs == layout->a_runs) {
+            layout->a_runs *= 2;
+            layout->a_runs += 8;
+            layout->runs = xreallocarray(layout->runs, layout->a_runs,
+                                         sizeof(*layout->runs));
+        }
+        run = &layout->runs[layout->num_runs++];
+        run->col = col;
+        run->n = g.n;
+        run->x = x;
+        run->w = g.w;
+        run->kind = kind;
+        run->hi = hi;
+    }
+    return layout;
+}
+
+/**
+ * Gets the column index of a long line, it is made again if the line changed
+ * since.
+ *
+ * @param buf       The buffer containing the line.
+ * @param line_i    The line to get the index of.
+ *
+ * @return The column index.
+ */
+static struct col_index *get_col_index(struct buf *buf, line_t line_i)
+{
+    struct col_index    *index;
+    struct line         *line;
+    size_t              i, x;
+    size_t              next;
+    struct glyph        g;
+
+    if (buf->col_indexes == NULL) {
+        buf->col_indexes = xcalloc(COL_INDEX_CACHE_SIZE,
+                                   sizeof(*buf->col_indexes));
+        for (i = 0; i < COL_INDEX_CACHE_SIZE; i++) {
+            buf->col_indexes[i].line_i = -1;
+        }
+    }
+
+    index = &buf->col_indexes[line_i % COL_INDEX_CACHE_SIZE];
+    if (index->line_i == line_i && index->tab_size == buf->rule.tab_size) {
+        return index;
+    }
+    index->line_i = line_i;
+    index->tab_size = buf->rule.tab_size;
+    index->num_points = 0;
+
+    line = get_text_line(&buf->text, line_i);
+    index->is_plain = skip_plain(line->s, &line->s[line->n]) ==
+                            &line->s[line->n];
+    if (index->is_plain) {
+        return index;
+    }
+
+    index->is_ordered = true;
+    for (i = 0, x = 0, next = 0; i < (size_t) line->n; i += g.n, x += g.w) {
+        if (i >= next) {
+            if (index->num_points == index->a_points) {
+                index->a_points *= 2;
+                index->a_points += 8;
+                index->points = xreallocarray(index->points, index->a_points,
+                                              sizeof(*index->points));
+            }
+            index->points[index->num_points].col = i;
+            index->points[index->num_points].x = x;
+            index->num_points++;
+            next = (i / COL_INDEX_STEP + 1) * COL_INDEX_STEP;
+        }
+        /* printable ascii takes one column per byte, stop at the next
+         * checkpoint
+         */
+        g.n = skip_plain(&line->s[i], &line->s[MIN(next, (size_t) line->n)]) -
+            &line->s[i];
+        if (g.n > 0) {
+            g.w = g.n;
+        } else if (line->s[i] == '\t') {
+            g.n = 1;
+            g.w = tab_adjust(x, index->tab_size);
+        } else {
+            (void) get_glyph(&line->s[i], line->n - i, &g);
+            if (g.w < 0) {
+                index->is_ordered = false;
+            }
+        }
+    }
+    return index;
+}
+
+/**
+ * Checks if a checkpoint can be used when only the first bytes of its line
+ * are considered.
+ *
+ * The glyphs before the checkpoint must be the same, so there must be room for
+ * the longest utf8 sequence.
+ *
+ * @param line  The line of the checkpoint.
+ * @param point The checkpoint.
+ * @param n     The number of bytes considered.
+ *
+ * @return Whether the checkpoint can be used.
+ */
+static inline bool is_point_usable(const struct line *line,
+                                   const struct col_checkpoint *point,
+                                   size_t n)
+{
+    return n == (size_t) line->n || (size_t) point->col + 4 <= n;
+}
+
+size_t get_line_advance(struct buf *buf, line_t line_i, size_t n, size_t i)
+{
+    struct line         *line;
+    struct col_index    *index;
+    size_t              p;
+
+    line = get_text_line(&buf->text, line_i);
+    if (line->n < COL_INDEX_STEP) {
+        return get_advance(line->s, n, buf->rule.tab_size, i);
+    }
+
+    index = get_col_index(buf, line_i);
+    i = MIN(i, n);
+    if (index->is_plain) {
+        return i;
+    }
+
+    p = MIN(i / COL_INDEX_STEP, index->num_points - 1);
+    while (p > 0 && ((size_t) index->points[p].col > i ||
+                     !is_point_usable(line, &index->points[p], n))) {
+        p--;
+    }
+    return get_advance_from(line->s, n, buf->rule.tab_size,
+                            index->points[p].col, index->points[p].x, i);
+}
+
+size_t get_line_index(struct buf *buf, line_t line_i, size_t n, size_t x)
+{
+    struct line         *line;
+    struct col_index    *index;
+    size_t              l, m, r;
+
+    line = get_text_line(&buf->text, line_i);
+    if (line->n < COL_INDEX_STEP) {
+        return get_index(line->s, n, buf->rule.tab_size, x);
+    }
+
+    index = get_col_index(buf, line_i);
+    if (index->is_plain) {
+        return MIN(x, n);
+    }
+    if (!index->is_ordered) {
+        return get_index(line->s, n, buf->rule.tab_size, x);
+    }
+
+    /* find the last checkpoint before the x position */
+    l = 0;
+    r = index->num_points;
+    while (l + 1 < r) {
+        m = (l + r) / 2;
+        if (index->points[m].x < x) {
+            l = m;
+        } else {
+            r = m;
+        }
+    }
+    while (l > 0 && !is_point_usable(line, &index->points[l], n)) {
+        l--;
+    }
+    return get_index_from(line->s, n, buf->rule.tab_size,
+                          index->points[l].col, index->points[l].x, x);
+}
+
+void load_buffer_lines(struct buf *buf, line_t max_lines)
+{
+    line_t          old_n, n, i;
+    struct line     *line;
+    struct pos      from, to;
+    struct match    *matches;
+    size_t          index, num_matches;
+
+    if (!buf->is_loading) {
+        return;
+    }
+
+    old_n = buf->text.num_lines;
+    if (split_text(&buf->text, buf->file.eol, &buf->load_off, max_lines)) {
+        buf->is_loading = false;
+    }
+    n = buf->text.num_lines - old_n;
+    if (n == 0) {
+        return;
+    }
+
+    /* the new lines are not edited yet, hash them for the undo history */
+    for (i = old_n; i < buf->text.num_lines; i++) {
+        line = get_text_line(&buf->text, i);
+        buf->load_hash = hash_bytes(line->s, line->n, buf->load_hash);
+        buf->load_hash = hash_bytes("\n", 1, buf->load_hash);
+    }
+
+    notice_line_growth(buf, old_n, n);
+    highlight_lines(buf, old_n, n);
+
+    if (buf->search_pat != NULL) {
+        /* search again from the previous last line because a match could
+         * continue into the new lines
+         */
+        from.line = old_n == 0 ? 0 : old_n - 1;
         from.col = 0;
-        from.line = 0;
+        index = get_match_line(buf, from.line);
+        if (index > 0 && buf->matches[index - 1].to.line == from.line) {
+            from = buf->matches[index - 1].to;
+        }
         to.line = buf->text.num_lines - 1;
-        to.col = buf->text.lines[to.line].n;
-        matches = search_pattern(buf, &from, &to, &num_matches);
-        fuse_matches(buf, 0, buf->num_matches, matches, num_matches);
+        to.col = get_text_line(&buf->text, to.line)->n;
+        matches = search_pattern(buf, buf->search_prog, &from, &to,
+                                 &num_matches);
+        fuse_matches(buf, index, buf->num_matches, matches, num_matches);
         free(matches);
     }
+}
 
-    state = line_i == 0 ? STATE_START : buf->states[line_i - 1];
-    for (; num_lines > 0; num_lines--, line_i++) {
-        if (line_i >= buf->text.num_lines) {
-            break;
-        }
-        prev_state = buf->states[line_i];
-        highlight_line(buf, line_i, state); 
+void finish_loading(struct buf *buf)
+{
+    load_buffer_lines(buf, LINE_MAX);
+}
+
+bool update_buffers(void)
+{
+    struct timespec start, now;
+    struct buf      *buf;
+    long            elapsed;
 
-        if (prev_state != buf->states[line_i]) {
-            if (num_lines == 1) {
-                num_lines++;
+    check_mapped_files();
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (buf = FirstBuffer; buf != NULL; buf = buf->next) {
+        while (buf->is_loading || buf->hl_line < buf->text.num_lines) {
+            if (buf->is_loading) {
+                load_buffer_lines(buf, LOAD_CHUNK_LINES);
+            } else {
+                highlight_up_to(buf, buf->hl_line + HIGHLIGHT_CHUNK_LINES);
+            }
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            elapsed = (now.tv_sec - start.tv_sec) * 1000 +
+                (now.tv_nsec - start.tv_nsec) / 1000000;
+            if (elapsed >= UPDATE_TIME_SLICE) {
+                return true;
             }
         }
-        state = buf->states[line_i];
     }
+    return false;
 }
 
 size_t get_next_paren_index(const struct buf *buf, const struct pos *pos)
@@ -1096,6 +2270,7 @@ size_t get_paren(struct buf *buf, const struct pos *pos)
 {
     size_t          first_i, index;
 
+    flush_batch(buf);
     first_i = get_paren_line(buf, pos->line);
     index = first_i;
     while (index < buf->num_parens &&
@@ -1175,3 +2350,34 @@ size_t get_matching_paren(struct buf *buf, size_t paren_i)
     /* there was no matching parenthesis */
     return SIZE_MAX;
 }
+
+size_t find_matching_paren(struct buf *buf, size_t paren_i)
+{
+    int             type;
+    size_t          index, c;
+
+    type = buf->parens[paren_i].type;
+    if (!(type & FOPEN_PAREN)) {
+        /* all lines before a highlighted line are highlighted as well */
+        return get_matching_paren(buf, paren_i);
+    }
+
+    /* find the closing parenthesis, highlighting further lines only when the
+     * known parentheses run out
+     */
+    for (index = paren_i + 1, c = 1; ; index++) {
+        while (index == buf->num_parens) {
+            if (buf->hl_line >= buf->text.num_lines) {
+                return SIZE_MAX;
+            }
+            highlight_up_to(buf, buf->hl_line + HIGHLIGHT_CHUNK_LINES);
+        }
+        if (((type ^ buf->parens[index].type) & ~FOPEN_PAREN) == 0) {
+            if ((buf->parens[index].type & FOPEN_PAREN)) {
+                c++;
+            } else if (--c == 0) {
+                return index;
+            }
+        }
+    }
+}
@@ -7,6 +7,7 @@
 
 #include "purec.h"
 #include "regex.h"
+#include "xalloc.h"
 
 #include <stdbool.h>
 #include <stdlib.h>
@@ -19,14 +20,23 @@
 
 /**
  * This undo works by caching small text segments and writing huge text segments
- * to a file. If the `lines` variable of a segment is `NULL`, then that means
+ * to a file. If the `data` variable of a segment is `NULL`, then that means
  * the contents of that segments are within the file and can be located using
- * `file_pos`. To get these lines, `seg = load_undo_data(i)` should be used and
+ * `file_off`. To get these lines, `load_undo_data(seg)` should be used and
  * then after finished, `unload_undo_data(seg)`.
+ *
+ * The file is only ever appended to. Segments that compress well are stored
+ * compressed and decompressed on load, other segments are mapped into memory
+ * directly.
+ *
+ * Segments read from an undo history file stay within that file in the same
+ * way. Their `lines` are only created when they are loaded the first time.
  */
 extern struct undo {
     /// the off memory file for large text segments
     FILE *fp;
+    /// number of bytes written to `fp`
+    off_t file_size;
     /// the undo data segments
     struct undo_seg {
         /// the raw string data
@@ -37,15 +47,27 @@ extern struct undo {
         struct line *lines;
         /// number of lines
         line_t num_lines;
-        /// position within the file `fp`
-        fpos_t file_pos;
+        /// the file holding the data, `Undo.fp` or an undo history file
+        FILE *fp;
+        /// offset within the file `fp` or -1 if the segment is kept in memory
+        off_t file_off;
+        /// length of the compressed data in the file or 0 if it is stored raw
+        size_t comp_len;
+        /// whether `data` is mapped into memory rather than allocated
+        bool is_mapped;
         /// how many times this segment was loaded without unloading
         size_t load_count;
+        /// hash of `data`
+        uint64_t hash;
     } **segments;
     /// number of undo segments
     size_t num_segments;
     /// number of allocated undo segments
     size_t a_segments;
+    /// the segments indexed by their hash, `NULL` for empty slots
+    struct undo_seg **table;
+    /// number of slots in `table`, this is a power of two
+    size_t a_table;
 } Undo;
 
 /// whether an undo/redo should stop at this event
@@ -70,8 +92,15 @@ extern struct undo {
  * valid for the first and last event respectively in a transient chain.
  * A transient chain start with an event that has the transient flag on and
  * ends at the first event without the transient flag.
+ *
+ * The events form a tree through `parent`. Making a change after undoing does
+ * not throw away the undone events, they stay as a branch of the tree.
  */
 struct undo_event {
+    /// the event before this one or `NULL` if this is a first event
+    struct undo_event *parent;
+    /// index within the `history` of the buffer
+    size_t seq;
     /// flags of this event
     int flags;
     /// time of the event
@@ -97,6 +126,111 @@ struct match {
     size_t num;
 };
 
+/// the most line ranges a buffer remembers as changed, more are joined
+#define MAX_DAMAGE  8
+
+/**
+ * A range of lines.
+ */
+struct line_range {
+    /// the first line
+    line_t from;
+    /// the end of the range (exclusive)
+    line_t to;
+};
+
+/// the number of lines whose layout a buffer keeps, see `get_line_layout()`
+#define LAYOUT_CACHE_SIZE   256
+
+/* kinds of layout runs */
+/// glyphs of the same highlight group
+#define RUN_TEXT        0
+/// trailing spaces, shown as `·`
+#define RUN_BLANK       1
+/// a trailing tab, shown as `»`
+#define RUN_TAB         2
+/// a byte that is not valid utf8, shown as `?`
+#define RUN_ERROR       3
+/// a control character, shown as `^X`
+#define RUN_CONTROL     4
+
+/**
+ * A run of glyphs that are displayed the same way.
+ */
+struct layout_run {
+    /// the index of the first byte within the line
+    col_t col;
+    /// the number of bytes
+    col_t n;
+    /// the visual column the run starts at
+    col_t x;
+    /// the visual width of the run
+    col_t w;
+    /// the kind of the run (`RUN_*`)
+    unsigned char kind;
+    /// the highlight group to draw the run with
+    unsigned char hi;
+};
+
+/**
+ * The display layout of a line, this does not depend on the scrolling, so it
+ * can be shared by all frames showing the line.
+ */
+struct line_layout {
+    /// the line this layout belongs to, -1 if it is unused
+    line_t line_i;
+    /// the tab size the layout was made with
+    col_t tab_size;
+    /// the visual width of the leading blanks
+    col_t indent;
+    /// the runs of the line, tabs that are not trailing are left out
+    struct layout_run *runs;
+    /// the number of runs
+    size_t num_runs;
+    /// the number of allocated runs
+    size_t a_runs;
+};
+
+/// the number of bytes between two checkpoints of a column index, shorter
+/// lines are not indexed
+#define COL_INDEX_STEP      256
+
+/// the number of lines whose column index a buffer keeps
+#define COL_INDEX_CACHE_SIZE 32
+
+/**
+ * A glyph of a line with its visual column.
+ */
+struct col_checkpoint {
+    /// the index of the glyph
+    col_t col;
+    /// the visual column of the glyph
+    size_t x;
+};
+
+/**
+ * Maps byte indexes of a long line to visual columns and back, see
+ * `get_line_advance()` and `get_line_index()`.
+ */
+struct col_index {
+    /// the line this index belongs to, -1 if it is unused
+    line_t line_i;
+    /// the tab size the index was made with
+    col_t tab_size;
+    /// whether the line is only printable ascii, then the visual column is
+    /// the same as the index and there are no checkpoints
+    bool is_plain;
+    /// whether the visual columns never go back, otherwise the checkpoints can
+    /// not be searched by visual column
+    bool is_ordered;
+    /// the first glyph at or after every `COL_INDEX_STEP` bytes
+    struct col_checkpoint *points;
+    /// the number of checkpoints
+    size_t num_points;
+    /// the number of allocated checkpoints
+    size_t a_points;
+};
+
 #define FOPEN_PAREN 0x10000000
 
 struct paren {
@@ -109,6 +243,19 @@ struct paren {
     int type;
 };
 
+/**
+ * A run of bytes that share the same highlight group.
+ *
+ * The runs of a line are stored back to back and end with a run of length 0.
+ * Runs longer than `UCHAR_MAX` are split into multiple runs.
+ */
+struct hi_span {
+    /// the number of bytes in this run
+    unsigned char n;
+    /// the highlight group of the run (`HI_*`)
+    unsigned char hi;
+};
+
 /**
  * After buffer creation, it is guaranteed that `num_lines` will always be at
  * least 1 and never 0.
@@ -144,8 +291,13 @@ struct buf {
     struct file_rule file;
     /// last statistics of the file
     struct stat st;
+    /// hash of the lines as they were loaded, see `load_undo_history()`
+    uint64_t load_hash;
     /// the event index at the time of saving
     size_t save_event_i;
+    /// whether another process changed the mapped file, the unedited lines
+    /// then can not be trusted and writing is refused until `:e!`
+    bool is_stale;
 
     /// saved cursor position
     struct pos save_cur;
@@ -160,19 +312,80 @@ struct buf {
 
     /// the text within the buffer
     struct text text;
-    /// states at the start of each line
+    /// whether `text.orig` is still being split into lines
+    bool is_loading;
+    /// the offset into `text.orig` where loading continues
+    size_t load_off;
+    /// states at the end of each line
     size_t *states;
-    /// attributes
-    int **attribs;
-
-    /// events that occured
-    struct undo_event *events;
-    /// number of events that occured
+    /// highlight runs of each line, `NULL` for empty lines
+    struct hi_span **attribs;
+    /// the memory the highlight runs are allocated from
+    struct slab attrib_slab;
+    /// lines before this line have valid states and attributes
+    line_t hl_line;
+    /// how many batches are open, see `begin_batch()`
+    unsigned batch_depth;
+    /// the lines changed within the batch, empty if `batch_from > batch_to`
+    line_t batch_from, batch_to;
+    /// the number of lines added within the batch, negative if lines were
+    /// removed
+    line_t batch_shift;
+    /// where the insertion that is still being typed starts, see
+    /// `type_char()`
+    struct pos ins_pos;
+    /// number of bytes typed so far, 0 if there is no such insertion
+    col_t ins_n;
+    /// number of bytes allocated for the line that is typed into
+    col_t a_ins;
+    /// the lines that changed since the last rendering, see `damage_lines()`
+    struct line_range damage[MAX_DAMAGE];
+    /// the number of ranges in `damage`
+    size_t num_damage;
+    /// layouts of recently rendered lines, indexed by the line modulo
+    /// `LAYOUT_CACHE_SIZE`
+    struct line_layout *layouts;
+    /// column indexes of recently used long lines, indexed by the line modulo
+    /// `COL_INDEX_CACHE_SIZE`
+    struct col_index *col_indexes;
+
+    /// all events in the order they were made
+    struct undo_event **history;
+    /// number of events in `history`
+    size_t num_history;
+    /// number of allocated events in `history`
+    size_t a_history;
+    /// the events of the current branch, from the first to the newest
+    struct undo_event **events;
+    /// number of events on the current branch
     size_t num_events;
     /// number of allocated events
     size_t a_events;
     /// current event index (1 based)
     size_t event_i;
+    /// whether the undo history on disk was already considered
+    bool is_history_loaded;
+    /// the undo history file as it was last read or written, `NULL` if there
+    /// is none
+    FILE *history_fp;
+    /// the segments whose data is within `history_fp`, sorted by the address
+    /// of the segment
+    struct history_ref {
+        /// the segment, this must be the first member
+        struct undo_seg *seg;
+        /// offset of the data within `history_fp`
+        uint64_t file_off;
+        /// length of the compressed data or 0 if it is stored raw
+        uint64_t comp_len;
+    } *history_refs;
+    /// number of segments in `history_refs`
+    size_t num_history_refs;
+    /// number of allocated segments in `history_refs`
+    size_t a_history_refs;
+    /// the size of `history_fp` after the last write, new data goes after it
+    uint64_t history_size;
+    /// the number of bytes within `history_fp` that are no longer used
+    uint64_t history_garbage;
 
     /// all parentheses within the buffer
     struct paren *parens;
@@ -189,8 +402,8 @@ struct buf {
     size_t a_matches;
     /// last search pattern
     char *search_pat;
-    /// the parsed search pattern
-    struct regex_group *search_group;
+    /// the compiled search pattern
+    struct regex_prog *search_prog;
 
     /// next buffer in the buffer linked list
     struct buf *next;
@@ -239,6 +452,35 @@ void set_language(struct buf *buf, size_t lang);
  */
 int init_load_buffer(struct buf *buf);
 
+/**
+ * Adds the next lines of a buffer that is still loading.
+ *
+ * Large files are not split into lines all at once, only the first lines are
+ * loaded by `init_load_buffer()` and the rest is added while the user is idle.
+ *
+ * @param buf       The buffer to continue loading.
+ * @param max_lines The maximum number of lines to add.
+ */
+void load_buffer_lines(struct buf *buf, line_t max_lines);
+
+/**
+ * Loads all remaining lines of a buffer.
+ *
+ * This must be called before a loading buffer is modified or written.
+ *
+ * @param buf   The buffer to finish loading.
+ */
+void finish_loading(struct buf *buf);
+
+/**
+ * Continues loading and highlighting buffers for a short time slice.
+ *
+ * This is called while the user is idle.
+ *
+ * @return Whether there is work left.
+ */
+bool update_buffers(void);
+
 /**
  * Deletes a buffer and removes it from the buffer list.
  *
@@ -290,6 +532,52 @@ size_t get_buffer_count(void);
  */
 size_t write_file(struct buf *buf, line_t from, line_t to, FILE *fp);
 
+/**
+ * Makes sure no buffer still has the given file mapped into memory.
+ *
+ * This must be called before a file is truncated or overwritten because the
+ * unmodified lines of a buffer may point directly into the file. A buffer
+ * whose mapping was changed by another process is marked stale instead of
+ * taking over the new bytes, see `check_buffer_mapping()`.
+ *
+ * @param path  The path of the file that is about to change.
+ */
+void unmap_file(const char *path);
+
+/**
+ * Checks if another process changed the mapped file of a buffer.
+ *
+ * If so, the text is copied out of the mapping and the buffer is marked as
+ * stale: its unedited lines now hold bytes of the new file, or zeros where it
+ * was truncated. A stale buffer is not written and does not use its undo
+ * history until it is read again with `reload_buffer()`.
+ *
+ * @param buf   The buffer to check.
+ *
+ * @return Whether the buffer is stale.
+ */
+bool check_buffer_mapping(struct buf *buf);
+
+/**
+ * Checks the mapped files of all buffers, see `check_buffer_mapping()`.
+ *
+ * This is done while the user is idle, at most every
+ * `MAPPING_CHECK_INTERVAL` milliseconds. The user is told which file changed.
+ */
+void check_mapped_files(void);
+
+/**
+ * Replaces the text of a buffer with the current contents of its file.
+ *
+ * This is one change that can be undone. The buffer counts as saved
+ * afterwards and is no longer stale.
+ *
+ * @param buf   The buffer to reload, it must have a path.
+ *
+ * @return 0 on success, -1 if the file could not be opened.
+ */
+int reload_buffer(struct buf *buf);
+
 /**
  * NOTE: The below functions that return a `struct undo_event *` do not set the
  * `cur_undo` and `cur_redo` values, they must be set by the caller.
@@ -440,7 +728,36 @@ struct undo_event *_insert_block(struct buf *buf, const struct pos *pos,
 struct undo_event *break_line(struct buf *buf, const struct pos *pos);
 
 /**
- * Gets the first index of the match on the given line.
+ * Types a single byte into the buffer.
+ *
+ * Bytes typed one after another on the same line form a single insertion. It
+ * goes into the line right away but the event and the highlighting are only
+ * made when it is committed by `commit_insertion()`. The line keeps spare room
+ * while typing, so typing at the end of a line does not move or reallocate
+ * anything.
+ *
+ * WARNING: This function does NO clipping on `pos`.
+ *
+ * @param buf   The buffer to type into.
+ * @param pos   The position to type at.
+ * @param c     The byte to type.
+ */
+void type_char(struct buf *buf, const struct pos *pos, int c);
+
+/**
+ * Adds the event of the insertion that is still being typed and highlights
+ * its line again.
+ *
+ * All other functions that add an event do this first, it only needs to be
+ * called directly when the typing ends.
+ *
+ * @param buf   The buffer whose insertion to commit.
+ */
+void commit_insertion(struct buf *buf);
+
+/**
+ * Gets the first index of the match on the given line, an open batch is
+ * flushed first.
  *
  * @param buf       The buffer to look for the match.
  * @param line_i    The line to look for.
@@ -642,8 +959,7 @@ bool should_join(const struct undo_event *ev1, const struct undo_event *ev2);
 /**
  * Saves given lines.
  *
- * @param lines     The lines to save.
- * @param num_lines The number of lines to save.
+ * @param text  The lines to save, the segment takes them over.
  *
  * @return Allocated data segment.
  */
@@ -652,9 +968,14 @@ struct undo_seg *save_lines(struct text *text);
 /**
  * Loads the data of the given data segment.
  *
+ * If the data can not be read back from the undo file, an error is set and
+ * the segment stays unloaded.
+ *
  * @param seg   The data segment to load.
+ *
+ * @return 0 on success, -1 if the data could not be read.
  */
-void load_undo_data(struct undo_seg *seg);
+int load_undo_data(struct undo_seg *seg);
 
 /**
  * Cleans up after a call to `load_undo_data()`.
@@ -663,6 +984,38 @@ void load_undo_data(struct undo_seg *seg);
  */
 void unload_undo_data(struct undo_seg *seg);
 
+/**
+ * Writes the events of the buffer to its undo history file.
+ *
+ * The history file is within the cache directory and named after a hash of the
+ * path. It stores the path, the statistics and a hash of the text so that it
+ * is only used again for the exact same file. All branches of the event tree
+ * are written.
+ *
+ * Data already within the file is kept and only the new segments and the
+ * tables of events and segments are appended, the header is updated last.
+ * Once more than half the file is unused, or another process replaced it, the
+ * file is written again under a temporary name and then renamed. A failed
+ * write leaves the previous history intact.
+ *
+ * @param buf   The buffer whose history to write, it must have a path.
+ */
+void save_undo_history(struct buf *buf);
+
+/**
+ * Puts the undo history of the file in front of the buffer events.
+ *
+ * This only does something the first time it is called for a buffer and only
+ * if the file did not change since the history was saved. It must be called
+ * before the statistics of the buffer are updated.
+ *
+ * The text is not touched, only the events are read. Their data is read from
+ * the history file when an event is undone or redone.
+ *
+ * @param buf   The buffer whose history to load.
+ */
+void load_undo_history(struct buf *buf);
+
 /**
  * Adds an event to the buffer event list.
  *
@@ -705,6 +1058,45 @@ struct undo_event *undo_event(struct buf *buf);
  */
 struct undo_event *redo_event(struct buf *buf);
 
+/**
+ * Finds the state that is a number of changes before or after the current
+ * state. The changes are counted in the order they were made, regardless of
+ * the branch they are on.
+ *
+ * @param buf   The buffer whose events to use.
+ * @param count The number of changes, negative to go back.
+ *
+ * @return The last event of that state or `NULL` for the state before any
+ *         event.
+ */
+struct undo_event *get_event_by_count(struct buf *buf, long count);
+
+/**
+ * Finds the newest state that was made at or before a given time.
+ *
+ * @param buf   The buffer whose events to use.
+ * @param time  The time of the state.
+ *
+ * @return The last event of that state or `NULL` for the state before any
+ *         event.
+ */
+struct undo_event *get_event_by_time(struct buf *buf, time_t time);
+
+/**
+ * Changes the text to the state after an event on any branch.
+ *
+ * This undoes the events up to the closest common event and then redoes the
+ * events of the other branch. The changed lines are highlighted once at the
+ * end.
+ *
+ * @param buf   The buffer to change.
+ * @param ev    The event to go to or `NULL` for the state before any event.
+ * @param p_cur Set to where the cursor should go if any event was applied.
+ *
+ * @return The number of events that were undone or redone.
+ */
+size_t goto_event(struct buf *buf, struct undo_event *ev, struct pos *p_cur);
+
 /**
  * Performs the action given event defines.
  *
@@ -734,6 +1126,44 @@ struct undo_event *perform_event(struct buf *buf, const struct undo_event *ev)
  */
 size_t set_pattern(struct buf *buf, const char *pat);
 
+/**
+ * Starts a batch of changes.
+ *
+ * Until the matching `end_batch()`, changed lines are only collected and not
+ * highlighted or searched. The states, attributes, parentheses and matches are
+ * not moved either, the changed lines are collected into one range and
+ * everything after it is moved once at the end.
+ *
+ * So within a batch, these still refer to the lines before the batch and
+ * everything that reads or changes them must call `flush_batch()` first.
+ * `highlight_up_to()`, `get_match_line()`, `get_paren()`, `get_line_layout()`
+ * and `set_pattern()` do so themselves.
+ *
+ * Batches can be nested.
+ *
+ * @param buf   The buffer to change.
+ */
+void begin_batch(struct buf *buf);
+
+/**
+ * Moves the highlighting and matches and highlights the lines changed so far
+ * within a batch. The batch stays open.
+ *
+ * This must be called before using the states, attributes, parentheses or
+ * matches of a buffer that may be within a batch.
+ *
+ * @param buf   The buffer that was changed.
+ */
+void flush_batch(struct buf *buf);
+
+/**
+ * Ends a batch of changes, the outermost batch highlights and searches all
+ * changed lines in one pass.
+ *
+ * @param buf   The buffer that was changed.
+ */
+void end_batch(struct buf *buf);
+
 /**
  * Rehighlights given lines.
  *
@@ -743,6 +1173,76 @@ size_t set_pattern(struct buf *buf, const char *pat);
  */
 void rehighlight_lines(struct buf *buf, line_t line_i, line_t num_lines);
 
+/**
+ * Marks lines as changed, so that the frames showing them draw them again.
+ *
+ * Overlapping and adjacent ranges are joined, when there are too many ranges,
+ * all are joined into one.
+ *
+ * @param buf   The buffer containing the lines.
+ * @param from  The first changed line.
+ * @param to    The end of the changed lines (exclusive), use `LINE_MAX` when
+ *              all following lines moved.
+ */
+void damage_lines(struct buf *buf, line_t from, line_t to);
+
+/**
+ * Gets the display layout of a line.
+ *
+ * The layout is kept until the line changes, so rendering it again or within
+ * another frame does not need to decode the line again. The line must be
+ * highlighted, an open batch is flushed first.
+ *
+ * @param buf       The buffer containing the line.
+ * @param line_i    The line to get the layout of.
+ *
+ * @return The layout, valid until the buffer changes or the next call.
+ */
+struct line_layout *get_line_layout(struct buf *buf, line_t line_i);
+
+/**
+ * Gets the x position of an index within a line.
+ *
+ * This is the same as `get_advance()` with the tab size of the buffer but
+ * long lines are indexed, so it does not need to go through the whole line.
+ *
+ * @param buf       The buffer containing the line.
+ * @param line_i    The line.
+ * @param n         The length of the line to consider, at most the length of
+ *                  the line.
+ * @param i         The index.
+ *
+ * @return The x position.
+ */
+size_t get_line_advance(struct buf *buf, line_t line_i, size_t n, size_t i);
+
+/**
+ * Gets the index at an x position within a line.
+ *
+ * This is the same as `get_index()` with the tab size of the buffer but long
+ * lines are indexed, so it does not need to go through the whole line.
+ *
+ * @param buf       The buffer containing the line.
+ * @param line_i    The line.
+ * @param n         The length of the line to consider, at most the length of
+ *                  the line.
+ * @param x         The x position.
+ *
+ * @return The index at given x position.
+ */
+size_t get_line_index(struct buf *buf, line_t line_i, size_t n, size_t x);
+
+/**
+ * Makes sure that all lines up to given line are highlighted.
+ *
+ * Lines are only highlighted when they are needed, for example for rendering.
+ * The lines are highlighted from the last valid state onwards.
+ *
+ * @param buf       The buffer to highlight.
+ * @param line_i    The last line that must be highlighted.
+ */
+void highlight_up_to(struct buf *buf, line_t line_i);
+
 /**
  * Gets the index where the given position should be inserted within the
  * paranthesis list.
@@ -764,7 +1264,7 @@ size_t get_next_paren_index(const struct buf *buf, const struct pos *pos);
 void add_paren(struct buf *buf, const struct pos *pos, int type);
 
 /**
- * Gets the parenthesis at given position.
+ * Gets the parenthesis at given position, an open batch is flushed first.
  *
  * @param buf   The buffer to get the parenthesis from.
  * @param pos   The position of the parenthesis.
@@ -792,4 +1292,19 @@ void clear_parens(struct buf *buf, line_t line_i);
  */
 size_t get_matching_paren(struct buf *buf, size_t paren_i);
 
+/**
+ * Finds the matching parenthesis, highlighting more lines if needed.
+ *
+ * Unlike `get_matching_paren()`, this does not stop at the last highlighted
+ * line but highlights the following lines in chunks until the match is found
+ * or the end of the buffer is reached.
+ *
+ * @param buf       The buffer to find the matching parenthesis in, it must be
+ *                  highlighted up to the line of the parenthesis.
+ * @param paren_i   The index of the parenthesis to find a match for.
+ *
+ * @return The matching parenthesis or `SIZE_MAX` if none was found.
+ */
+size_t find_matching_paren(struct buf *buf, size_t paren_i);
+
 #endif
@@ -79,6 +79,9 @@ static const struct cmd {
     { "cq", ACCEPTS_NUMBER, cmd_cquit, 0 },
     { "cquit", ACCEPTS_NUMBER, cmd_cquit, 0 },
 
+    { "ea", ACCEPTS_NUMBER, cmd_earlier, 0 },
+    { "earlier", ACCEPTS_NUMBER, cmd_earlier, 0 },
+
     { "e", 0, cmd_edit, TAB_PATH },
     { "edit", 0, cmd_edit, TAB_PATH },
 
@@ -92,11 +95,16 @@ static const struct cmd {
     { "hi", 0, cmd_highlight, TAB_HIGHLIGHT },
     { "highlight", 0, cmd_highlight, TAB_HIGHLIGHT },
 
+    { "lat", ACCEPTS_NUMBER, cmd_later, 0 },
+    { "later", ACCEPTS_NUMBER, cmd_later, 0 },
+
     { "noh", 0, cmd_nohighlight, 0 },
     { "nohighlight", 0, cmd_nohighlight, 0 },
 
     { "make", 0, cmd_make, 0 },
 
+    { "memstats", 0, cmd_memstats, 0 },
+
     { "q", 0, cmd_quit, 0 },
     { "qa", 0, cmd_quit_all, 0 },
     { "qall", 0, cmd_quit_all, 0 },
@@ -263,6 +271,7 @@ int run_command(char *s_cmd)
     FILE                *pp;
     struct buf          *buf;
     line_t              i;
+    struct line         *line;
     size_t              prev_num_sigs;
 
     s_cmd += strspn(s_cmd, " \t");
@@ -270,6 +279,9 @@ int run_command(char *s_cmd)
         return 0;
     }
 
+    /* commands may change anything, like the colors or the tab size */
+    Core.is_screen_dirty = true;
+
     if (s_cmd[0] == '%') {
         data.has_range = true;
         data.from = 0;
@@ -317,7 +329,8 @@ int run_command(char *s_cmd)
         buf = SelFrame->buf;
         data.to = MIN(data.to, (size_t) buf->text.num_lines - 1);
         for (i = data.from; i <= (line_t) data.to; i++) {
-            fwrite(buf->text.lines[i].s, buf->text.lines[i].n, 1, pp);
+            line = get_text_line(&buf->text, i);
+            fwrite(line->s, line->n, 1, pp);
             fputc('\n', pp);
         }
         pclose(pp);
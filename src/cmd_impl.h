@@ -121,6 +121,11 @@ static int save_buffer(struct cmd_data *cd, struct buf *buf)
     struct stat     st;
     size_t          num_bytes;
 
+    /* the unedited lines may hold bytes of another process */
+    if (check_buffer_mapping(buf)) {
+        return -1;
+    }
+
     file = cd->arg;
 
     if (file[0] == '\0') {
@@ -154,6 +159,12 @@ static int save_buffer(struct cmd_data *cd, struct buf *buf)
         cd->to = LINE_MAX;
     }
 
+    if (file == buf->path) {
+        /* the history is only valid for the file before overwriting it */
+        load_undo_history(buf);
+    }
+
+    unmap_file(file);
     fp = fopen(file, "w");
     if (fp == NULL) {
         set_error("could not open '%s': %s", file, strerror(errno));
@@ -166,6 +177,7 @@ static int save_buffer(struct cmd_data *cd, struct buf *buf)
     if (file == buf->path) {
         stat(buf->path, &buf->st);
         buf->save_event_i = buf->event_i;
+        save_undo_history(buf);
     }
 
     if (num_bytes == 0) {
@@ -186,10 +198,107 @@ int cmd_cquit(struct cmd_data *cd)
     return 0;
 }
 
+/**
+ * Moves through the undo history by a number of changes or by a time span.
+ *
+ * The argument is either a count or a count followed by `s`, `m`, `h` or `d`
+ * for seconds, minutes, hours or days.
+ *
+ * @param cd    The command data.
+ * @param dir   -1 to go back in time and 1 to go forward.
+ *
+ * @return 0 on success, -1 on a bad argument.
+ */
+static int travel_history(struct cmd_data *cd, long dir)
+{
+    struct buf      *buf;
+    unsigned long   n;
+    char            *end;
+    long            unit;
+    struct undo_event *ev;
+    time_t          t;
+    struct pos      cur;
+
+    buf = SelFrame->buf;
+    if (cd->arg[0] == '\0') {
+        n = cd->has_number ? cd->from : 1;
+        unit = 0;
+    } else {
+        n = strtoul(cd->arg, &end, 10);
+        if (end == cd->arg) {
+            set_error("expected a count or a time");
+            return -1;
+        }
+        switch (end[0]) {
+        case '\0':
+            unit = 0;
+            break;
+        case 's':
+            unit = 1;
+            break;
+        case 'm':
+            unit = 60;
+            break;
+        case 'h':
+            unit = 60 * 60;
+            break;
+        case 'd':
+            unit = 24 * 60 * 60;
+            break;
+        default:
+            set_error("invalid time unit '%c'", end[0]);
+            return -1;
+        }
+    }
+
+    load_undo_history(buf);
+
+    if (unit == 0) {
+        ev = get_event_by_count(buf, dir * (long) n);
+    } else {
+        if (buf->event_i > 0) {
+            t = buf->events[buf->event_i - 1]->time;
+        } else if (buf->num_history > 0) {
+            t = buf->history[0]->time - 1;
+        } else {
+            return 0;
+        }
+        ev = get_event_by_time(buf, t + dir * (long) n * unit);
+    }
+
+    if (goto_event(buf, ev, &cur) > 0) {
+        set_cursor(SelFrame, &cur);
+    }
+    return 0;
+}
+
+int cmd_earlier(struct cmd_data *cd)
+{
+    return travel_history(cd, -1);
+}
+
 int cmd_edit(struct cmd_data *cd)
 {
     char *entry;
     struct buf *buf = NULL;
+    struct frame *frame;
+
+    if (cd->arg[0] == '\0' && cd->force) {
+        buf = SelFrame->buf;
+        if (buf->path == NULL) {
+            set_error("no file name");
+            return -1;
+        }
+        if (reload_buffer(buf) == -1) {
+            return -1;
+        }
+        for (frame = FirstFrame; frame != NULL; frame = frame->next) {
+            if (frame->buf == buf) {
+                adjust_cursor(frame);
+            }
+        }
+        return 0;
+    }
 
     if (cd->arg[0] == '\0') {
         entry = choose_file(NULL);
@@ -319,14 +428,20 @@ int cmd_highlight(struct cmd_data *cd)
     return -1;
 }
 
+int cmd_later(struct cmd_data *cd)
+{
+    return travel_history(cd, 1);
+}
+
 int cmd_nohighlight(struct cmd_data *cd)
 {
     (void) cd;
     SelFrame->buf->num_matches = 0;
+    damage_lines(SelFrame->buf, 0, LINE_MAX);
     free(SelFrame->buf->search_pat);
     SelFrame->buf->search_pat = NULL;
-    free_regex_group(SelFrame->buf->search_group);
-    SelFrame->buf->search_group = NULL;
+    free_regex_prog(SelFrame->buf->search_prog);
+    SelFrame->buf->search_prog = NULL;
     return 0;
 }
 
@@ -473,6 +588,148 @@ int cmd_make(struct cmd_data *cd)
     return 0;
 }
 
+#ifdef XALLOC_STATS
+
+/// the subsystems shown by `:memstats`, the last one takes all other sites
+static const char *const MemstatsNames[] = {
+    "text", "undo", "attribs", "matches", "parser", "regex", "other"
+};
+
+/// maps call sites to the subsystem they allocate for
+static const struct memstats_rule {
+    /// the file name of the call site
+    const char *file;
+    /// a part of the function name or `NULL` for all functions
+    const char *func;
+    /// the index of the subsystem in `MemstatsNames`
+    size_t group;
+} MemstatsRules[] = {
+    { "text.c", NULL, 0 },
+    { "buf.c", "type_char", 0 },
+    { "buf.c", "insertion", 0 },
+    { "buf.c", "indent", 0 },
+    { "buf.c", "break_line", 0 },
+    { "buf.c", "change_", 0 },
+    { "undo.c", NULL, 1 },
+    { "buf.c", "highlight", 2 },
+    { "buf.c", "line_marks", 2 },
+    { "buf.c", "line_growth", 2 },
+    { "buf.c", "match", 3 },
+    { "buf.c", "search", 3 },
+    { "buf.c", "pattern", 3 },
+    { "parse.c", NULL, 4 },
+    { "eval.c", NULL, 4 },
+    { "regex.c", NULL, 5 },
+};
+
+/// the number of sites listed per subsystem
+#define MEMSTATS_TOP    5
+
+/**
+ * Gets the subsystem a call site allocates for.
+ *
+ * @param site  The call site.
+ *
+ * @return The index of the subsystem in `MemstatsNames`.
+ */
+static size_t get_memstats_group(const struct xalloc_site *site)
+{
+    const char      *file;
+    size_t          i;
+
+    file = strrchr(site->file, '/');
+    file = file == NULL ? site->file : file + 1;
+    for (i = 0; i < ARRAY_SIZE(MemstatsRules); i++) {
+        if (strcmp(MemstatsRules[i].file, file) == 0 &&
+                (MemstatsRules[i].func == NULL ||
+                 strstr(site->func, MemstatsRules[i].func) != NULL)) {
+            return MemstatsRules[i].group;
+        }
+    }
+    return ARRAY_SIZE(MemstatsNames) - 1;
+}
+
+int cmd_memstats(struct cmd_data *cd)
+{
+    struct xalloc_site  *sites;
+    size_t              num_sites;
+    size_t              *groups;
+    size_t              g, i, n;
+    size_t              calls, bytes, live;
+    char                site[128];
+    FILE                *fp;
+    struct buf          *buf;
+    struct pos          pos;
+
+    (void) cd;
+    fp = tmpfile();
+    if (fp == NULL) {
+        set_error("tmpfile: %s", strerror(errno));
+        return -1;
+    }
+
+    sites = get_xalloc_sites(&num_sites);
+    groups = xreallocarray(NULL, num_sites, sizeof(*groups));
+    for (i = 0; i < num_sites; i++) {
+        groups[i] = get_memstats_group(&sites[i]);
+    }
+
+    fprintf(fp, "%-40s %10s %14s %14s\n", "subsystem", "calls", "bytes",
+            "live");
+    for (g = 0; g < ARRAY_SIZE(MemstatsNames); g++) {
+        calls = 0;
+        bytes = 0;
+        live = 0;
+        for (i = 0; i < num_sites; i++) {
+            if (groups[i] == g) {
+                calls += sites[i].calls;
+                bytes += sites[i].bytes;
+                live += sites[i].live;
+            }
+        }
+        fprintf(fp, "%-40s %10zu %14zu %14zu\n", MemstatsNames[g],
+                calls, bytes, live);
+    }
+
+    /* the sites are sorted by their live bytes */
+    for (g = 0; g < ARRAY_SIZE(MemstatsNames); g++) {
+        fprintf(fp, "\n%s:\n", MemstatsNames[g]);
+        for (i = 0, n = 0; i < num_sites && n < MEMSTATS_TOP; i++) {
+            if (groups[i] != g) {
+                continue;
+            }
+            snprintf(site, sizeof(site), "%s:%d %s", sites[i].file,
+                     sites[i].line, sites[i].func);
+            fprintf(fp, "%-40s %10zu %14zu %14zu\n", site,
+                    sites[i].calls, sites[i].bytes, sites[i].live);
+            n++;
+        }
+    }
+    free(groups);
+    free(sites);
+
+    rewind(fp);
+    buf = create_buffer(NULL);
+    pos.line = 0;
+    pos.col = 0;
+    (void) read_file(buf, &pos, fp);
+    fclose(fp);
+    buf->save_event_i = buf->event_i;
+    set_frame_buffer(SelFrame, buf);
+    return 0;
+}
+
+#else
+
+int cmd_memstats(struct cmd_data *cd)
+{
+    (void) cd;
+    set_error("allocation statistics need a build with XALLOC_STATS");
+    return -1;
+}
+
+#endif
+
 int cmd_quit(struct cmd_data *cd)
 {
     if (!cd->force && SelFrame->buf->save_event_i != SelFrame->buf->event_i) {
@@ -525,6 +782,57 @@ int cmd_read(struct cmd_data *cd)
     return 0;
 }
 
+/**
+ * Appends bytes to a growing string.
+ *
+ * @param p_s   The string to append to.
+ * @param p_n   The length of the string.
+ * @param p_a   The number of allocated bytes.
+ * @param b     The bytes to append.
+ * @param n     The number of bytes to append.
+ */
+static void append_bytes(char **p_s, size_t *p_n, size_t *p_a,
+                         const char *b, size_t n)
+{
+    if (n == 0) {
+        return;
+    }
+    if (*p_n + n > *p_a) {
+        *p_a *= 2;
+        *p_a += n;
+        *p_s = xrealloc(*p_s, *p_a);
+    }
+    memcpy(&(*p_s)[*p_n], b, n);
+    *p_n += n;
+}
+
+/**
+ * Appends the text between two positions of a buffer to a growing string.
+ *
+ * @param p_s   The string to append to.
+ * @param p_n   The length of the string.
+ * @param p_a   The number of allocated bytes.
+ * @param text  The text to take the bytes from.
+ * @param from  The start of the range.
+ * @param to    The end of the range.
+ */
+static void append_range(char **p_s, size_t *p_n, size_t *p_a,
+                         const struct text *text,
+                         const struct pos *from, const struct pos *to)
+{
+    line_t          i;
+    col_t           col;
+    struct line     *line;
+
+    for (i = from->line, col = from->col; i < to->line; i++, col = 0) {
+        line = get_text_line(text, i);
+        append_bytes(p_s, p_n, p_a, &line->s[col], line->n - col);
+        append_bytes(p_s, p_n, p_a, "\n", 1);
+    }
+    line = get_text_line(text, to->line);
+    append_bytes(p_s, p_n, p_a, &line->s[col], to->col - col);
+}
+
 int cmd_substitute(struct cmd_data *cd)
 {
     char                sep;
@@ -533,12 +841,20 @@ int cmd_substitute(struct cmd_data *cd)
     size_t              repl_len;
     struct buf          *buf;
     struct group        *group;
-    struct value        loc;
-    struct value        val;
+    char                *param;
+    struct eval_prog    *prog;
+    struct val_string   arg;
+    const struct value  *val;
     struct text         text;
-    struct text         res;
-    struct match        *m;
-    char                *pat;
+    size_t              first, last;
+    struct match        *m, *end;
+    struct pos          from, to, p;
+    struct pos          m_from, m_to;
+    line_t              num_lines, shift;
+    char                *s;
+    size_t              n, a;
+    char                *scratch;
+    size_t              num_scratch, a_scratch;
 
     sep = cd->arg[0];
     if (sep == '\0') {
@@ -568,59 +884,113 @@ int cmd_substitute(struct cmd_data *cd)
         if (group == NULL) {
             return -1;
         }
+        param = save_word("\\0", 2);
+        prog = compile_group(group, &param, 1);
+        repl = NULL;
+        repl_len = 0;
     } else {
-        group = NULL;
+        prog = NULL;
         repl = parse_string(&e1[1], &e1, &repl_len, '\0');
-        str_to_text(repl, repl_len, &text);
-        free(repl);
     }
     buf = SelFrame->buf;
+    /* loading lines while replacing would change the matches */
+    finish_loading(buf);
     set_pattern(buf, &cd->arg[1]);
-    m = &buf->matches[buf->num_matches];
-    /* make sure the buffer does not move the matches */
-    pat = buf->search_pat;
-    buf->search_pat = NULL;
-    buf->num_matches = 0;
-    /* do it in reverse */
-    for (; m != buf->matches; ) {
-        m--;
-        /* skip matches that are out of range */
-        if ((size_t) m->to.line < cd->from) {
+
+    /* find the matches within the range */
+    for (first = 0; first < buf->num_matches; first++) {
+        if ((size_t) buf->matches[first].to.line >= cd->from) {
             break;
         }
-        if ((size_t) m->from.line > cd->to) {
-            continue;
+    }
+    for (last = first; last < buf->num_matches; last++) {
+        if ((size_t) buf->matches[last].from.line > cd->to) {
+            break;
+        }
+    }
+    if (first == last) {
+        if (prog != NULL) {
+            free_eval_prog(prog);
         }
-        if (group != NULL) {
-            get_text(&buf->text, &m->from, &m->to, &text);
-            loc.type = VALUE_STRING;
-            loc.v.s.p = text_to_str(&text, &loc.v.s.n);
-            push_local_variable(save_word("\\0", 2), &loc);
-            (void) delete_range(buf, &m->from, &m->to);
-            if (compute_value(group, &val) == 0) {
-                if (val.type != VALUE_STRING) {
+        free(repl);
+        return 0;
+    }
+
+    /* each run of lines with matches is built in one go and then replaced with
+     * one deletion and one insertion, the lines in between stay untouched;
+     * within the batch the matches do not move, so the lines of a run are
+     * shifted by what the runs before it added
+     */
+    s = NULL;
+    a = 0;
+    scratch = NULL;
+    num_scratch = 0;
+    a_scratch = 0;
+    num_lines = buf->text.num_lines;
+    shift = 0;
+    begin_batch(buf);
+    for (m = &buf->matches[first]; m != &buf->matches[last]; m = end) {
+        for (end = m + 1; end != &buf->matches[last]; end++) {
+            if (end->from.line > end[-1].to.line + 1) {
+                break;
+            }
+        }
+
+        from.line = m->from.line + shift;
+        from.col = 0;
+        to.line = MIN(end[-1].to.line, num_lines - 1) + shift;
+        to.col = get_text_line(&buf->text, to.line)->n;
+
+        n = 0;
+        p = from;
+        for (; m != end; m++) {
+            m_from = m->from;
+            m_from.line += shift;
+            m_to = m->to;
+            m_to.line += shift;
+            append_range(&s, &n, &a, &buf->text, &p, &m_from);
+            p = is_point_before(&to, &m_to) ? to : m_to;
+            if (prog == NULL) {
+                append_bytes(&s, &n, &a, repl, repl_len);
+                continue;
+            }
+            /* bind \0 to the matched text, single line matches are viewed in
+             * place
+             */
+            if (m_from.line == p.line) {
+                arg.p = &get_text_line(&buf->text, p.line)->s[m_from.col];
+                arg.n = p.col - m_from.col;
+            } else {
+                num_scratch = 0;
+                append_range(&scratch, &num_scratch, &a_scratch, &buf->text,
+                             &m_from, &p);
+                arg.p = scratch;
+                arg.n = num_scratch;
+            }
+            if (run_eval_prog(prog, &arg, &val) == 0) {
+                if (val->type != VALUE_STRING) {
                     set_error("got value that is not a string");
                 } else {
-                    str_to_text(val.v.s.p, val.v.s.n, &res);
-                    (void) insert_lines(buf, &m->from, &res, 1);
-                    clear_text(&res);
+                    append_bytes(&s, &n, &a, val->v.s.p, val->v.s.n);
                 }
-                clear_value(&val);
             }
-            Parser.num_locals--;
-            clear_value(&Parser.locals[Parser.num_locals].value);
-            clear_text(&text);
-        } else {
-            (void) replace_lines(buf, &m->from, &m->to, &text);
         }
-    }
-    clip_column(SelFrame);
+        append_range(&s, &n, &a, &buf->text, &p, &to);
 
-    buf->search_pat = pat;
+        str_to_text(s, n, &text);
+        shift += text.num_lines - (to.line - from.line + 1);
+        (void) _replace_lines(buf, &from, &to, &text);
+    }
+    end_batch(buf);
 
-    if (group == NULL) {
-        clear_text(&text);
+    if (prog != NULL) {
+        free_eval_prog(prog);
     }
+    free(scratch);
+    free(repl);
+    free(s);
+
+    clip_column(SelFrame);
     return 0;
 }
 
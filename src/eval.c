@@ -872,3 +872,335 @@ int compute_value(struct group *group, struct value *value)
     }
     return compute_deep_value(group, value);
 }
+
+/* * * Compiled groups * * */
+
+/// push a number (`group->v.f`)
+#define INSN_NUMBER     0
+/// push a view of a string (`group->v.s`)
+#define INSN_STRING     1
+/// push a view of the argument at index `i`
+#define INSN_PARAM      2
+/// replace the top `n` values by the result of operator `i`
+#define INSN_OPERATE    3
+/// replace the top `n` values by the result of system function `i`
+#define INSN_CALL       4
+/// push the value of `group` computed by `compute_deep_value()`
+#define INSN_GROUP      5
+/// push the value of `group` computed by `compute_value()`
+#define INSN_ASSIGN     6
+
+struct eval_insn {
+    /// type of the instruction
+    int             type;
+    /// operator, parameter or function index
+    size_t          i;
+    /// number of values the instruction consumes
+    size_t          n;
+    /// the group the instruction takes its constant from
+    struct group    *group;
+};
+
+struct eval_prog {
+    /// the instructions in postfix order
+    struct eval_insn    *insns;
+    /// the number of instructions
+    size_t              num_insns;
+    /// the names of the parameters
+    char                **params;
+    /// the number of parameters
+    size_t              num_params;
+    /// whether the parameters must be visible as local variables
+    bool                needs_locals;
+    /// the value stack
+    struct value        *stack;
+    /// whether the values on the stack are owned by the program
+    bool                *is_owned;
+    /// the size of the value stack
+    size_t              max_stack;
+    /// the number of values left from the last run
+    size_t              num_stack;
+};
+
+static void emit_insn(struct eval_prog *prog, int type, size_t i, size_t n,
+                      struct group *group)
+{
+    struct eval_insn    *insn;
+
+    prog->insns = xreallocarray(prog->insns, prog->num_insns + 1,
+                                sizeof(*prog->insns));
+    insn = &prog->insns[prog->num_insns++];
+    insn->type = type;
+    insn->i = i;
+    insn->n = n;
+    insn->group = group;
+}
+
+static void compile_deep(struct eval_prog *prog, struct group *group,
+                         size_t depth);
+
+/**
+ * Compiles a fallback that lets the interpreter compute the group.
+ *
+ * Since variables are looked up dynamically, the parameters must then be
+ * pushed as local variables while running.
+ */
+static void compile_fallback(struct eval_prog *prog, int type,
+                             struct group *group, size_t depth)
+{
+    emit_insn(prog, type, 0, 0, group);
+    prog->needs_locals = true;
+    prog->max_stack = MAX(prog->max_stack, depth + 1);
+}
+
+/**
+ * Compiles the arguments of a function call from left to right.
+ *
+ * @return The number of arguments.
+ */
+static size_t compile_args(struct eval_prog *prog, struct group *arg,
+                           size_t depth)
+{
+    size_t          n;
+
+    if (arg->type != GROUP_COMMA) {
+        compile_deep(prog, arg, depth);
+        return 1;
+    }
+    n = compile_args(prog, arg->left, depth);
+    compile_deep(prog, arg->right, depth + n);
+    return n + 1;
+}
+
+static bool compile_implicit(struct eval_prog *prog, struct group *group,
+                             size_t depth)
+{
+    struct group    *left, *right, *arg, *a;
+    size_t          var_i;
+    size_t          num_args;
+    size_t          i;
+
+    left = group->left;
+    right = group->right;
+    if (left->type != GROUP_VARIABLE) {
+        return false;
+    }
+    /* the same rules as in compute_implicit() */
+    var_i = get_variable(left->v.w);
+    if (var_i != SIZE_MAX) {
+        if (right->type == GROUP_ROUND ||
+                Parser.vars[var_i].items[0].num_args > 0) {
+            /* user functions are left to the interpreter */
+            compile_fallback(prog, INSN_GROUP, group, depth);
+            return true;
+        }
+        return false;
+    }
+    if (!has_system_function(left->v.w)) {
+        return false;
+    }
+
+    arg = right->type == GROUP_ROUND ? right->left : right;
+    num_args = 1;
+    for (a = arg; a->type == GROUP_COMMA; a = a->left) {
+        num_args++;
+    }
+    for (i = 0; i < ARRAY_SIZE(system_functions); i++) {
+        if (strcmp(system_functions[i].name, left->v.w) == 0 &&
+                system_functions[i].num_args == num_args) {
+            break;
+        }
+    }
+    if (i == ARRAY_SIZE(system_functions)) {
+        /* let the interpreter report the error */
+        compile_fallback(prog, INSN_GROUP, group, depth);
+        return true;
+    }
+    (void) compile_args(prog, arg, depth);
+    emit_insn(prog, INSN_CALL, i, num_args, NULL);
+    return true;
+}
+
+static void compile_deep(struct eval_prog *prog, struct group *group,
+                         size_t depth)
+{
+    size_t          i;
+
+    switch (group->type) {
+    case GROUP_NUMBER:
+        emit_insn(prog, INSN_NUMBER, 0, 0, group);
+        prog->max_stack = MAX(prog->max_stack, depth + 1);
+        return;
+
+    case GROUP_STRING:
+        emit_insn(prog, INSN_STRING, 0, 0, group);
+        prog->max_stack = MAX(prog->max_stack, depth + 1);
+        return;
+
+    case GROUP_VARIABLE:
+        for (i = 0; i < prog->num_params; i++) {
+            if (prog->params[i] == group->v.w) {
+                emit_insn(prog, INSN_PARAM, i, 0, group);
+                prog->max_stack = MAX(prog->max_stack, depth + 1);
+                return;
+            }
+        }
+        compile_fallback(prog, INSN_GROUP, group, depth);
+        return;
+
+    case GROUP_IMPLICIT:
+        if (compile_implicit(prog, group, depth)) {
+            return;
+        }
+        compile_deep(prog, group->left, depth);
+        compile_deep(prog, group->right, depth + 1);
+        emit_insn(prog, INSN_OPERATE, GROUP_MULTIPLY, 2, NULL);
+        return;
+    }
+
+    if (group->left == NULL && group->right == NULL) {
+        compile_fallback(prog, INSN_GROUP, group, depth);
+        return;
+    }
+
+    compile_deep(prog, group->left, depth);
+    if (group->right == NULL) {
+        /* parentheses just pass their value */
+        if (group->type != GROUP_ROUND) {
+            emit_insn(prog, INSN_OPERATE, group->type, 1, NULL);
+        }
+    } else {
+        compile_deep(prog, group->right, depth + 1);
+        emit_insn(prog, INSN_OPERATE, group->type, 2, NULL);
+    }
+}
+
+struct eval_prog *compile_group(struct group *group, char *const *params,
+                                size_t num_params)
+{
+    struct eval_prog    *prog;
+
+    prog = xcalloc(1, sizeof(*prog));
+    prog->params = xmemdup(params, sizeof(*params) * num_params);
+    prog->num_params = num_params;
+    if (group->type == GROUP_EQUAL) {
+        /* this might be an assignment */
+        compile_fallback(prog, INSN_ASSIGN, group, 0);
+    } else {
+        compile_deep(prog, group, 0);
+    }
+    prog->stack = xreallocarray(NULL, prog->max_stack, sizeof(*prog->stack));
+    prog->is_owned = xreallocarray(NULL, prog->max_stack,
+                                   sizeof(*prog->is_owned));
+    return prog;
+}
+
+/**
+ * Frees the owned values on the stack above given size.
+ */
+static void drop_stack(struct eval_prog *prog, size_t to)
+{
+    while (prog->num_stack > to) {
+        prog->num_stack--;
+        if (prog->is_owned[prog->num_stack]) {
+            clear_value(&prog->stack[prog->num_stack]);
+        }
+    }
+}
+
+int run_eval_prog(struct eval_prog *prog, const struct val_string *args,
+                  const struct value **p_value)
+{
+    size_t              num_locals;
+    size_t              i;
+    struct eval_insn    *insn;
+    struct value        *v, r;
+    size_t              sp;
+    int                 err;
+
+    drop_stack(prog, 0);
+
+    num_locals = Parser.num_locals;
+    if (prog->needs_locals) {
+        for (i = 0; i < prog->num_params; i++) {
+            r.type = VALUE_STRING;
+            r.v.s = args[i];
+            push_local_variable(prog->params[i], &r);
+        }
+    }
+
+    err = 0;
+    for (i = 0; i < prog->num_insns; i++) {
+        insn = &prog->insns[i];
+        sp = prog->num_stack;
+        v = &prog->stack[sp];
+        switch (insn->type) {
+        case INSN_NUMBER:
+            v->type = VALUE_NUMBER;
+            v->v.f = insn->group->v.f;
+            prog->is_owned[sp] = false;
+            break;
+
+        case INSN_STRING:
+            v->type = VALUE_STRING;
+            v->v.s = insn->group->v.s;
+            prog->is_owned[sp] = false;
+            break;
+
+        case INSN_PARAM:
+            v->type = VALUE_STRING;
+            v->v.s = args[insn->i];
+            prog->is_owned[sp] = false;
+            break;
+
+        case INSN_OPERATE:
+        case INSN_CALL:
+            sp -= insn->n;
+            v = &prog->stack[sp];
+            if (insn->type == INSN_OPERATE) {
+                err = operate(&r, v, insn->n, insn->i);
+            } else {
+                err = system_functions[insn->i].opr(&r, v);
+            }
+            if (err != 0) {
+                break;
+            }
+            drop_stack(prog, sp);
+            *v = r;
+            prog->is_owned[sp] = true;
+            break;
+
+        case INSN_GROUP:
+            err = compute_deep_value(insn->group, v);
+            prog->is_owned[sp] = true;
+            break;
+
+        case INSN_ASSIGN:
+            err = compute_value(insn->group, v);
+            prog->is_owned[sp] = true;
+            break;
+        }
+        if (err != 0) {
+            break;
+        }
+        prog->num_stack = sp + 1;
+    }
+
+    Parser.num_locals = num_locals;
+    if (err != 0) {
+        drop_stack(prog, 0);
+        return -1;
+    }
+    *p_value = &prog->stack[0];
+    return 0;
+}
+
+void free_eval_prog(struct eval_prog *prog)
+{
+    drop_stack(prog, 0);
+    free(prog->insns);
+    free(prog->params);
+    free(prog->stack);
+    free(prog->is_owned);
+    free(prog);
+}
@@ -292,6 +292,8 @@ void update_screen_size(void)
 {
     struct frame *frame;
 
+    Core.is_screen_dirty = true;
+
     /* expand frames that have no frame on the right */
     for (frame = FirstFrame; frame != NULL; frame = frame->next) {
         if (is_frame_in(frame->x + frame->w, frame->y, INT_MAX / 2, frame->h)) {
@@ -456,6 +458,8 @@ void set_frame_buffer(struct frame *frame, struct buf *buf)
     frame->cur = buf->save_cur;
     frame->scroll = buf->save_scroll;
     frame->vct = frame->cur.col;
+    /* the old buffer might be freed and the new one take its address */
+    frame->view.buf = NULL;
 }
 
 void adjust_cursor(struct frame *frame)
@@ -467,9 +471,9 @@ void adjust_cursor(struct frame *frame)
     if (frame->cur.line >= buf->text.num_lines) {
         frame->cur.line = buf->text.num_lines - 1;
     }
-    line = &buf->text.lines[frame->cur.line];
-    frame->cur.col = get_index(line->s, get_mode_line_end(line),
-                               buf->rule.tab_size, frame->vct);
+    line = get_text_line(&buf->text, frame->cur.line);
+    frame->cur.col = get_line_index(buf, frame->cur.line,
+                                    get_mode_line_end(line), frame->vct);
 }
 
 int adjust_scroll(struct frame *frame)
@@ -481,9 +485,9 @@ int adjust_scroll(struct frame *frame)
 
     get_text_rect(frame, &x, &y, &w, &h);
 
-    line = &frame->buf->text.lines[frame->cur.line];
-    v_x = get_advance(line->s, line->n,
-                      frame->buf->rule.tab_size, frame->cur.col);
+    line = get_text_line(&frame->buf->text, frame->cur.line);
+    v_x = get_line_advance(frame->buf, frame->cur.line, line->n,
+                           frame->cur.col);
 
     if (v_x < frame->scroll.col) {
         frame->scroll.col = v_x;
@@ -519,9 +523,9 @@ col_t compute_vct(struct frame *frame, const struct pos *pos)
 {
     struct line *line;
 
-    line = &frame->buf->text.lines[pos->line];
-    return get_advance(line->s, get_mode_line_end(line),
-                       frame->buf->rule.tab_size, pos->col);
+    line = get_text_line(&frame->buf->text, pos->line);
+    return get_line_advance(frame->buf, pos->line, get_mode_line_end(line),
+                            pos->col);
 }
 
 int scroll_frame(struct frame *frame, line_t dist)
@@ -552,7 +556,7 @@ void clip_column(struct frame *frame)
 {
     col_t           end;
 
-    end = get_mode_line_end(&frame->buf->text.lines[frame->cur.line]);
+    end = get_mode_line_end(get_text_line(&frame->buf->text, frame->cur.line));
     frame->cur.col = MIN(frame->cur.col, end);
 }
 
@@ -570,13 +574,12 @@ void set_cursor(struct frame *frame, const struct pos *pos)
     }
 
     /* clip column */
-    line = &frame->buf->text.lines[new_cur.line];
+    line = get_text_line(&frame->buf->text, new_cur.line);
     n = get_mode_line_end(line);
     new_cur.col = MIN(new_cur.col, n);
 
     /* set vct */
-    frame->vct = get_advance(line->s, n,
-                             frame->buf->rule.tab_size, new_cur.col);
+    frame->vct = get_line_advance(frame->buf, new_cur.line, n, new_cur.col);
 
     frame->prev_cur = frame->cur;
     frame->cur = new_cur;
@@ -606,7 +609,7 @@ static int move_left(struct frame *frame)
         return 0;
     }
     frame->next_cur.line = frame->cur.line;
-    line = &frame->buf->text.lines[frame->next_cur.line];
+    line = get_text_line(&frame->buf->text, frame->next_cur.line);
     for (; Core.counter > 0; Core.counter--) {
         if (col == 0) {
             break;
@@ -624,7 +627,7 @@ static int move_right(struct frame *frame)
     struct line     *line;
 
     col = frame->cur.col;
-    line = &frame->buf->text.lines[frame->cur.line];
+    line = get_text_line(&frame->buf->text, frame->cur.line);
     if (col == line->n) {
         return 0;
     }
@@ -652,9 +655,9 @@ static int move_up(struct frame *frame)
     } else {
         frame->next_cur.line = frame->cur.line - Core.counter;
     }
-    line = &frame->buf->text.lines[frame->next_cur.line];
-    frame->next_cur.col = get_index(line->s, line->n,
-                                    frame->buf->rule.tab_size, frame->vct);
+    line = get_text_line(&frame->buf->text, frame->next_cur.line);
+    frame->next_cur.col = get_line_index(frame->buf, frame->next_cur.line,
+                                         line->n, frame->vct);
     frame->next_vct = frame->vct;
     return UPDATE_UI;
 }
@@ -673,9 +676,9 @@ static int move_down(struct frame *frame)
     if (frame->next_cur.line == frame->cur.line) {
         return 0;
     }
-    line = &frame->buf->text.lines[frame->next_cur.line];
-    frame->next_cur.col = get_index(line->s, line->n,
-                                    frame->buf->rule.tab_size, frame->vct);
+    line = get_text_line(&frame->buf->text, frame->next_cur.line);
+    frame->next_cur.col = get_line_index(frame->buf, frame->next_cur.line,
+                                         line->n, frame->vct);
     frame->next_vct = frame->vct;
     return UPDATE_UI;
 }
@@ -696,7 +699,7 @@ static int move_end(struct frame *frame)
     col_t           n;
 
     frame->next_vct = SIZE_MAX;
-    n = frame->buf->text.lines[frame->cur.line].n;
+    n = get_text_line(&frame->buf->text, frame->cur.line)->n;
     if (frame->cur.col == n) {
         return 0;
     }
@@ -717,7 +720,7 @@ static int move_prev(struct frame *frame)
 
     col = frame->cur.col;
     line_i = frame->cur.line;
-    line = &frame->buf->text.lines[line_i];
+    line = get_text_line(&frame->buf->text, line_i);
     while (1) {
         for (; Core.counter > 0; Core.counter--) {
             if (col == 0) {
@@ -729,7 +732,7 @@ static int move_prev(struct frame *frame)
             break;
         }
         line_i--;
-        line--;
+        line = get_text_line(&frame->buf->text, line_i);
         col = get_mode_line_end(line);
         Core.counter--;
     }
@@ -747,7 +750,7 @@ static int move_next(struct frame *frame)
 
     col = frame->cur.col;
     line_i = frame->cur.line;
-    line = &frame->buf->text.lines[line_i];
+    line = get_text_line(&frame->buf->text, line_i);
     while (line_i != frame->buf->text.num_lines - 1) {
         for (; Core.counter > 0; Core.counter--) {
             if (col == get_mode_line_end(line)) {
@@ -760,7 +763,7 @@ static int move_next(struct frame *frame)
         }
         col = 0;
         line_i++;
-        line++;
+        line = get_text_line(&frame->buf->text, line_i);
         Core.counter--;
     }
     if (col == frame->cur.col && line_i == frame->cur.line) {
@@ -781,9 +784,9 @@ static int move_frame_start(struct frame *frame)
     }
     frame->next_cur.line = frame->scroll.line;
 
-    line = &frame->buf->text.lines[frame->next_cur.line];
-    frame->next_cur.col  = get_index(line->s, line->n,
-                                     frame->buf->rule.tab_size, frame->vct);
+    line = get_text_line(&frame->buf->text, frame->next_cur.line);
+    frame->next_cur.col  = get_line_index(frame->buf, frame->next_cur.line,
+                                          line->n, frame->vct);
     frame->next_vct = frame->vct;
     return UPDATE_UI;
 }
@@ -799,9 +802,9 @@ static int move_frame_middle(struct frame *frame)
         return 0;
     }
 
-    line = &frame->buf->text.lines[frame->next_cur.line];
-    frame->next_cur.col  = get_index(line->s, line->n,
-                                     frame->buf->rule.tab_size, frame->vct);
+    line = get_text_line(&frame->buf->text, frame->next_cur.line);
+    frame->next_cur.col  = get_line_index(frame->buf, frame->next_cur.line,
+                                          line->n, frame->vct);
     frame->next_vct = frame->vct;
     return UPDATE_UI;
 }
@@ -817,9 +820,9 @@ static int move_frame_end(struct frame *frame)
         return 0;
     }
 
-    line = &frame->buf->text.lines[frame->next_cur.line];
-    frame->next_cur.col  = get_index(line->s, line->n,
-                                     frame->buf->rule.tab_size, frame->vct);
+    line = get_text_line(&frame->buf->text, frame->next_cur.line);
+    frame->next_cur.col  = get_line_index(frame->buf, frame->next_cur.line,
+                                          line->n, frame->vct);
     frame->next_vct = frame->vct;
     return UPDATE_UI;
 }
@@ -842,9 +845,9 @@ static int move_to_start(struct frame *frame)
         return 0;
     }
     frame->next_cur.line = Core.counter;
-    line = &frame->buf->text.lines[frame->next_cur.line];
-    frame->next_cur.col = get_index(line->s, line->n,
-                                    frame->buf->rule.tab_size, frame->vct);
+    line = get_text_line(&frame->buf->text, frame->next_cur.line);
+    frame->next_cur.col = get_line_index(frame->buf, frame->next_cur.line,
+                                         line->n, frame->vct);
     frame->next_vct = frame->vct;
     return UPDATE_UI;
 }
@@ -861,9 +864,9 @@ static int move_to_end(struct frame *frame)
     if (frame->next_cur.line == frame->cur.line) {
         return 0;
     }
-    line = &frame->buf->text.lines[frame->next_cur.line];
-    frame->next_cur.col = get_index(line->s, line->n,
-                                    frame->buf->rule.tab_size, frame->vct);
+    line = get_text_line(&frame->buf->text, frame->next_cur.line);
+    frame->next_cur.col = get_line_index(frame->buf, frame->next_cur.line,
+                                         line->n, frame->vct);
     frame->next_vct = frame->vct;
     return UPDATE_UI;
 }
@@ -920,7 +923,7 @@ static int move_up_paragraph(struct frame *frame)
     }
     while (line > 0) {
         line--;
-        if (frame->buf->text.lines[line].n == 0) {
+        if (get_text_line(&frame->buf->text, line)->n == 0) {
             if (Core.counter > 1) {
                 Core.counter--;
                 continue;
@@ -944,7 +947,7 @@ static int move_down_paragraph(struct frame *frame)
     }
     while (line + 1 != frame->buf->text.num_lines) {
         line++;
-        if (frame->buf->text.lines[line].n == 0) {
+        if (get_text_line(&frame->buf->text, line)->n == 0) {
             if (Core.counter > 1) {
                 Core.counter--;
                 continue;
@@ -999,7 +1002,7 @@ static int find_prev_char(struct frame *frame, bool excl)
 
     col = frame->cur.col;
     new_col = col;
-    line = &frame->buf->text.lines[frame->cur.line];
+    line = get_text_line(&frame->buf->text, frame->cur.line);
     if (excl && col > 0) {
         col = move_back_glyph(line->s, col);
     }
@@ -1050,7 +1053,7 @@ static int find_next_char(struct frame *frame, bool excl)
         return -1;
     }
 
-    line = &frame->buf->text.lines[frame->cur.line];
+    line = get_text_line(&frame->buf->text, frame->cur.line);
     col = frame->cur.col;
     new_col = col;
     if (excl) {
@@ -1102,7 +1105,7 @@ static int move_to_prev_word_excl(struct frame *frame)
     }
 
     p = frame->cur;
-    line = &frame->buf->text.lines[p.line];
+    line = get_text_line(&frame->buf->text, p.line);
 
     do {
         s = -1;
@@ -1134,7 +1137,7 @@ static int move_to_prev_word_excl(struct frame *frame)
             }
 
             p.line--;
-            line--;
+            line = get_text_line(&frame->buf->text, p.line);
             p.col = line->n == 0 ? 0 : line->n - 1;
         }
 
@@ -1153,7 +1156,7 @@ static int move_to_next_word_excl(struct frame *frame)
     int             s, o_s;
 
     p = frame->cur;
-    line = &frame->buf->text.lines[p.line];
+    line = get_text_line(&frame->buf->text, p.line);
 
     do {
         p.col++;
@@ -1174,7 +1177,7 @@ static int move_to_next_word_excl(struct frame *frame)
 
             p.line++;
             p.col = 0;
-            line++;
+            line = get_text_line(&frame->buf->text, p.line);
         }
 
         s = -1;
@@ -1210,7 +1213,7 @@ static int move_to_prev_word(struct frame *frame)
     int             s, o_s;
 
     p = frame->cur;
-    line = &frame->buf->text.lines[p.line];
+    line = get_text_line(&frame->buf->text, p.line);
 
     do {
         for (; p.col > 0; p.col--) {
@@ -1221,8 +1224,8 @@ static int move_to_prev_word(struct frame *frame)
 
         if (p.col == 0) {
             if (p.line > 0) {
-                line--;
                 p.line--;
+                line = get_text_line(&frame->buf->text, p.line);
                 p.col = line->n;
             }
         }
@@ -1260,7 +1263,7 @@ static int move_to_next_word(struct frame *frame)
     int             s, o_s;
 
     p = frame->cur;
-    line = &frame->buf->text.lines[p.line];
+    line = get_text_line(&frame->buf->text, p.line);
 
     do {
         s = -1;
@@ -1277,7 +1280,7 @@ static int move_to_next_word(struct frame *frame)
             if (p.line + 1 < frame->buf->text.num_lines) {
                 p.line++;
                 p.col = 0;
-                line++;
+                line = get_text_line(&frame->buf->text, p.line);
             }
         }
 
@@ -1394,7 +1397,7 @@ static int _find_next_match(struct frame *frame)
     index = find_current_match(frame->buf, &frame->cur);
     p = frame->buf->matches[(index + 1) % frame->buf->num_matches].from;
     if (frame->cur.line == p.line && frame->cur.col + 1 == p.col &&
-            p.col == frame->buf->text.lines[p.line].n) {
+            p.col == get_text_line(&frame->buf->text, p.line)->n) {
         Core.counter = safe_add(Core.counter, 1);
     }
     index += Core.counter % frame->buf->num_matches;
@@ -1408,6 +1411,7 @@ static int _find_next_match(struct frame *frame)
 
 static int find_prev_match(struct frame *frame)
 {
+    flush_batch(frame->buf);
     if (frame->buf->num_matches == 0) {
         set_message("no matches");
         return UPDATE_UI;
@@ -1420,6 +1424,7 @@ static int find_prev_match(struct frame *frame)
 
 static int find_next_match(struct frame *frame)
 {
+    flush_batch(frame->buf);
     if (frame->buf->num_matches == 0) {
         set_message("no matches");
         return UPDATE_UI;
@@ -1434,11 +1439,12 @@ static int goto_matching_paren(struct frame *frame)
 {
     size_t          index;
 
+    highlight_up_to(frame->buf, frame->next_cur.line);
     index = get_paren(frame->buf, &frame->next_cur);
     if (index == SIZE_MAX) {
         return 0;
     }
-    index = get_matching_paren(frame->buf, index);
+    index = find_matching_paren(frame->buf, index);
     if (index == SIZE_MAX) {
         return 0;
     }
@@ -1506,7 +1512,8 @@ int apply_motion(struct frame *frame)
     } else if (frame->next_cur.line - frame->cur.line > MAX(frame->h, 2)) {
         frame->prev_cur = frame->cur;
     }
-    max_col = get_mode_line_end(&frame->buf->text.lines[frame->next_cur.line]);
+    max_col = get_mode_line_end(get_text_line(&frame->buf->text,
+                                              frame->next_cur.line));
     frame->cur.col = MIN(frame->next_cur.col, max_col);
     frame->cur.line = frame->next_cur.line;
     frame->vct = frame->next_vct;
@@ -1531,10 +1538,11 @@ int do_action_till(struct frame *frame, int action, line_t min_line,
     update = false;
     if (action == '>') {
         text.num_lines = max_line - min_line + 1;
+        text.gap = text.num_lines;
         text.lines = xmalloc(sizeof(*text.lines) * text.num_lines);
         for (i = min_line; i <= max_line; i++) {
             line = &text.lines[i - min_line];
-            if (buf->text.lines[i].n == 0) {
+            if (get_text_line(&buf->text, i)->n == 0) {
                 /* do not indent empty lines */
                 line->s = NULL;
                 line->n = 0;
@@ -1562,7 +1570,7 @@ int do_action_till(struct frame *frame, int action, line_t min_line,
         p1.line = min_line;
         ev = _insert_block(buf, &p1, &text);
         ev->cur = frame->cur;
-        if (buf->text.lines[frame->cur.line].n > 0) {
+        if (get_text_line(&buf->text, frame->cur.line)->n > 0) {
             frame->cur.col += buf->rule.tab_size;
         }
         return UPDATE_UI;
@@ -1574,8 +1582,9 @@ int do_action_till(struct frame *frame, int action, line_t min_line,
         }
     }
 
+    begin_batch(buf);
     for (; min_line <= max_line; min_line++) {
-        if (buf->text.lines[min_line].n == 0) {
+        if (get_text_line(&buf->text, min_line)->n == 0) {
             /* skip empty lines */
             continue;
         }
@@ -1603,14 +1612,15 @@ int do_action_till(struct frame *frame, int action, line_t min_line,
             break;
 
         case '<':
-            if (buf->text.lines[min_line].s[0] == '\t') {
+            line = get_text_line(&buf->text, min_line);
+            if (line->s[0] == '\t') {
                 n = 1;
             } else {
-                for (n = 0; n < buf->text.lines[min_line].n; n++) {
+                for (n = 0; n < line->n; n++) {
                     if (n == buf->rule.tab_size) {
                         break;
                     }
-                    if (buf->text.lines[min_line].s[n] != ' ') {
+                    if (line->s[n] != ' ') {
                         break;
                     }
                 }
@@ -1627,6 +1637,7 @@ int do_action_till(struct frame *frame, int action, line_t min_line,
             break;
         }
     }
+    end_batch(buf);
     if (update) {
         return UPDATE_UI;
     }
@@ -38,6 +38,23 @@ struct frame {
     size_t vct;
     /// the next value for `vct`
     size_t next_vct;
+    /// what the last rendering showed, see `render_frame()`
+    struct frame_view {
+        /// the buffer, `NULL` if the frame must be drawn again completely
+        struct buf *buf;
+        /// position and size on the screen
+        int x, y, w, h;
+        /// the width of the line numbers
+        int num_w;
+        /// offset of the text origin
+        struct pos scroll;
+        /// the tab size of the buffer
+        col_t tab_size;
+        /// the lines of the selection, empty if `sel_from >= sel_to`
+        line_t sel_from, sel_to;
+        /// the lines of the highlighted parentheses, -1 for none
+        line_t paren_lines[2];
+    } view;
     /// next frame in the linked list
     struct frame *next;
 };
@@ -81,6 +98,11 @@ void destroy_frame(struct frame *frame);
 /**
  * Renders the frame within its defined bounds.
  *
+ * Only the rows that changed since the last rendering are drawn again, that
+ * are the damaged lines of the buffer and the lines of overlays like the
+ * selection. If the frame moved, scrolled or shows a different buffer, all
+ * rows are drawn. The status bar is always drawn.
+ *
  * @param frame The frame to render.
  */
 void render_frame(struct frame *frame);
@@ -178,7 +200,7 @@ void set_frame_buffer(struct frame *frame, struct buf *buf);
 int adjust_scroll(struct frame *frame);
 
 /**
- * Wrapper around `get_advance()`.
+ * Wrapper around `get_line_advance()`.
  *
  * @param frame The frame whose buffer to use.
  * @param pos   The position of the line and column index.
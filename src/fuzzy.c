@@ -210,6 +210,9 @@ void render_fuzzy(struct fuzzy *fuzzy)
     fuzzy->w = COLS == 1 ? 1 : COLS * 2 / 3;
     fuzzy->h = LINES <= 2 ? LINES : LINES * 2 / 3;
 
+    /* the frames below have to be drawn again once the popup is gone */
+    Core.is_screen_dirty = true;
+
     set_highlight(stdscr, HI_NORMAL);
 
     draw_frame(fuzzy->x, fuzzy->y, fuzzy->w, fuzzy->h);
@@ -0,0 +1,209 @@
+#include "lz.h"
+#include "util.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+/// number of bits used to index the match table
+#define LZ_HASH_BITS    12
+
+/// the furthest a back reference can point
+#define LZ_MAX_OFFSET   65535
+
+/**
+ * Writes the extra bytes of a length that did not fit into the token.
+ *
+ * @param dst   The output buffer.
+ * @param p_o   The current output index, this is advanced.
+ * @param cap   The size of the output buffer.
+ * @param n     The length minus 15.
+ *
+ * @return Whether the bytes fit.
+ */
+static bool put_length(char *dst, size_t *p_o, size_t cap, size_t n)
+{
+    size_t          o;
+
+    o = *p_o;
+    for (; n >= 255; n -= 255) {
+        if (o == cap) {
+            return false;
+        }
+        dst[o++] = (char) 255;
+    }
+    if (o == cap) {
+        return false;
+    }
+    dst[o++] = n;
+    *p_o = o;
+    return true;
+}
+
+/**
+ * Writes a sequence of literals followed by a match.
+ *
+ * @param dst       The output buffer.
+ * @param p_o       The current output index, this is advanced.
+ * @param cap       The size of the output buffer.
+ * @param lit       The literals.
+ * @param num_lit   The number of literals.
+ * @param offset    The distance of the match, 0 for the last sequence.
+ * @param match     The length of the match.
+ *
+ * @return Whether the sequence fit.
+ */
+static bool put_sequence(char *dst, size_t *p_o, size_t cap,
+                         const char *lit, size_t num_lit,
+                         size_t offset, size_t match)
+{
+    size_t          o;
+    unsigned        token;
+
+    o = *p_o;
+    if (o == cap) {
+        return false;
+    }
+    token = MIN(num_lit, 15) << 4;
+    if (offset > 0) {
+        match -= LZ_MIN_MATCH;
+        token |= MIN(match, 15);
+    }
+    dst[o++] = token;
+
+    if (num_lit >= 15 && !put_length(dst, &o, cap, num_lit - 15)) {
+        return false;
+    }
+    if (num_lit > cap - o) {
+        return false;
+    }
+    memcpy(&dst[o], lit, num_lit);
+    o += num_lit;
+
+    if (offset > 0) {
+        if (cap - o < 2) {
+            return false;
+        }
+        dst[o++] = offset & 0xff;
+        dst[o++] = offset >> 8;
+        if (match >= 15 && !put_length(dst, &o, cap, match - 15)) {
+            return false;
+        }
+    }
+    *p_o = o;
+    return true;
+}
+
+size_t lz_compress(const char *src, size_t len, char *dst, size_t cap)
+{
+    /* positions plus one, so that 0 means no entry */
+    size_t          table[1 << LZ_HASH_BITS];
+    size_t          i, anchor, ref, match;
+    size_t          o;
+    uint32_t        seq, h;
+
+    memset(table, 0, sizeof(table));
+    o = 0;
+    anchor = 0;
+    i = 0;
+    while (len - i >= LZ_MIN_MATCH) {
+        memcpy(&seq, &src[i], sizeof(seq));
+        h = (seq * 2654435761u) >> (32 - LZ_HASH_BITS);
+        ref = table[h];
+        table[h] = i + 1;
+        if (ref == 0 || i - (ref - 1) > LZ_MAX_OFFSET ||
+                memcmp(&src[ref - 1], &src[i], LZ_MIN_MATCH) != 0) {
+            i++;
+            continue;
+        }
+        ref--;
+
+        match = LZ_MIN_MATCH;
+        while (i + match < len && src[ref + match] == src[i + match]) {
+            match++;
+        }
+        if (!put_sequence(dst, &o, cap, &src[anchor], i - anchor,
+                          i - ref, match)) {
+            return 0;
+        }
+        i += match;
+        anchor = i;
+    }
+
+    if (!put_sequence(dst, &o, cap, &src[anchor], len - anchor, 0, 0)) {
+        return 0;
+    }
+    return o;
+}
+
+/**
+ * Reads the extra bytes of a length that did not fit into the token.
+ *
+ * @param src       The compressed block.
+ * @param src_len   The length of the compressed block.
+ * @param p_s       The current input index, this is advanced.
+ * @param p_n       The length to add to.
+ *
+ * @return Whether the input was long enough.
+ */
+static bool get_length(const char *src, size_t src_len, size_t *p_s,
+                       size_t *p_n)
+{
+    unsigned char   b;
+
+    do {
+        if (*p_s == src_len) {
+            return false;
+        }
+        b = src[(*p_s)++];
+        *p_n += b;
+    } while (b == 255);
+    return true;
+}
+
+int lz_decompress(const char *src, size_t src_len, char *dst, size_t dst_len)
+{
+    size_t          s, o;
+    unsigned char   token;
+    size_t          num_lit, offset, match;
+
+    s = 0;
+    o = 0;
+    while (s < src_len) {
+        token = src[s++];
+
+        num_lit = token >> 4;
+        if (num_lit == 15 && !get_length(src, src_len, &s, &num_lit)) {
+            return -1;
+        }
+        if (num_lit > src_len - s || num_lit > dst_len - o) {
+            return -1;
+        }
+        memcpy(&dst[o], &src[s], num_lit);
+        s += num_lit;
+        o += num_lit;
+
+        if (s == src_len) {
+            break;
+        }
+
+        if (src_len - s < 2) {
+            return -1;
+        }
+        offset = (unsigned char) src[s] | (unsigned char) src[s + 1] << 8;
+        s += 2;
+        match = token & 0xf;
+        if (match == 15 && !get_length(src, src_len, &s, &match)) {
+            return -1;
+        }
+        match += LZ_MIN_MATCH;
+        if (offset == 0 || offset > o || match > dst_len - o) {
+            return -1;
+        }
+        /* the match may overlap the output, so copy byte by byte */
+        for (; match > 0; match--, o++) {
+            dst[o] = dst[o - offset];
+        }
+    }
+    return o == dst_len ? 0 : -1;
+}
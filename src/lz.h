@@ -0,0 +1,46 @@
+#ifndef LZ_H
+#define LZ_H
+
+#include <stddef.h>
+
+/**
+ * A small LZ77 block compressor in the spirit of LZ4.
+ *
+ * A block is a series of sequences. Each sequence starts with a token byte,
+ * the upper four bits are the number of literals and the lower four bits are
+ * the match length minus `LZ_MIN_MATCH`. A value of 15 means that more length
+ * bytes follow, each one is added and the last one is less than 255. After the
+ * token and literal length come the literals, then a two byte little endian
+ * offset and the remaining match length bytes. The last sequence only has
+ * literals.
+ */
+
+/// the shortest match that is encoded as back reference
+#define LZ_MIN_MATCH    4
+
+/**
+ * Compresses a block of bytes.
+ *
+ * @param src       The bytes to compress.
+ * @param len       The number of bytes to compress.
+ * @param dst       The output buffer.
+ * @param cap       The size of the output buffer.
+ *
+ * @return The length of the compressed block or 0 if it does not fit into
+ *         `cap` bytes.
+ */
+size_t lz_compress(const char *src, size_t len, char *dst, size_t cap);
+
+/**
+ * Decompresses a block created by `lz_compress()`.
+ *
+ * @param src       The compressed block.
+ * @param src_len   The length of the compressed block.
+ * @param dst       The output buffer.
+ * @param dst_len   The exact length of the decompressed data.
+ *
+ * @return 0 on success or -1 if the block is malformed.
+ */
+int lz_decompress(const char *src, size_t src_len, char *dst, size_t dst_len);
+
+#endif
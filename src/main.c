@@ -20,7 +20,21 @@ int get_ch(void)
         return c;
     }
 
-    c = getch();
+    if (!Core.is_busy) {
+        /* continue loading and highlighting while the user is idle */
+        Core.is_busy = true;
+        timeout(0);
+        while (c = getch(), c == ERR && update_buffers()) {
+            render_all();
+        }
+        timeout(-1);
+        Core.is_busy = false;
+        if (c == ERR) {
+            c = getch();
+        }
+    } else {
+        c = getch();
+    }
     if (c == KEY_RESIZE) {
         update_screen_size();
         render_all();
@@ -130,6 +144,7 @@ int main(int argc, char **argv)
     struct play_rec     *rec;
     struct undo_event   *ev;
     struct buf          *buf;
+    bool                is_batched;
 
     if (init_purec(argc, argv) == -1) {
         return -1;
@@ -140,6 +155,7 @@ int main(int argc, char **argv)
         render_all();
 
         Core.is_busy = false;
+        is_batched = false;
         do {
             rec = get_playback();
             next_dot_i = rec == NULL ? Core.rec_len : rec->index;
@@ -156,6 +172,14 @@ int main(int argc, char **argv)
             old_mode = Core.mode;
             r = handle_input(c);
 
+            /* highlight the changes of a playback all at once at the end */
+            if (!is_batched && get_playback() != NULL) {
+                for (buf = FirstBuffer; buf != NULL; buf = buf->next) {
+                    begin_batch(buf);
+                }
+                is_batched = true;
+            }
+
             /* the dot recording is either the last key used in normal mode or
              * the key that led to a different mode all until the end of that
              * mode
@@ -173,6 +197,15 @@ int main(int argc, char **argv)
          */
         } while (get_playback() != NULL);
 
+        if (is_batched) {
+            /* buffers opened during the playback are not within a batch */
+            for (buf = FirstBuffer; buf != NULL; buf = buf->next) {
+                if (buf->batch_depth > 0) {
+                    end_batch(buf);
+                }
+            }
+        }
+
         if (Core.is_stopped) {
             break;
         }
@@ -184,7 +217,7 @@ int main(int argc, char **argv)
             if (buf->num_events == 0) {
                 continue;
             }
-            ev = &buf->events[buf->num_events - 1];
+            ev = buf->events[buf->num_events - 1];
             ev->flags |= IS_STOP;
         }
     }
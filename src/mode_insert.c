@@ -19,8 +19,8 @@ static void attempt_join(void)
     struct undo_event   *prev_ev, *ev;
 
     for (i = Core.ev_from_insert + 1; i < SelFrame->buf->event_i; i++) {
-        prev_ev = &SelFrame->buf->events[i - 1];
-        ev = &SelFrame->buf->events[i];
+        prev_ev = SelFrame->buf->events[i - 1];
+        ev = SelFrame->buf->events[i];
         if (should_join(prev_ev, ev)) {
             prev_ev->flags &= ~IS_STOP;
         }
@@ -50,26 +50,28 @@ static void repeat_last_insertion(void)
 
     /* check if there is only a SINGLE transient chain */
     for (e = Core.ev_from_insert + 1; e < buf->event_i; e++) {
-        ev = &buf->events[e - 1];
+        ev = buf->events[e - 1];
         if ((ev->flags & IS_STOP)) {
             return;
         }
     }
 
     /* combine the events (we only expect insertion and deletion events) */
-    cur = buf->events[Core.ev_from_insert].pos;
+    cur = buf->events[Core.ev_from_insert]->pos;
     init_text(&text, 1);
     for (e = Core.ev_from_insert; e < buf->event_i; e++) {
-        ev = &buf->events[e];
+        ev = buf->events[e];
         pos = ev->pos;
         pos.line -= cur.line;
         if (pos.line == 0) {
             pos.col -= cur.col;
         }
         seg = ev->seg;
-        sub.lines = seg->lines;
-        sub.num_lines = seg->num_lines;
-        load_undo_data(seg);
+        if (load_undo_data(seg) != 0) {
+            clear_text(&text);
+            return;
+        }
+        make_text(&sub, seg->lines, seg->num_lines);
         if ((ev->flags & IS_INSERTION)) {
             insert_text(&text, &pos, &sub);
         } else {
@@ -86,13 +88,13 @@ static void repeat_last_insertion(void)
     orig_col = cur.col;
 
     if (text.num_lines == 1) {
-        cur.col += text.lines[0].n;
+        cur.col += get_text_line(&text, 0)->n;
     } else {
         cur.line += text.num_lines - 1;
-        cur.col = text.lines[text.num_lines - 1].n;
+        cur.col = get_text_line(&text, text.num_lines - 1)->n;
     }
     if (!is_point_equal(&SelFrame->cur, &cur) ||
-            (text.num_lines == 1 && text.lines[0].n == 0)) {
+            (text.num_lines == 1 && get_text_line(&text, 0)->n == 0)) {
         clear_text(&text);
         return;
     }
@@ -103,7 +105,7 @@ static void repeat_last_insertion(void)
         if (cur.line >= SelFrame->buf->text.num_lines) {
             break;
         }
-        if (orig_col > SelFrame->buf->text.lines[cur.line].n) {
+        if (orig_col > get_text_line(&SelFrame->buf->text, cur.line)->n) {
             continue;
         }
 
@@ -111,10 +113,10 @@ static void repeat_last_insertion(void)
         ev = insert_lines(SelFrame->buf, &cur, &text, repeat);
 
         if (text.num_lines == 1) {
-            cur.col += text.lines[0].n;
+            cur.col += get_text_line(&text, 0)->n;
         } else {
             cur.line += repeat * (text.num_lines - 1);
-            cur.col = text.lines[text.num_lines - 1].n;
+            cur.col = get_text_line(&text, text.num_lines - 1)->n;
         }
         repeat = Core.repeat_insert;
     }
@@ -150,17 +152,17 @@ static int enter_new_line(void)
 
     buf = SelFrame->buf;
     if (buf->event_i > 0 &&
-            (buf->events[buf->event_i - 1].flags & IS_AUTO_INDENT)) {
+            (buf->events[buf->event_i - 1]->flags & IS_AUTO_INDENT)) {
         undo_event_no_trans(buf);
         if (buf->event_i > 0) {
-            buf->events[buf->event_i - 1].flags |= IS_STOP;
+            buf->events[buf->event_i - 1]->flags |= IS_STOP;
         }
         /* since the indentation is now trimmed, move to the first column */
         SelFrame->cur.col = 0;
     }
     (void) break_line(buf, &SelFrame->cur);
     SelFrame->cur.line++;
-    SelFrame->cur.col = buf->events[buf->event_i - 1].end.col;
+    SelFrame->cur.col = buf->events[buf->event_i - 1]->end.col;
     (void) adjust_scroll(SelFrame);
     return UPDATE_UI;
 }
@@ -173,8 +175,7 @@ static int enter_tab(void)
 
     ind = get_line_indent(SelFrame->buf, SelFrame->cur.line, NULL);
 
-    text.num_lines = 1;
-    text.lines = xmalloc(sizeof(*text.lines));
+    make_text(&text, xmalloc(sizeof(*text.lines)), 1);
     if (SelFrame->cur.col > ind && SelFrame->cur.col < ind + 16 &&
             ind % 2 == 0) {
         n = 16 + ind - SelFrame->cur.col;
@@ -205,7 +206,7 @@ static int delete_next_char(void)
     struct buf      *buf;
 
     buf = SelFrame->buf;
-    if (SelFrame->cur.col == buf->text.lines[SelFrame->cur.line].n) {
+    if (SelFrame->cur.col == get_text_line(&buf->text, SelFrame->cur.line)->n) {
         if (SelFrame->cur.line == buf->text.num_lines - 1) {
             return 0;
         }
@@ -234,13 +235,14 @@ static int delete_prev_char(void)
             return 0;
         }
         SelFrame->next_cur.line--;
-        SelFrame->next_cur.col = buf->text.lines[SelFrame->next_cur.line].n;
+        line = get_text_line(&buf->text, SelFrame->next_cur.line);
+        SelFrame->next_cur.col = line->n;
         SelFrame->next_vct = compute_vct(SelFrame, &SelFrame->next_cur);
     } else {
         if (SelFrame->cur.col % SelFrame->buf->rule.tab_size == 0) {
             Core.counter = SelFrame->buf->rule.tab_size;
        
-            line = &buf->text.lines[SelFrame->cur.line];
+            line = get_text_line(&buf->text, SelFrame->cur.line);
             for (i = SelFrame->cur.col;
                  i > SelFrame->cur.col - SelFrame->buf->rule.tab_size; ) {
                 i--;
@@ -264,9 +266,6 @@ static int delete_prev_char(void)
 
 int insert_handle_input(int c)
 {
-    struct text     text;
-    struct pos      p;
-
     static int (*binds[])(void) = {
         ['\x1b'] = escape_insert_mode,
         [CONTROL('C')] = cancel_insert_mode,
@@ -279,21 +278,19 @@ int insert_handle_input(int c)
     };
 
     if (c < (int) ARRAY_SIZE(binds) && binds[c] != NULL) {
+        commit_insertion(SelFrame->buf);
         return binds[c]();
     }
 
     if (c >= ' ' && c < 0x100) {
-        init_text(&text, 1);
-        text.lines[0].n = 1;
-        text.lines[0].s = xmalloc(1);
-        text.lines[0].s[0] = c;
-        p = SelFrame->cur;
-        (void) _insert_lines(SelFrame->buf, &p, &text);
+        type_char(SelFrame->buf, &SelFrame->cur, c);
         SelFrame->cur.col++;
         Langs[SelFrame->buf->lang].char_hook(SelFrame->buf, &SelFrame->cur, c);
         SelFrame->vct = compute_vct(SelFrame, &SelFrame->cur);
         (void) adjust_scroll(SelFrame);
         return UPDATE_UI;
-   }
-   return do_motion(SelFrame, c);
+    }
+
+    commit_insertion(SelFrame->buf);
+    return do_motion(SelFrame, c);
 }
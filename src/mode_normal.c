@@ -520,9 +520,9 @@ static int insert_line_above(void)
         clip_column(SelFrame);
     } else {
         p.line--;
-        p.col = SelFrame->buf->text.lines[p.line].n;
+        p.col = get_text_line(&SelFrame->buf->text, p.line)->n;
         (void) break_line(SelFrame->buf, &p);
-        p = SelFrame->buf->events[SelFrame->buf->event_i - 1].end;
+        p = SelFrame->buf->events[SelFrame->buf->event_i - 1]->end;
         set_cursor(SelFrame, &p);
     }
     return UPDATE_UI;
@@ -534,9 +534,9 @@ static int insert_line_below(void)
 
     set_mode(INSERT_MODE);
     p.line = SelFrame->cur.line;
-    p.col = SelFrame->buf->text.lines[p.line].n;
+    p.col = get_text_line(&SelFrame->buf->text, p.line)->n;
     (void) break_line(SelFrame->buf, &p);
-    p = SelFrame->buf->events[SelFrame->buf->event_i - 1].end;
+    p = SelFrame->buf->events[SelFrame->buf->event_i - 1]->end;
     set_cursor(SelFrame, &p);
     return UPDATE_UI;
 }
@@ -594,6 +594,7 @@ static int delete_prev_chars(void)
 static int delete_till(int c)
 {
     struct pos          cur, from, to;
+    struct line         *line;
     struct undo_event   *ev, *ev_nn;
     int                 r;
 
@@ -613,7 +614,7 @@ static int delete_till(int c)
              */
             ev = ev_nn - 1;
         }
-        SelFrame->cur.col = SelFrame->buf->text.lines[from.line].n;
+        SelFrame->cur.col = get_text_line(&SelFrame->buf->text, from.line)->n;
         break;
 
     case 'd':
@@ -624,9 +625,9 @@ static int delete_till(int c)
 
         if (cur.line > 0) {
             from.line = cur.line - 1;
-            from.col = SelFrame->buf->text.lines[from.line].n;
+            from.col = get_text_line(&SelFrame->buf->text, from.line)->n;
             to.line--;
-            to.col = SelFrame->buf->text.lines[to.line].n;
+            to.col = get_text_line(&SelFrame->buf->text, to.line)->n;
         } else {
             from.line = cur.line;
             from.col = 0;
@@ -648,9 +649,8 @@ static int delete_till(int c)
         from = SelFrame->cur;
         to = SelFrame->next_cur;
         if (r == 2) {
-            to.col = move_forward_glyph(SelFrame->buf->text.lines[to.line].s,
-                                        to.col,
-                                        SelFrame->buf->text.lines[to.line].n);
+            line = get_text_line(&SelFrame->buf->text, to.line);
+            to.col = move_forward_glyph(line->s, to.col, line->n);
         }
         ev = delete_range(SelFrame->buf, &from, &to);
         if (to.line < SelFrame->cur.line ||
@@ -729,9 +729,9 @@ static int yank_lines_to(int c)
 
         if (SelFrame->cur.line > 0) {
             from.line = SelFrame->cur.line - 1;
-            from.col = SelFrame->buf->text.lines[from.line].n;
+            from.col = get_text_line(&SelFrame->buf->text, from.line)->n;
             to.line--;
-            to.col = SelFrame->buf->text.lines[to.line].n;
+            to.col = get_text_line(&SelFrame->buf->text, to.line)->n;
         } else {
             from.line = SelFrame->cur.line;
             from.col = 0;
@@ -766,14 +766,15 @@ static int yank_lines(void)
 static int paste_text(bool before)
 {
     struct pos          p;
+    struct line         *line;
     struct text         text;
     struct undo_event   *ev;
     struct reg          *reg;
 
     p = SelFrame->cur;
-    if (!before && p.col < SelFrame->buf->text.lines[p.line].n) {
-        p.col = move_forward_glyph(SelFrame->buf->text.lines[p.line].s,
-                                   p.col, SelFrame->buf->text.lines[p.line].n);
+    line = get_text_line(&SelFrame->buf->text, p.line);
+    if (!before && p.col < line->n) {
+        p.col = move_forward_glyph(line->s, p.col, line->n);
     }
 
     if (Core.user_reg == '+' || Core.user_reg == '*') {
@@ -786,7 +787,9 @@ static int paste_text(bool before)
         if (reg->seg == NULL) {
             return 0;
         }
-        load_undo_data(reg->seg);
+        if (load_undo_data(reg->seg) != 0) {
+            return UPDATE_UI;
+        }
         make_text(&text, reg->seg->lines, reg->seg->num_lines);
         if ((reg->flags & IS_BLOCK)) {
             ev = insert_block(SelFrame->buf, &p, &text, Core.counter);
@@ -841,12 +844,12 @@ static int join_lines(void)
         if (from.line + 1 == SelFrame->buf->text.num_lines) {
             break;
         }
-        from.col = SelFrame->buf->text.lines[from.line].n;
+        from.col = get_text_line(&SelFrame->buf->text, from.line)->n;
         to = from;
         to.line++;
         (void) get_line_indent(SelFrame->buf, to.line, &to.col);
         (void) delete_range(SelFrame->buf, &from, &to);
-        line = &SelFrame->buf->text.lines[from.line];
+        line = get_text_line(&SelFrame->buf->text, from.line);
         if (from.col > 0 && from.col != line->n &&
                 !isblank(line->s[from.col - 1])) {
             init_text(&text, 1);
@@ -978,7 +981,7 @@ static int add_to_number(int dir)
     size_t          n;
     struct charnum  num1, num2, sum;
 
-    line = &SelFrame->buf->text.lines[SelFrame->cur.line];
+    line = get_text_line(&SelFrame->buf->text, SelFrame->cur.line);
     for (c = SelFrame->cur.col; c < line->n; c++) {
         if (isdigit(line->s[c])) {
             break;
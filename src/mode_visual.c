@@ -53,7 +53,7 @@ static int enter_append_mode(void)
         set_cursor(SelFrame, &sel.beg);
         Core.move_down_count = sel.end.line - sel.beg.line;
         if (SelFrame->cur.col !=
-                SelFrame->buf->text.lines[SelFrame->cur.col].n) {
+                get_text_line(&SelFrame->buf->text, SelFrame->cur.col)->n) {
             SelFrame->cur.col++;
         }
     } else {
@@ -88,6 +88,7 @@ static bool del_selection(bool chg)
 {
     struct buf          *buf;
     struct selection    sel;
+    struct line         *line;
     struct undo_event   *ev;
 
     buf = SelFrame->buf;
@@ -99,21 +100,20 @@ static bool del_selection(bool chg)
         if (Core.mode == VISUAL_LINE_MODE) {
             if (chg) {
                 sel.beg.col = 0;
-                sel.end.col = buf->text.lines[sel.end.line].n;
+                sel.end.col = get_text_line(&buf->text, sel.end.line)->n;
             } else {
                 sel.beg.col = 0;
                 sel.end.col = 0;
                 sel.end.line++;
             }
          } else {
-              if (sel.end.col == buf->text.lines[sel.end.line].n) {
+              line = get_text_line(&buf->text, sel.end.line);
+              if (sel.end.col == line->n) {
                  sel.end.line++;
                  sel.end.col = 0;
              } else {
-                 sel.end.col =
-                    move_forward_glyph(buf->text.lines[sel.end.line].s,
-                                       sel.end.col,
-                                       buf->text.lines[sel.end.line].n);
+                 sel.end.col = move_forward_glyph(line->s, sel.end.col,
+                                                  line->n);
              }
         }
         ev = delete_range(buf, &sel.beg, &sel.end);
@@ -166,7 +166,7 @@ static bool del_selection_line_based(bool chg)
             sel.end.line++;
         } else {
             sel.beg.col = 0;
-            sel.end.col = buf->text.lines[sel.end.line].n;
+            sel.end.col = get_text_line(&buf->text, sel.end.line)->n;
         }
         ev = delete_range(buf, &sel.beg, &sel.end);
     }
@@ -249,7 +249,8 @@ static int yank_selection(void)
             sel.end.col = 0;
             sel.end.line++;
          } else {
-              if (sel.end.col == SelFrame->buf->text.lines[sel.end.line].n) {
+              if (sel.end.col ==
+                      get_text_line(&SelFrame->buf->text, sel.end.line)->n) {
                  sel.end.line++;
                  sel.end.col = 0;
              } else {
@@ -328,10 +329,10 @@ static int add_to_number(int dir)
     get_selection(&sel);
     if (Core.mode == VISUAL_LINE_MODE) {
         sel.beg.col = 0;
-        sel.end.col = SelFrame->buf->text.lines[sel.end.line].n;
+        sel.end.col = get_text_line(&SelFrame->buf->text, sel.end.line)->n;
     }
     for (i = sel.beg.line; i <= sel.end.line; i++) {
-        line = &SelFrame->buf->text.lines[i];
+        line = get_text_line(&SelFrame->buf->text, i);
         m_c = sel.beg.col;
         c = MIN(sel.end.col + 1, line->n);
         if (Core.mode != VISUAL_BLOCK_MODE) {
@@ -389,10 +390,10 @@ static int add_to_number(int dir)
         }
     }
     clear_char_num(&num2);
-    Core.pos.col = MIN(Core.pos.col,
-                       SelFrame->buf->text.lines[Core.pos.line].n);
-    SelFrame->cur.col = MIN(SelFrame->cur.col,
-                            SelFrame->buf->text.lines[SelFrame->cur.line].n);
+    line = get_text_line(&SelFrame->buf->text, Core.pos.line);
+    Core.pos.col = MIN(Core.pos.col, line->n);
+    line = get_text_line(&SelFrame->buf->text, SelFrame->cur.line);
+    SelFrame->cur.col = MIN(SelFrame->cur.col, line->n);
     return UPDATE_UI | DO_NOT_RECORD;
 }
 
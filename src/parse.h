@@ -206,6 +206,52 @@ void copy_value(struct value *dest, const struct value *src);
  */
 void clear_value(struct value *value);
 
+/* * * Compiled groups * * */
+
+/*
+ * A group that is evaluated many times with different parameters, like the
+ * expression of `:s/pat/\=expr/`, can be compiled into a flat program. The
+ * program borrows from the group, so the group must outlive it.
+ */
+struct eval_prog;
+
+/**
+ * Compiles a group into a program.
+ *
+ * The parameters are variables that are bound to strings on each run, they
+ * are referenced by name and must be in the dictionary (`save_word()`).
+ *
+ * @param group         The group to compile.
+ * @param params        The names of the parameters.
+ * @param num_params    The number of parameters.
+ *
+ * @return The allocated program.
+ */
+struct eval_prog *compile_group(struct group *group, char *const *params,
+                                size_t num_params);
+
+/**
+ * Runs a compiled program.
+ *
+ * The arguments are not copied, the result may point into them. Otherwise it
+ * is owned by the program and valid until the next run.
+ *
+ * @param prog      The program to run.
+ * @param args      The strings to bind to the parameters.
+ * @param p_value   The resulting value.
+ *
+ * @return -1 if an error occured, 0 otherwise.
+ */
+int run_eval_prog(struct eval_prog *prog, const struct val_string *args,
+                  const struct value **p_value);
+
+/**
+ * Frees a program and the value of its last run.
+ *
+ * @param prog  The program to free.
+ */
+void free_eval_prog(struct eval_prog *prog);
+
 /* * * Parser * * */
 
 extern struct parser {
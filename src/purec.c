@@ -10,6 +10,7 @@
 #include <locale.h>
 #include <signal.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <unistd.h>
 
 WINDOW *OffScreen;
@@ -105,9 +106,9 @@ struct mark *get_mark(struct frame *frame, char ch)
             }
             m.buf = frame->buf;
             if (ch != ']') {
-                m.pos = frame->buf->events[frame->buf->event_i].pos;
+                m.pos = frame->buf->events[frame->buf->event_i - 1]->pos;
             } else {
-                m.pos = frame->buf->events[frame->buf->event_i].end;
+                m.pos = frame->buf->events[frame->buf->event_i - 1]->end;
             }
             break;
 
@@ -139,8 +140,8 @@ void yank_data(struct undo_seg *seg, int flags)
     struct reg *reg;
 
     if (Core.user_reg == '+' || Core.user_reg == '*') {
-        load_undo_data(seg);
-        if (copy_clipboard(seg, Core.user_reg == '*') == -1) {
+        if (load_undo_data(seg) == 0 &&
+                copy_clipboard(seg, Core.user_reg == '*') == -1) {
             unload_undo_data(seg);
         }
         /* else do not unload, copy will do that later */
@@ -178,13 +179,16 @@ void set_mode(int mode)
     col_t           indent;
 
     buf = SelFrame->buf;
+    if (Core.mode == INSERT_MODE) {
+        commit_insertion(buf);
+    }
     if (Core.mode == INSERT_MODE && buf->event_i > 0 &&
-            (buf->events[buf->event_i - 1].flags & IS_AUTO_INDENT)) {
+            (buf->events[buf->event_i - 1]->flags & IS_AUTO_INDENT)) {
         (void) get_line_indent(buf, SelFrame->cur.line, &indent);
-        if (indent == buf->text.lines[SelFrame->cur.line].n) {
+        if (indent == get_text_line(&buf->text, SelFrame->cur.line)->n) {
             undo_event_no_trans(buf);
             if (buf->event_i > 0) {
-                buf->events[buf->event_i - 1].flags |= IS_STOP;
+                buf->events[buf->event_i - 1]->flags |= IS_STOP;
             }
             SelFrame->cur.col = 0;
             (void) adjust_scroll(SelFrame);
@@ -463,7 +467,7 @@ void jump_to_file(const struct buf *buf, const struct pos *pos)
     struct buf      *new_buf;
     struct frame    *frame;
 
-    line = &buf->text.lines[pos->line];
+    line = get_text_line(&buf->text, pos->line);
     for (s = &line->s[pos->col]; s > line->s; s--) {
         if (!isalnum(s[-1]) &&
                 s[-1] != '.' &&
@@ -582,6 +586,39 @@ int handle_input(int c)
     return input_handlers[Core.mode](c);
 }
 
+/**
+ * Handles an access to a mapped file that was truncated by another process.
+ *
+ * The accessed page is replaced by zeros so that the access can continue,
+ * `check_buffer_mapping()` then notices the change and marks the buffer as
+ * stale.
+ */
+static void sigbus_handler(int sig, siginfo_t *info, void *ctx)
+{
+    struct buf      *buf;
+    char            *addr;
+    long            page_size;
+
+    (void) ctx;
+    addr = info->si_addr;
+    for (buf = FirstBuffer; buf != NULL; buf = buf->next) {
+        if (!buf->text.is_mapped || addr < buf->text.orig ||
+                addr >= buf->text.orig + buf->text.orig_len) {
+            continue;
+        }
+        page_size = sysconf(_SC_PAGESIZE);
+        addr -= (uintptr_t) addr % page_size;
+        if (mmap(addr, page_size, PROT_READ,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) !=
+                MAP_FAILED) {
+            return;
+        }
+        break;
+    }
+    /* not caused by a mapped file, fail as usual */
+    signal(sig, SIG_DFL);
+}
+
 static void sigint_handler(int sig)
 {
     (void) sig;
@@ -599,6 +636,7 @@ static void sigint_handler(int sig)
 int init_purec(int argc, char **argv)
 {
     const char      *home;
+    struct sigaction sa;
 
     setlocale(LC_ALL, "");
 
@@ -632,12 +670,20 @@ int init_purec(int argc, char **argv)
     initscr();
     cbreak();
     keypad(stdscr, true);
+    /* let the terminal move rows when frames scroll */
+    idlok(stdscr, true);
     noecho();
 
     set_escdelay(0);
 
     signal(SIGINT, sigint_handler);
 
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_sigaction = sigbus_handler;
+    sa.sa_flags = SA_SIGINFO;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGBUS, &sa, NULL);
+
     init_colors();
     init_clipboard();
 
@@ -652,6 +698,7 @@ int init_purec(int argc, char **argv)
     }
 
     wbkgdset(stdscr, ' ' | COLOR_PAIR(HI_NORMAL));
+    Core.is_screen_dirty = true;
     wbkgdset(Core.msg_win, ' ' | COLOR_PAIR(HI_NORMAL));
     wbkgdset(Core.preview_win, ' ' | COLOR_PAIR(HI_NORMAL));
     wbkgdset(OffScreen, ' ' | COLOR_PAIR(HI_NORMAL));
@@ -722,17 +769,39 @@ void render_all(void)
 
     int             cur_x, cur_y;
     struct frame    *frame;
+    struct buf      *buf;
     int             x;
     size_t          d, d2;
     
     curs_set(0);
 
-    erase();
+    if (Core.is_screen_dirty) {
+        erase();
+        for (frame = FirstFrame; frame != NULL; frame = frame->next) {
+            frame->view.buf = NULL;
+        }
+        Core.is_screen_dirty = false;
+    }
+
+    /* highlighting damages lines, so it must be done before any frame looks
+     * at the damage of its buffer
+     */
+    for (frame = FirstFrame; frame != NULL; frame = frame->next) {
+        highlight_up_to(frame->buf, frame->scroll.line + frame->h - 2);
+    }
 
     for (frame = FirstFrame; frame != NULL; frame = frame->next) {
         render_frame(frame);
     }
 
+    for (buf = FirstBuffer; buf != NULL; buf = buf->next) {
+        buf->num_damage = 0;
+    }
+
+    /* the message line is drawn again each time */
+    move(LINES - 1, 0);
+    clrtoeol();
+
     if (Core.msg_state == MSG_TO_DEFAULT) {
         set_message_to_default();
         Core.msg_state = MSG_DEFAULT;
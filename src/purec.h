@@ -96,6 +96,9 @@ extern struct core {
 
     /// contains the current characters pressed
     WINDOW *preview_win;
+    /// whether the screen must be erased and drawn again completely, for
+    /// example after a popup was drawn over the frames
+    bool is_screen_dirty;
 
     /// whether the editor should quit
     bool is_stopped;
@@ -486,7 +489,10 @@ int handle_input(int c);
 int init_purec(int argc, char **argv);
 
 /**
- * Renders all frames and places the cursor
+ * Renders all frames and places the cursor.
+ *
+ * The changes since the last call are drawn, unless `Core.is_screen_dirty` is
+ * set, then the screen is erased first and everything is drawn.
  */
 void render_all(void);
 
@@ -1,4 +1,5 @@
 #include "regex.h"
+#include "scan.h"
 #include "xalloc.h"
 
 #include <ctype.h>
@@ -53,13 +54,22 @@ static void walk_up_precedences(struct regex_parser *rp, int prec)
     }
 }
 
+static struct regex_group *new_group(struct regex_parser *rp)
+{
+    struct regex_group  *group;
+
+    group = arena_alloc(rp->arena, sizeof(*group));
+    memset(group, 0, sizeof(*group));
+    return group;
+}
+
 static void enter_group(struct regex_parser *rp, int group_type)
 {
     struct regex_group  *group;
 
     rp->stack = xreallocarray(rp->stack, rp->num_stack + 1,
                                  sizeof(*rp->stack));
-    group = xcalloc(1, sizeof(*group));
+    group = new_group(rp);
     group->type = group_type;
     rp->stack[rp->num_stack - 1]->right = group;
     rp->stack[rp->num_stack++] = group;
@@ -78,7 +88,7 @@ static void exchange_group(struct regex_parser *rp, int group_type)
     struct regex_group  *group;
     struct regex_group  *parent;
 
-    group = xcalloc(1, sizeof(*group));
+    group = new_group(rp);
     group->type = group_type;
     group->left = rp->stack[rp->num_stack - 1];
     if (rp->num_stack > 1) {
@@ -263,7 +273,7 @@ const char *parse_special_group(struct char_set *set, const char *s)
     return e + 1;
 }
 
-struct regex_group *parse_regex(const char *s)
+struct regex_group *parse_regex(const char *s, struct arena *arena)
 {
     struct regex_parser rp;
     char                chs[4];
@@ -271,8 +281,9 @@ struct regex_group *parse_regex(const char *s)
     size_t              ns;
     struct regex_group  *gr;
 
+    rp.arena = arena;
     rp.stack = xmalloc(sizeof(*rp.stack));
-    rp.stack[0] = xcalloc(1, sizeof(*rp.stack[0]));
+    rp.stack[0] = new_group(&rp);
     rp.num_stack = 1;
 
 beg:
@@ -384,196 +395,794 @@ infix:
     goto beg;
 }
 
-void free_regex_group(struct regex_group *group)
+size_t get_regex_line_span(struct regex_group *group)
 {
+    size_t          left, right;
+
     if (group == NULL) {
-        return;
+        return 0;
     }
-    free_regex_group(group->left);
-    free_regex_group(group->right);
-    free(group);
-}
 
-struct matcher_stack {
-    struct matcher_stack_item {
-        struct regex_group *group;
-        struct pos pos;
-        size_t times;
-    } *items;
-    size_t len;
-};
+    switch (group->type) {
+    case RXGROUP_LIT:
+        return is_char_toggled(&group->chars, '\n') ? 1 : 0;
 
-static inline void push_group(struct matcher_stack *stack,
-                              struct regex_group *group,
-                              struct pos *pos)
-{
-    stack->items = xrealloc(stack->items,
-                            sizeof(*stack->items) * (stack->len + 1));
-    stack->items[stack->len].group = group;
-    stack->items[stack->len].pos = *pos;
-    stack->items[stack->len].times = 0;
-    stack->len++;
+    case RXGROUP_ROUND:
+        return get_regex_line_span(group->left);
+
+    case RXGROUP_OR:
+        left = get_regex_line_span(group->left);
+        right = get_regex_line_span(group->right);
+        return MAX(left, right);
+
+    case RXGROUP_CON:
+        left = get_regex_line_span(group->left);
+        right = get_regex_line_span(group->right);
+        if (__builtin_add_overflow(left, right, &left)) {
+            return SIZE_MAX;
+        }
+        return left;
+
+    case RXGROUP_RANGE:
+        left = get_regex_line_span(group->left);
+        if (left == 0) {
+            return 0;
+        }
+        if (group->max == SIZE_MAX ||
+                __builtin_mul_overflow(left, group->max, &left)) {
+            return SIZE_MAX;
+        }
+        return left;
+
+    default:
+        /* assertions and empty groups do not consume anything */
+        return 0;
+    }
 }
 
-static inline struct regex_group *pop_group(struct matcher_stack *stack,
-                                            struct pos *pos)
+/**
+ * The maximum number of cached DFA states before the cache is flushed.
+ */
+#define DFA_MAX_STATES 1024
+
+static size_t emit_inst(struct regex_prog *prog, enum regex_op op,
+                        size_t x, size_t y)
 {
-    struct matcher_stack_item   *item;
+    struct regex_inst   *inst;
 
-    item = &stack->items[--stack->len];
-    if (pos != NULL) {
-        *pos = item->pos;
+    if (prog->num_insts == prog->a_insts) {
+        prog->a_insts *= 2;
+        prog->a_insts += 8;
+        prog->insts = xreallocarray(prog->insts, prog->a_insts,
+                                    sizeof(*prog->insts));
     }
-    return item->group;
+    inst = &prog->insts[prog->num_insts];
+    inst->op = op;
+    inst->x = x;
+    inst->y = y;
+    return prog->num_insts++;
 }
 
-static inline int pop_group_success(struct matcher_stack *stack,
-                                    struct regex_group **p_group,
-                                    struct pos *pos)
+static void compile_group(struct regex_prog *prog, struct regex_group *group)
 {
-    struct regex_group  *group;
-    size_t              times;
+    size_t          split, jmp;
+    size_t          i;
 
-    while (stack->len > 0) {
-        group = pop_group(stack, NULL);
-        switch (group->type) {
-        case RXGROUP_OR:
-        case RXGROUP_ROUND:
-            break;
+    if (group == NULL) {
+        return;
+    }
 
-        case RXGROUP_CON:
-            *p_group = group->right;
-            return 0;
+    switch (group->type) {
+    case RXGROUP_NULL:
+        emit_inst(prog, RXOP_FAIL, 0, 0);
+        break;
 
-        case RXGROUP_RANGE:
-            times = stack->items[stack->len].times + 1;
-            if (times < group->max) {
-                push_group(stack, group, pos);
-                stack->items[stack->len - 1].times = times;
-                *p_group = group->left;
-                return 0;
-            }
-            break;
+    case RXGROUP_ROUND:
+        compile_group(prog, group->left);
+        break;
 
-        default:
-            *p_group = group;
-            return 0;
+    case RXGROUP_CON:
+        compile_group(prog, group->left);
+        compile_group(prog, group->right);
+        break;
+
+    case RXGROUP_OR:
+        split = emit_inst(prog, RXOP_SPLIT, 0, 0);
+        prog->insts[split].x = prog->num_insts;
+        compile_group(prog, group->left);
+        jmp = emit_inst(prog, RXOP_JMP, 0, 0);
+        prog->insts[split].y = prog->num_insts;
+        compile_group(prog, group->right);
+        prog->insts[jmp].x = prog->num_insts;
+        break;
+
+    case RXGROUP_RANGE:
+        for (i = 0; i < group->min; i++) {
+            compile_group(prog, group->left);
         }
+        if (group->max == SIZE_MAX) {
+            split = emit_inst(prog, RXOP_SPLIT, 0, 0);
+            prog->insts[split].x = prog->num_insts;
+            compile_group(prog, group->left);
+            emit_inst(prog, RXOP_JMP, split, 0);
+            prog->insts[split].y = prog->num_insts;
+        } else {
+            /* every optional repetition skips to the end when not taken,
+             * the jump targets are patched once the end is known
+             */
+            jmp = prog->num_insts;
+            for (; i < group->max; i++) {
+                emit_inst(prog, RXOP_SPLIT, prog->num_insts + 1, SIZE_MAX);
+                compile_group(prog, group->left);
+            }
+            for (; jmp < prog->num_insts; jmp++) {
+                if (prog->insts[jmp].op == RXOP_SPLIT &&
+                        prog->insts[jmp].y == SIZE_MAX) {
+                    prog->insts[jmp].y = prog->num_insts;
+                }
+            }
+        }
+        break;
+
+    case RXGROUP_LIT:
+        prog->sets = xreallocarray(prog->sets, prog->num_sets + 1,
+                                   sizeof(*prog->sets));
+        prog->sets[prog->num_sets] = group->chars;
+        emit_inst(prog, RXOP_SET, prog->num_sets++, 0);
+        break;
+
+    case RXGROUP_WORD_START:
+        emit_inst(prog, RXOP_WORD_START, 0, 0);
+        prog->has_assertions = true;
+        break;
+
+    case RXGROUP_WORD_END:
+        emit_inst(prog, RXOP_WORD_END, 0, 0);
+        prog->has_assertions = true;
+        break;
+
+    case RXGROUP_START:
+        emit_inst(prog, RXOP_START, 0, 0);
+        prog->has_assertions = true;
+        break;
+
+    case RXGROUP_END:
+        emit_inst(prog, RXOP_END, 0, 0);
+        prog->has_assertions = true;
+        break;
     }
-    *p_group = NULL;
-    return 0;
 }
 
-static inline int pop_group_fail(struct matcher_stack *stack,
-                                 struct regex_group **p_group,
-                                 struct pos *pos)
+/**
+ * Allocates the memory the Pike VM and DFA construction work in.
+ *
+ * @param prog  The program with all instructions emitted.
+ */
+static void init_work_memory(struct regex_prog *prog)
 {
-    struct regex_group  *group;
+    prog->lists[0].threads = xreallocarray(NULL, prog->num_insts,
+                                           sizeof(*prog->lists[0].threads));
+    prog->lists[1].threads = xreallocarray(NULL, prog->num_insts,
+                                           sizeof(*prog->lists[1].threads));
+    prog->marks = xcalloc(prog->num_insts, sizeof(*prog->marks));
+    prog->scratch = xreallocarray(NULL, prog->num_insts,
+                                  sizeof(*prog->scratch));
+}
 
-    while (stack->len > 0) {
-        group = pop_group(stack, NULL);
-        switch (group->type) {
-        case RXGROUP_OR:
-            *pos = stack->items[stack->len].pos;
-            *p_group = group->right;
-            return 0;
+/**
+ * Gets the only char within a char set.
+ *
+ * @param set   The set to check.
+ *
+ * @return The char or -1 if the set does not have exactly one char.
+ */
+static int get_single_char(const struct char_set *set)
+{
+    int             c;
+    unsigned        i;
+    int             count;
 
-        case RXGROUP_RANGE:
-            if (stack->items[stack->len].times < group->min) {
-                break;
-            }
-            *pos = stack->items[stack->len].pos;
-            return pop_group_success(stack, p_group, pos);
+    c = -1;
+    count = 0;
+    for (i = 0; i < ARRAY_SIZE(set->set); i++) {
+        if (set->set[i] != 0) {
+            count += __builtin_popcount(set->set[i]);
+            c = i * 16 + __builtin_ctz(set->set[i]);
+        }
+    }
+    return count == 1 ? c : -1;
+}
 
-        default:
-            /* nothing */
+/**
+ * Collects the literal every match must start with.
+ *
+ * @param prog  The program to analyze.
+ */
+static void extract_prefix(struct regex_prog *prog)
+{
+    size_t              pc;
+    struct regex_inst   *inst;
+    int                 c;
+
+    prog->prefix = xmalloc(prog->num_insts);
+    for (pc = 0; ; ) {
+        inst = &prog->insts[pc];
+        if (inst->op == RXOP_JMP) {
+            pc = inst->x;
+            continue;
+        }
+        if (inst->op == RXOP_MATCH) {
+            prog->is_literal = true;
             break;
         }
+        if (inst->op != RXOP_SET) {
+            break;
+        }
+        c = get_single_char(&prog->sets[inst->x]);
+        /* the prefix is searched for within single lines */
+        if (c == -1 || c == '\n') {
+            break;
+        }
+        prog->prefix[prog->prefix_len++] = c;
+        pc++;
+    }
+}
+
+struct regex_prog *compile_regex(struct regex_group *group)
+{
+    struct regex_prog   *prog;
+
+    prog = xcalloc(1, sizeof(*prog));
+    compile_group(prog, group);
+    emit_inst(prog, RXOP_MATCH, 0, 0);
+    prog->line_span = get_regex_line_span(group);
+    init_work_memory(prog);
+    extract_prefix(prog);
+    return prog;
+}
+
+struct regex_prog *copy_regex_prog(const struct regex_prog *prog)
+{
+    struct regex_prog   *copy;
+
+    copy = xcalloc(1, sizeof(*copy));
+    copy->insts = xmemdup(prog->insts, sizeof(*prog->insts) * prog->num_insts);
+    copy->num_insts = prog->num_insts;
+    copy->a_insts = prog->num_insts;
+    copy->sets = xmemdup(prog->sets, sizeof(*prog->sets) * prog->num_sets);
+    copy->num_sets = prog->num_sets;
+    copy->has_assertions = prog->has_assertions;
+    copy->line_span = prog->line_span;
+    copy->prefix = xmemdup(prog->prefix, prog->prefix_len);
+    copy->prefix_len = prog->prefix_len;
+    copy->is_literal = prog->is_literal;
+    init_work_memory(copy);
+    return copy;
+}
+
+/**
+ * Removes all cached DFA states.
+ *
+ * @param prog  The program whose cache to clear.
+ */
+static void flush_states(struct regex_prog *prog)
+{
+    size_t          i;
+
+    for (i = 0; i < prog->num_states; i++) {
+        free(prog->states[i].pcs);
+    }
+    prog->num_states = 0;
+    for (i = 0; i < prog->a_table; i++) {
+        prog->table[i] = SIZE_MAX;
+    }
+    prog->num_flushes++;
+}
+
+void free_regex_prog(struct regex_prog *prog)
+{
+    if (prog == NULL) {
+        return;
+    }
+    flush_states(prog);
+    free(prog->states);
+    free(prog->table);
+    free(prog->insts);
+    free(prog->sets);
+    free(prog->lists[0].threads);
+    free(prog->lists[1].threads);
+    free(prog->marks);
+    free(prog->scratch);
+    free(prog->prefix);
+    free(prog);
+}
+
+/**
+ * Gets the char at given position.
+ *
+ * @param matcher   The input text.
+ * @param pos       The position of the char.
+ *
+ * @return The char or -1 if the position is at the end of the text.
+ */
+static inline int get_char_at(const struct regex_matcher *matcher,
+                              const struct pos *pos)
+{
+    const struct line   *line;
+
+    line = get_text_line(matcher->text, pos->line);
+    if (pos->col < line->n) {
+        return (unsigned char) line->s[pos->col];
+    }
+    if (pos->line + 1 < matcher->text->num_lines) {
+        return '\n';
     }
     return -1;
 }
 
-int match_regex(struct regex_group *group, struct regex_matcher *matcher)
+static inline void step_pos(const struct regex_matcher *matcher,
+                            struct pos *pos)
 {
-    struct matcher_stack    stack;
-    struct line             *line;
-
-    memset(&stack, 0, sizeof(stack));
-    while (group != NULL) {
-        switch (group->type) {
-        case RXGROUP_NULL:
-            goto fail;
-
-        case RXGROUP_ROUND:
-        case RXGROUP_CON:
-        case RXGROUP_OR:
-        case RXGROUP_RANGE:
-            push_group(&stack, group, &matcher->pos);
-            group = group->left;
-            continue;
+    if (pos->col < get_text_line(matcher->text, pos->line)->n) {
+        pos->col++;
+    } else {
+        pos->line++;
+        pos->col = 0;
+    }
+}
 
-        case RXGROUP_WORD_START:
-            line = &matcher->lines[matcher->pos.line];
-            if (matcher->pos.col == line->n ||
-                    !isidentf(line->s[matcher->pos.col]) ||
-                    (matcher->pos.col > 0 &&
-                     isidentf(line->s[matcher->pos.col - 1]))) {
-                goto fail;
-            }
-            break;
+static bool check_assertion(enum regex_op op,
+                            const struct regex_matcher *matcher,
+                            const struct pos *pos)
+{
+    const struct line   *line;
 
-        case RXGROUP_WORD_END:
-            line = &matcher->lines[matcher->pos.line];
-            if (matcher->pos.col == line->n || matcher->pos.col == 0 ||
-                    isidentf(line->s[matcher->pos.col]) ||
-                    !isidentf(line->s[matcher->pos.col - 1])) {
-                goto fail;
-            }
+    line = get_text_line(matcher->text, pos->line);
+    switch (op) {
+    case RXOP_WORD_START:
+        return pos->col < line->n && isidentf(line->s[pos->col]) &&
+            (pos->col == 0 || !isidentf(line->s[pos->col - 1]));
+
+    case RXOP_WORD_END:
+        return pos->col < line->n && pos->col > 0 &&
+            !isidentf(line->s[pos->col]) && isidentf(line->s[pos->col - 1]);
+
+    case RXOP_START:
+        return pos->col == 0;
+
+    case RXOP_END:
+        return pos->col == line->n;
+
+    default:
+        return false;
+    }
+}
+
+/**
+ * Adds a thread to a list and follows all jumps and assertions.
+ *
+ * Instructions already in the list are not added again because the thread
+ * that added them first has the higher priority.
+ */
+static void add_thread(struct regex_prog *prog, struct regex_thread_list *list,
+                       size_t pc, const struct pos *start,
+                       const struct regex_matcher *matcher,
+                       const struct pos *pos)
+{
+    struct regex_inst   *inst;
+
+    if (prog->marks[pc] == prog->gen) {
+        return;
+    }
+    prog->marks[pc] = prog->gen;
+
+    inst = &prog->insts[pc];
+    switch (inst->op) {
+    case RXOP_SPLIT:
+        add_thread(prog, list, inst->x, start, matcher, pos);
+        add_thread(prog, list, inst->y, start, matcher, pos);
+        break;
+
+    case RXOP_JMP:
+        add_thread(prog, list, inst->x, start, matcher, pos);
+        break;
+
+    case RXOP_WORD_START:
+    case RXOP_WORD_END:
+    case RXOP_START:
+    case RXOP_END:
+        if (check_assertion(inst->op, matcher, pos)) {
+            add_thread(prog, list, pc + 1, start, matcher, pos);
+        }
+        break;
+
+    case RXOP_FAIL:
+        break;
+
+    case RXOP_SET:
+    case RXOP_MATCH:
+        list->threads[list->num].pc = pc;
+        list->threads[list->num].start = *start;
+        list->num++;
+        break;
+    }
+}
+
+/**
+ * Runs the Pike VM, all threads run in lock step over the input so that every
+ * char is looked at only once.
+ */
+static int pike_search(struct regex_prog *prog, struct regex_matcher *matcher,
+                       const struct pos *to, struct pos *p_start)
+{
+    struct regex_thread_list    *cur, *next, *tmp;
+    struct pos                  pos, next_pos, end;
+    bool                        matched;
+    int                         c;
+    size_t                      i;
+    struct regex_thread         *thread;
+    struct regex_inst           *inst;
+
+    cur = &prog->lists[0];
+    next = &prog->lists[1];
+    cur->num = 0;
+    prog->gen++;
+    pos = matcher->pos;
+    matched = false;
+    while (1) {
+        /* a new thread for each start position has the lowest priority */
+        if (!matched && !is_point_before(to, &pos)) {
+            add_thread(prog, cur, 0, &pos, matcher, &pos);
+        }
+        if (cur->num == 0 && (matched || !is_point_before(&pos, to))) {
             break;
+        }
 
-        case RXGROUP_START:
-            if (matcher->pos.col > 0) {
-                goto fail;
+        c = get_char_at(matcher, &pos);
+        next_pos = pos;
+        if (c != -1) {
+            step_pos(matcher, &next_pos);
+        }
+        prog->gen++;
+        next->num = 0;
+        for (i = 0; i < cur->num; i++) {
+            thread = &cur->threads[i];
+            inst = &prog->insts[thread->pc];
+            if (inst->op == RXOP_MATCH) {
+                /* cut off all threads with lower priority */
+                matched = true;
+                *p_start = thread->start;
+                end = pos;
+                break;
+            }
+            if (c != -1 && is_char_toggled(&prog->sets[inst->x], c)) {
+                add_thread(prog, next, thread->pc + 1, &thread->start,
+                           matcher, &next_pos);
             }
+        }
+        if (c == -1) {
             break;
+        }
+        tmp = cur;
+        cur = next;
+        next = tmp;
+        pos = next_pos;
+    }
+
+    if (!matched) {
+        return 1;
+    }
+    matcher->pos = end;
+    return 0;
+}
+
+static int compare_pcs(const void *a, const void *b)
+{
+    const size_t    *pc1 = a, *pc2 = b;
+
+    return *pc1 < *pc2 ? -1 : *pc1 > *pc2;
+}
+
+/**
+ * Adds the closure of an instruction to the scratch set, the program has no
+ * assertions, so the closure does not depend on the position.
+ */
+static void add_dfa_pc(struct regex_prog *prog, size_t *p_num, size_t pc)
+{
+    struct regex_inst   *inst;
+
+    if (prog->marks[pc] == prog->gen) {
+        return;
+    }
+    prog->marks[pc] = prog->gen;
+
+    inst = &prog->insts[pc];
+    switch (inst->op) {
+    case RXOP_SPLIT:
+        add_dfa_pc(prog, p_num, inst->x);
+        add_dfa_pc(prog, p_num, inst->y);
+        break;
+
+    case RXOP_JMP:
+        add_dfa_pc(prog, p_num, inst->x);
+        break;
+
+    case RXOP_SET:
+    case RXOP_MATCH:
+        prog->scratch[(*p_num)++] = pc;
+        break;
+
+    default:
+        break;
+    }
+}
+
+static size_t hash_pcs(const size_t *pcs, size_t num_pcs)
+{
+    size_t          hash;
+    size_t          i;
+
+    hash = 14695981039346656037u;
+    for (i = 0; i < num_pcs; i++) {
+        hash ^= pcs[i];
+        hash *= 1099511628211u;
+    }
+    return hash;
+}
+
+/**
+ * Gets the state for the instructions in the scratch set and creates it if it
+ * does not exist yet.
+ */
+static size_t intern_state(struct regex_prog *prog, size_t num_pcs)
+{
+    size_t                  slot;
+    size_t                  index;
+    struct regex_dfa_state  *state;
+    size_t                  i;
+
+    qsort(prog->scratch, num_pcs, sizeof(*prog->scratch), compare_pcs);
+
+    if (prog->num_states == DFA_MAX_STATES) {
+        flush_states(prog);
+    }
+
+    if (prog->a_table == 0) {
+        prog->a_table = DFA_MAX_STATES * 2;
+        prog->table = xreallocarray(NULL, prog->a_table, sizeof(*prog->table));
+        for (i = 0; i < prog->a_table; i++) {
+            prog->table[i] = SIZE_MAX;
+        }
+    }
+
+    slot = hash_pcs(prog->scratch, num_pcs) & (prog->a_table - 1);
+    while ((index = prog->table[slot]) != SIZE_MAX) {
+        state = &prog->states[index];
+        if (state->num_pcs == num_pcs && (num_pcs == 0 ||
+                memcmp(state->pcs, prog->scratch,
+                       sizeof(*state->pcs) * num_pcs) == 0)) {
+            return index;
+        }
+        slot = (slot + 1) & (prog->a_table - 1);
+    }
+
+    if (prog->num_states == prog->a_states) {
+        prog->a_states *= 2;
+        prog->a_states += 4;
+        prog->states = xreallocarray(prog->states, prog->a_states,
+                                     sizeof(*prog->states));
+    }
+    index = prog->num_states++;
+    prog->table[slot] = index;
+    state = &prog->states[index];
+    state->pcs = xmemdup(prog->scratch, sizeof(*state->pcs) * num_pcs);
+    state->num_pcs = num_pcs;
+    state->is_match = false;
+    for (i = 0; i < num_pcs; i++) {
+        if (prog->insts[state->pcs[i]].op == RXOP_MATCH) {
+            state->is_match = true;
+        }
+    }
+    state->seeded = SIZE_MAX;
+    for (i = 0; i < ARRAY_SIZE(state->next); i++) {
+        state->next[i] = SIZE_MAX;
+    }
+    return index;
+}
+
+/**
+ * Gets the state that follows after consuming a char.
+ */
+static size_t get_next_state(struct regex_prog *prog, size_t index, int c)
+{
+    struct regex_dfa_state  *state;
+    size_t                  num, i;
+    size_t                  pc;
+    size_t                  flushes;
+    size_t                  next;
+
+    state = &prog->states[index];
+    if (state->next[c] != SIZE_MAX) {
+        return state->next[c];
+    }
+
+    prog->gen++;
+    num = 0;
+    for (i = 0; i < state->num_pcs; i++) {
+        pc = state->pcs[i];
+        if (prog->insts[pc].op == RXOP_SET &&
+                is_char_toggled(&prog->sets[prog->insts[pc].x], c)) {
+            add_dfa_pc(prog, &num, pc + 1);
+        }
+    }
 
-        case RXGROUP_END:
-            line = &matcher->lines[matcher->pos.line];
-            if (matcher->pos.col < line->n) {
-                goto fail;
+    flushes = prog->num_flushes;
+    next = intern_state(prog, num);
+    /* the source state is gone if the cache was flushed */
+    if (flushes == prog->num_flushes) {
+        prog->states[index].next[c] = next;
+    }
+    return next;
+}
+
+/**
+ * Gets the state that has the starting instructions added.
+ */
+static size_t get_seeded_state(struct regex_prog *prog, size_t index)
+{
+    struct regex_dfa_state  *state;
+    size_t                  num, i;
+    size_t                  flushes;
+    size_t                  seeded;
+
+    if (index != SIZE_MAX) {
+        state = &prog->states[index];
+        if (state->seeded != SIZE_MAX) {
+            return state->seeded;
+        }
+    }
+
+    prog->gen++;
+    num = 0;
+    if (index != SIZE_MAX) {
+        state = &prog->states[index];
+        for (i = 0; i < state->num_pcs; i++) {
+            add_dfa_pc(prog, &num, state->pcs[i]);
+        }
+    }
+    add_dfa_pc(prog, &num, 0);
+
+    flushes = prog->num_flushes;
+    seeded = intern_state(prog, num);
+    if (index != SIZE_MAX && flushes == prog->num_flushes) {
+        prog->states[index].seeded = seeded;
+    }
+    return seeded;
+}
+
+/**
+ * Checks with the DFA if any match starts before `to`.
+ *
+ * @param p_restart The pointer to store the position in from which the exact
+ *                  match can be searched.
+ *
+ * @return Whether there is a match.
+ */
+static bool dfa_search(struct regex_prog *prog,
+                       const struct regex_matcher *matcher,
+                       const struct pos *to, struct pos *p_restart)
+{
+    struct pos      pos;
+    size_t          index;
+    int             c;
+
+    pos = matcher->pos;
+    *p_restart = pos;
+    index = get_seeded_state(prog, SIZE_MAX);
+    while (!prog->states[index].is_match) {
+        c = get_char_at(matcher, &pos);
+        if (c == -1) {
+            return false;
+        }
+        index = get_next_state(prog, index, c);
+        step_pos(matcher, &pos);
+        if (prog->states[index].num_pcs == 0) {
+            /* all earlier threads died, so a match starts here or later */
+            *p_restart = pos;
+            if (is_point_before(to, &pos)) {
+                return false;
             }
-            break;
+        }
+        if (!is_point_before(to, &pos)) {
+            index = get_seeded_state(prog, index);
+        }
+    }
+    return true;
+}
 
-        case RXGROUP_LIT:
-            line = &matcher->lines[matcher->pos.line];
-            if (matcher->pos.col == line->n) {
-                if (matcher->pos.line + 1 < matcher->num_lines &&
-                        is_char_toggled(&group->chars, '\n')) {
-                    matcher->pos.col = 0;
-                    matcher->pos.line++;
-                    break;
-                }
-            } else if (is_char_toggled(&group->chars,
-                                       line->s[matcher->pos.col])) {
-                matcher->pos.col++;
+/**
+ * Finds the next position where the literal prefix of the program occurs.
+ *
+ * @param pos   The position to start at, this is set to the found position.
+ *
+ * @return Whether the prefix was found before `to`.
+ */
+static bool find_prefix(const struct regex_prog *prog,
+                        const struct regex_matcher *matcher,
+                        const struct pos *to, struct pos *pos)
+{
+    struct pos          p;
+    const struct line   *line;
+    const char          *s, *end;
+
+    for (p = *pos; p.line <= to->line; p.line++, p.col = 0) {
+        line = get_text_line(matcher->text, p.line);
+        if (line->n - p.col < (col_t) prog->prefix_len) {
+            continue;
+        }
+        s = &line->s[p.col];
+        /* the prefix can not start within the last bytes */
+        end = &line->s[line->n - prog->prefix_len + 1];
+        while (s = find_byte(s, end, prog->prefix[0]), s != end) {
+            if (memcmp(s + 1, prog->prefix + 1, prog->prefix_len - 1) == 0) {
                 break;
             }
-            goto fail;
+            s++;
         }
+        if (s == end) {
+            continue;
+        }
+        p.col = s - line->s;
+        if (is_point_before(to, &p)) {
+            return false;
+        }
+        *pos = p;
+        return true;
+    }
+    return false;
+}
 
-        (void) pop_group_success(&stack, &group, &matcher->pos);
-        continue;
+int search_regex(struct regex_prog *prog, struct regex_matcher *matcher,
+                 const struct pos *to, struct pos *p_start)
+{
+    struct pos      restart, start;
+
+    matcher->num = 0;
+    if (prog->prefix_len > 0) {
+        /* every match starts with the prefix, so no match starts before its
+         * first occurrence
+         */
+        start = matcher->pos;
+        if (!find_prefix(prog, matcher, to, &start)) {
+            return 1;
+        }
+        matcher->pos = start;
+        if (prog->is_literal) {
+            *p_start = start;
+            matcher->pos.col += prog->prefix_len;
+            return 0;
+        }
+    }
 
-    fail:
-        if (pop_group_fail(&stack, &group, &matcher->pos) == -1) {
-            goto mismatch;
+    if (!prog->has_assertions) {
+        if (!dfa_search(prog, matcher, to, &restart)) {
+            return 1;
         }
+        matcher->pos = restart;
     }
+    return pike_search(prog, matcher, to, p_start);
+}
 
-    free(stack.items);
-    return 0;
+int match_regex(struct regex_group *group, struct regex_matcher *matcher)
+{
+    struct regex_prog   *prog;
+    struct pos          to, start;
+    int                 r;
 
-mismatch:
-    free(stack.items);
-    return 1;
+    prog = compile_regex(group);
+    /* only allow the match to start at the current position */
+    to = matcher->pos;
+    r = search_regex(prog, matcher, &to, &start);
+    free_regex_prog(prog);
+    return r;
 }
@@ -7,6 +7,7 @@
 
 #include "util.h"
 #include "text.h"
+#include "xalloc.h"
 
 struct char_set {
     uint16_t set[16];
@@ -67,19 +68,31 @@ struct regex_group {
 struct regex_parser {
     struct regex_group **stack;
     size_t num_stack;
+    /// the arena the groups are allocated from
+    struct arena *arena;
 };
 
 /**
  * Parses given regex to the internal regex group structure.
+ *
+ * The groups only live until they are compiled, so they are allocated from
+ * an arena and freed all at once by clearing it.
+ *
+ * @param s     The regex to parse.
+ * @param arena The arena to allocate the groups from.
+ *
+ * @return The root group.
  */
-struct regex_group *parse_regex(const char *s);
+struct regex_group *parse_regex(const char *s, struct arena *arena);
 
 /**
- * Frees a regex group allocated by the parsing process.
+ * Gets the maximum number of line breaks a match of the regex group can span.
  *
- * @param group The group to check for.
+ * @param group The group to check.
+ *
+ * @return The number of line breaks or `SIZE_MAX` if it is not bounded.
  */
-void free_regex_group(struct regex_group *group);
+size_t get_regex_line_span(struct regex_group *group);
 
 struct regex_match {
     /// the start of the match
@@ -89,20 +102,173 @@ struct regex_match {
 };
 
 struct regex_matcher {
-    struct line *lines;
-    line_t num_lines;
+    /// the text to match against
+    const struct text *text;
     struct pos pos;
     struct regex_match sub[9];
     size_t num;
 };
 
+enum regex_op {
+    /// consume a char that is within a char set
+    RXOP_SET,
+    /// continue at `x` and with lower priority at `y`
+    RXOP_SPLIT,
+    /// continue at `x`
+    RXOP_JMP,
+    /// assert the start of a word
+    RXOP_WORD_START,
+    /// assert the end of a word
+    RXOP_WORD_END,
+    /// assert the start of a line
+    RXOP_START,
+    /// assert the end of a line
+    RXOP_END,
+    /// stop this thread
+    RXOP_FAIL,
+    /// a match was found
+    RXOP_MATCH,
+};
+
+struct regex_inst {
+    /// the operation of this instruction
+    enum regex_op op;
+    /// the char set index or jump target
+    size_t x;
+    /// the second jump target
+    size_t y;
+};
+
+struct regex_thread {
+    /// the instruction the thread is at
+    size_t pc;
+    /// the position where the thread started matching
+    struct pos start;
+};
+
+struct regex_thread_list {
+    /// the threads ordered by priority
+    struct regex_thread *threads;
+    /// the number of threads
+    size_t num;
+};
+
+struct regex_dfa_state {
+    /// the sorted instructions the state consists of
+    size_t *pcs;
+    /// the number of instructions
+    size_t num_pcs;
+    /// whether any thread within this state has matched
+    bool is_match;
+    /// the state with the starting instructions added or `SIZE_MAX`
+    size_t seeded;
+    /// the state after consuming a char or `SIZE_MAX` if not yet known
+    size_t next[256];
+};
+
+/**
+ * A regex compiled to instructions for a Pike VM.
+ *
+ * Patterns without assertions are first run through a lazily built DFA that
+ * finds out cheaply whether and roughly where a match is. The DFA states are
+ * cached within the program and flushed once there are too many.
+ */
+struct regex_prog {
+    /// the instructions
+    struct regex_inst *insts;
+    /// the number of instructions
+    size_t num_insts;
+    /// the number of allocated instructions
+    size_t a_insts;
+    /// the char sets used by `RXOP_SET`
+    struct char_set *sets;
+    /// the number of char sets
+    size_t num_sets;
+    /// whether any assertion instruction is used
+    bool has_assertions;
+    /// the maximum number of line breaks a match can span
+    size_t line_span;
+    /// the literal every match starts with
+    char *prefix;
+    /// the length of the prefix
+    size_t prefix_len;
+    /// whether the pattern is nothing but the prefix
+    bool is_literal;
+
+    /// current and next thread list of the Pike VM
+    struct regex_thread_list lists[2];
+    /// generation in which an instruction was last added to a list
+    size_t *marks;
+    /// the current generation
+    size_t gen;
+
+    /// the cached DFA states
+    struct regex_dfa_state *states;
+    /// the number of cached states
+    size_t num_states;
+    /// the number of allocated states
+    size_t a_states;
+    /// hash table of state indexes, `SIZE_MAX` for empty slots
+    size_t *table;
+    /// the number of slots in the hash table
+    size_t a_table;
+    /// the number of times the cache was flushed
+    size_t num_flushes;
+    /// space for building a set of instructions
+    size_t *scratch;
+};
+
+/**
+ * Compiles a regex group to a program.
+ *
+ * @param group The group to compile.
+ *
+ * @return The allocated program.
+ */
+struct regex_prog *compile_regex(struct regex_group *group);
+
+/**
+ * Makes a copy of a program that can be run independently of the original,
+ * for example by another thread.
+ *
+ * @param prog  The program to copy.
+ *
+ * @return The allocated copy.
+ */
+struct regex_prog *copy_regex_prog(const struct regex_prog *prog);
+
+/**
+ * Frees a program allocated by `compile_regex()` or `copy_regex_prog()`.
+ *
+ * @param prog  The program to free.
+ */
+void free_regex_prog(struct regex_prog *prog);
+
+/**
+ * Searches the first match that starts between the matcher position and `to`.
+ *
+ * Matches follow the usual leftmost first rules: the leftmost start wins and
+ * for that start, alternatives on the left and longer repetitions are
+ * preferred. The search time is linear in the searched text.
+ *
+ * @param prog      The program to run.
+ * @param matcher   The input text and the position to start at. On success,
+ *                  the position is set to the end of the match.
+ * @param to        The last position a match may start at.
+ * @param p_start   The pointer to store the start of the match in.
+ *
+ * @return 0 if a match was found, otherwise 1.
+ */
+int search_regex(struct regex_prog *prog, struct regex_matcher *matcher,
+                 const struct pos *to, struct pos *p_start);
+
 /**
  * Matches given string against a regex group.
  *
  * @param group     The group to use for matching.
  * @param matcher   The place to store sub matches and the input text.
  *
- * @return The length of the match.
+ * @return 0 if the group matches at the matcher position, otherwise 1.
  */
 int match_regex(struct regex_group *group, struct regex_matcher *matcher);
 
@@ -27,8 +27,6 @@ struct render_info {
     struct buf *buf;
     /// the line to render
     struct line *line;
-    /// the attributes of the line
-    int *attribs;
     /// the index of the line to render
     line_t line_i;
 };
@@ -96,77 +94,119 @@ struct lang Langs[] = {
 };
 
 /**
- * Renders a line using its cached attribute data.
+ * Draws a part of a run.
  *
  * @param ri    Render information.
+ * @param run   The run to draw.
+ * @param col   The index of the first byte to draw.
+ * @param n     The number of bytes to draw.
+ * @param x     The visual column to draw at.
  */
-static void render_line(struct render_info *ri)
+static void render_run(struct render_info *ri, const struct layout_run *run,
+                       col_t col, col_t n, col_t x)
 {
-    col_t           col;
-    col_t           sp_thres;
-    col_t           x;
-    int             hi;
-    struct glyph    g;
-    bool            err;
     char            ch;
-    col_t           x2;
-    int             t, a;
 
-    for (sp_thres = ri->line->n; sp_thres > 0; sp_thres --) {
-        if (!isblank(ri->line->s[sp_thres - 1])) {
-            break;
+    set_highlight(stdscr, run->hi);
+    switch (run->kind) {
+    case RUN_TEXT:
+        mvaddnstr(ri->off_y, ri->off_x + x, &ri->line->s[col], n);
+        break;
+
+    case RUN_BLANK:
+        move(ri->off_y, ri->off_x + x);
+        for (; n > 0; n--) {
+            addstr("·");
         }
-    }
+        break;
+
+    case RUN_TAB:
+        mvaddstr(ri->off_y, ri->off_x + x, "»");
+        break;
 
-    for (col = 0, x = 0; col < ri->line->n && x < ri->w;) {
+    case RUN_ERROR:
+        mvaddch(ri->off_y, ri->off_x + x, '?');
+        break;
+
+    case RUN_CONTROL:
         ch = ri->line->s[col];
-        if (ch == '\t') {
-            if (col >= sp_thres) {
-                set_highlight(stdscr, HI_MAX);
-                if (x >= ri->x) {
-                    mvaddstr(ri->off_y, ri->off_x + x, "»");
-                }
-            }
-            col++;
-            x += tab_adjust(x, ri->buf->rule.tab_size);
+        mvaddch(ri->off_y, ri->off_x + x, '^');
+        addch(ch == 0x7f ? '?' : ch + '@');
+        break;
+    }
+}
+
+/**
+ * Draws a run that is cut off by the left or right side glyph by glyph.
+ *
+ * @param ri    Render information.
+ * @param run   The run to draw.
+ *
+ * @return Whether the right side was not reached.
+ */
+static bool render_clipped_run(struct render_info *ri,
+                               const struct layout_run *run)
+{
+    col_t           col, x;
+    struct glyph    g;
+
+    for (col = run->col, x = run->x; col < run->col + run->n;
+         col += g.n, x += g.w) {
+        if (x >= ri->w) {
+            return false;
+        }
+        (void) get_glyph(&ri->line->s[col], ri->line->n - col, &g);
+        if (x + g.w <= ri->x) {
             continue;
         }
+        if (x < ri->x) {
+            set_highlight(stdscr, HI_COMMENT);
+            mvaddch(ri->off_y, ri->off_x + ri->x, '<');
+            continue;
+        }
+        if (x + g.w > ri->w) {
+            set_highlight(stdscr, HI_COMMENT);
+            mvaddch(ri->off_y, ri->off_x + x, '>');
+            return false;
+        }
+        render_run(ri, run, col, g.n, x);
+    }
+    return true;
+}
 
-        err = get_glyph(&ri->line->s[col], ri->line->n - col, &g) == -1;
-        if (x + g.w > ri->x) {
-            hi = ri->attribs[col];
-
-            if (x < ri->x) {
-                set_highlight(stdscr, HI_COMMENT);
-                mvaddch(ri->off_y, ri->off_x + ri->x, '<');
-                col += g.n;
-                x = ri->x + 1;
-                continue;
+/**
+ * Renders a line using its layout.
+ *
+ * @param ri    Render information.
+ */
+static void render_line(struct render_info *ri)
+{
+    struct line_layout  *layout;
+    struct layout_run   *run;
+    col_t               x, x2;
+    int                 t, a;
+
+    layout = get_line_layout(ri->buf, ri->line_i);
+    for (run = layout->runs; run < &layout->runs[layout->num_runs]; run++) {
+        if (run->x >= ri->w) {
+            break;
+        }
+        if (run->x + run->w <= ri->x) {
+            continue;
+        }
+        if (run->kind == RUN_TAB) {
+            if (run->x >= ri->x) {
+                render_run(ri, run, run->col, run->n, run->x);
             }
-
-            if (x + g.w > ri->w) {
-                set_highlight(stdscr, HI_COMMENT);
-                mvaddch(ri->off_y, ri->off_x + x, '>');
+            continue;
+        }
+        if (run->x < ri->x || run->x + run->w > ri->w) {
+            if (!render_clipped_run(ri, run)) {
                 break;
             }
-
-            if (col >= sp_thres) {
-                set_highlight(stdscr, HI_MAX);
-                mvaddstr(ri->off_y, ri->off_x + x, "·");
-            } else if (err) {
-                set_highlight(stdscr, HI_COMMENT);
-                mvaddch(ri->off_y, ri->off_x + x, '?');
-            } else if ((ch >= '\0' && ch < ' ') || ch == 0x7f) {
-                set_highlight(stdscr, HI_COMMENT);
-                mvaddch(ri->off_y, ri->off_x + x, '^');
-                addch(ch == 0x7f ? '?' : ch + '@');
-            } else {
-                set_highlight(stdscr, hi);
-                mvaddnstr(ri->off_y, ri->off_x + x, &ri->line->s[col], g.n);
-            }
+            continue;
         }
-        col += g.n;
-        x += g.w;
+        render_run(ri, run, run->col, run->n, run->x);
     }
 
     if (ri->line->n == 0) {
@@ -178,19 +218,10 @@ static void render_line(struct render_info *ri)
             x2 = get_line_indent(ri->buf, ri->line_i + 1, NULL);
             x = MIN(x, x2);
         }
-        x = MIN(x, ri->w);
     } else {
-        for (col = 0, x = 0; col < sp_thres && x < ri->w; col++) {
-            ch = ri->line->s[col];
-            if (ch == ' ') {
-                x++;
-            } else if (ch == '\t') {
-                x += tab_adjust(x, ri->buf->rule.tab_size);
-            } else {
-                break;
-            }
-        }
+        x = layout->indent;
     }
+    x = MIN(x, ri->w);
 
     set_highlight(stdscr, HI_MAX);
     for (a = ri->x % ri->buf->rule.tab_size,
@@ -200,9 +231,59 @@ static void render_line(struct render_info *ri)
     }
 }
 
+/**
+ * Marks the rows of lines as dirty.
+ *
+ * @param frame The frame the rows belong to.
+ * @param dirty The dirty flag of each row.
+ * @param h     The number of rows.
+ * @param from  The first line.
+ * @param to    The end of the lines (exclusive).
+ */
+static void damage_rows(const struct frame *frame, bool *dirty, int h,
+                        line_t from, line_t to)
+{
+    from = MAX(from, frame->scroll.line);
+    to = MIN(to, frame->scroll.line + h);
+    for (; from < to; from++) {
+        dirty[from - frame->scroll.line] = true;
+    }
+}
+
+/**
+ * Moves the text rows of a frame up or down on the screen.
+ *
+ * Only frames spanning the whole width can be scrolled, the terminal can then
+ * move the rows itself instead of getting them sent again.
+ *
+ * @param frame The frame to scroll.
+ * @param h     The number of text rows.
+ * @param d     The number of rows to move up, negative to move down.
+ *
+ * @return Whether the rows were moved.
+ */
+static bool scroll_rows(const struct frame *frame, int h, line_t d)
+{
+    if (frame->x > 0 || frame->x + frame->w < COLS ||
+            d <= -h || d >= h) {
+        return false;
+    }
+    scrollok(stdscr, true);
+    wsetscrreg(stdscr, frame->y, frame->y + h - 1);
+    wscrl(stdscr, d);
+    wsetscrreg(stdscr, 0, LINES - 1);
+    /* writing to the bottom right must not scroll */
+    scrollok(stdscr, false);
+    return true;
+}
+
 void render_frame(struct frame *frame)
 {
+    static bool         *dirty;
+    static int          a_dirty;
+
     struct buf          *buf;
+    struct frame_view   *view;
     int                 perc;
     struct render_info  ri;
     line_t              line;
@@ -213,6 +294,8 @@ void render_frame(struct frame *frame)
     int                 orig_x;
     struct match        *match;
     struct selection    sel;
+    bool                has_sel;
+    col_t               n;
     col_t               start, end;
     int                 v_start, v_end;
     size_t              paren_i, match_i;
@@ -221,43 +304,135 @@ void render_frame(struct frame *frame)
     int                 hi;
 
     buf = frame->buf;
+    view = &frame->view;
 
     orig_x = frame->x > 0;
     get_text_rect(frame, &x, &y, &w, &h);
 
+    if (h > a_dirty) {
+        a_dirty = h;
+        dirty = xreallocarray(dirty, a_dirty, sizeof(*dirty));
+    }
+
+    /* find the rows to draw again */
+    if (view->buf != buf || view->x != frame->x || view->y != frame->y ||
+            view->w != frame->w || view->h != frame->h || view->num_w != x ||
+            view->scroll.col != frame->scroll.col ||
+            view->tab_size != buf->rule.tab_size ||
+            (view->scroll.line != frame->scroll.line &&
+             !scroll_rows(frame, h, frame->scroll.line - view->scroll.line))) {
+        for (i = 0; i < h; i++) {
+            dirty[i] = true;
+        }
+    } else {
+        for (i = 0; i < h; i++) {
+            dirty[i] = false;
+        }
+        /* rows that came into view by scrolling */
+        if (frame->scroll.line > view->scroll.line) {
+            damage_rows(frame, dirty, h, view->scroll.line + h, LINE_MAX);
+        } else {
+            damage_rows(frame, dirty, h, 0, view->scroll.line);
+        }
+        for (i = 0; i < (int) buf->num_damage; i++) {
+            damage_rows(frame, dirty, h, buf->damage[i].from,
+                        buf->damage[i].to);
+        }
+        /* overlays of the last rendering */
+        damage_rows(frame, dirty, h, view->sel_from, view->sel_to);
+        for (i = 0; i < 2; i++) {
+            if (view->paren_lines[i] >= 0) {
+                damage_rows(frame, dirty, h, view->paren_lines[i],
+                            view->paren_lines[i] + 1);
+            }
+        }
+    }
+
+    /* overlays of this rendering */
+    view->sel_from = 0;
+    view->sel_to = 0;
+    view->paren_lines[0] = -1;
+    view->paren_lines[1] = -1;
+    has_sel = false;
+    paren_i = SIZE_MAX;
+    if (frame == SelFrame) {
+        has_sel = get_selection(&sel);
+        if (has_sel) {
+            view->sel_from = sel.beg.line;
+            view->sel_to = sel.end.line + 1;
+        }
+        paren_i = get_paren(buf, &frame->cur);
+        if (paren_i != SIZE_MAX) {
+            view->paren_lines[0] = buf->parens[paren_i].pos.line;
+            match_i = get_matching_paren(buf, paren_i);
+            if (match_i != SIZE_MAX) {
+                view->paren_lines[1] = buf->parens[match_i].pos.line;
+            }
+        }
+    }
+    damage_rows(frame, dirty, h, view->sel_from, view->sel_to);
+    for (i = 0; i < 2; i++) {
+        if (view->paren_lines[i] >= 0) {
+            damage_rows(frame, dirty, h, view->paren_lines[i],
+                        view->paren_lines[i] + 1);
+        }
+    }
+
+    view->buf = buf;
+    view->x = frame->x;
+    view->y = frame->y;
+    view->w = frame->w;
+    view->h = frame->h;
+    view->num_w = x;
+    view->scroll = frame->scroll;
+    view->tab_size = buf->rule.tab_size;
+
+    /* clear the text of the dirty rows */
+    wattr_set(stdscr, A_NORMAL, HI_NORMAL, NULL);
+    for (i = y; i < h; i++) {
+        if (dirty[i]) {
+            mvhline(frame->y + i, frame->x + x, ' ', w);
+        }
+    }
+
     /* render line number view if there is enough space */
     if (x > 2) {
         set_highlight(stdscr, HI_LINE_NO);
         line = frame->scroll.line + 1;
-        for (i = y; i < h; i++) {
+        for (i = y; i < h; i++, line++) {
+            if (!dirty[i]) {
+                continue;
+            }
             if (line > buf->text.num_lines) {
                 set_highlight(stdscr, HI_NORMAL);
                 mvaddstr(frame->y + i, frame->x + orig_x, " ~");
                 for (j = orig_x + 2; j < x; j++) {
                     addch(' ');
                 }
+                set_highlight(stdscr, HI_LINE_NO);
             } else {
                 mvprintw(frame->y + i, frame->x + orig_x, " %*zu ",
                         x - orig_x - 2, line);
             }
-            line++;
         }
     }
 
     /* render the lines */
-    ri.cur_line = &buf->text.lines[frame->cur.line];
+    ri.cur_line = get_text_line(&buf->text, frame->cur.line);
     ri.off_x = frame->x + x - frame->scroll.col;
     ri.x = frame->scroll.col;
     ri.w = frame->scroll.col + w;
     ri.buf = frame->buf;
 
-    last_line = frame->scroll.line + frame->h - 1;
+    last_line = frame->scroll.line + h;
     last_line = MIN(last_line, buf->text.num_lines);
     for (l = frame->scroll.line; l < last_line; l++) {
+        if (!dirty[l - frame->scroll.line]) {
+            continue;
+        }
         ri.off_y = frame->y + l - frame->scroll.line;
         ri.line_i = l;
-        ri.line = &buf->text.lines[l];
-        ri.attribs = buf->attribs[l];
+        ri.line = get_text_line(&buf->text, l);
         render_line(&ri);
     }
 
@@ -272,27 +447,23 @@ void render_frame(struct frame *frame)
             match < &buf->matches[buf->num_matches] &&
                 match->from.line < last_line;
             match++) {
-        v_start = get_advance(buf->text.lines[match->from.line].s,
-                              buf->text.lines[match->from.line].n,
-                              buf->rule.tab_size,
-                              match->from.col);
+        n = get_text_line(&buf->text, match->from.line)->n;
+        v_start = get_line_advance(buf, match->from.line, n, match->from.col);
         v_start = MAX(v_start, frame->scroll.col);
-        for (l = match->from.line; l <= match->to.line; l++,
+        for (l = match->from.line; l <= match->to.line && l < last_line; l++,
              v_start = frame->scroll.col) {
+            if (l < frame->scroll.line || !dirty[l - frame->scroll.line]) {
+                continue;
+            }
+            n = get_text_line(&buf->text, l)->n;
             if (l == match->to.line) {
-                v_end = get_advance(buf->text.lines[l].s,
-                                    buf->text.lines[l].n,
-                                    buf->rule.tab_size,
-                                    match->to.col);
+                v_end = get_line_advance(buf, l, n, match->to.col);
                 /* show empty matches as well */
                 if (l == match->from.line && match->from.col == match->to.col) {
                     v_end++;
                 }
             } else {
-                v_end = get_advance(buf->text.lines[l].s,
-                                    buf->text.lines[l].n,
-                                    buf->rule.tab_size,
-                                    buf->text.lines[l].n) + 1;
+                v_end = get_line_advance(buf, l, n, n) + 1;
             }
             if (v_start >= v_end) {
                 continue;
@@ -304,61 +475,53 @@ void render_frame(struct frame *frame)
         }
     }
 
-    if (frame == SelFrame) {
-        /* render the selection if it exists */
-        if (get_selection(&sel)) {
-            if (Core.mode == VISUAL_LINE_MODE) {
-                sel.beg.col = 0;
-                sel.end.col = buf->text.lines[sel.end.line].n;
+    /* render the selection if it exists */
+    if (has_sel) {
+        if (Core.mode == VISUAL_LINE_MODE) {
+            sel.beg.col = 0;
+            sel.end.col = get_text_line(&buf->text, sel.end.line)->n;
+        }
+        start = sel.beg.col;
+        for (l = MAX(sel.beg.line, frame->scroll.line);
+             l <= sel.end.line && l < last_line;
+             l++, start = 0) {
+            n = get_text_line(&buf->text, l)->n;
+            if (sel.is_block) {
+                start = sel.beg.col;
+                end = MIN(sel.end.col + 1, n);
+            } else {
+                end = l == sel.end.line ? sel.end.col + 1 : n + 1;
             }
-            start = sel.beg.col;
-            for (l = MAX(sel.beg.line, frame->scroll.line);
-                 l <= sel.end.line && l < last_line;
-                 l++, start = 0) {
-                if (sel.is_block) {
-                    start = sel.beg.col;
-                    end = MIN(sel.end.col + 1, buf->text.lines[l].n);
-                } else {
-                    end = l == sel.end.line ? sel.end.col + 1 :
-                        buf->text.lines[l].n + 1;
-                }
-                v_start = get_advance(buf->text.lines[l].s,
-                                      buf->text.lines[l].n,
-                                      buf->rule.tab_size,
-                                      start);
-                v_end   = get_advance(buf->text.lines[l].s,
-                                      buf->text.lines[l].n,
-                                      buf->rule.tab_size,
-                                      end);
-                v_start = MAX(v_start, frame->scroll.col);
-                if (v_end < v_start) {
-                    continue;
-                }
-                if ((Core.mode == VISUAL_MODE && l < sel.end.line) ||
-                        Core.mode == VISUAL_LINE_MODE) {
-                    v_end++;
-                }
-                mvchgat(frame->y + l - frame->scroll.line,
-                        frame->x + x + v_start - frame->scroll.col,
-                        MIN((int) (v_end - v_start), w),
-                        get_attrib_of(HI_VISUAL), HI_VISUAL, NULL);
+            v_start = get_line_advance(buf, l, n, start);
+            v_end   = get_line_advance(buf, l, n, end);
+            v_start = MAX(v_start, frame->scroll.col);
+            if (v_end < v_start) {
+                continue;
+            }
+            if ((Core.mode == VISUAL_MODE && l < sel.end.line) ||
+                    Core.mode == VISUAL_LINE_MODE) {
+                v_end++;
             }
+            mvchgat(frame->y + l - frame->scroll.line,
+                    frame->x + x + v_start - frame->scroll.col,
+                    MIN((int) (v_end - v_start), w),
+                    get_attrib_of(HI_VISUAL), HI_VISUAL, NULL);
         }
-        /* highlight matching parentheses */
-        paren_i = get_paren(buf, &frame->cur);
-        if (paren_i != SIZE_MAX) {
-            match_i = get_matching_paren(buf, paren_i);
-            hi = match_i == SIZE_MAX ? HI_ERROR : HI_PAREN_MATCH;
-            p = buf->parens[paren_i].pos;
+    }
+
+    /* highlight matching parentheses */
+    if (paren_i != SIZE_MAX) {
+        match_i = get_matching_paren(buf, paren_i);
+        hi = match_i == SIZE_MAX ? HI_ERROR : HI_PAREN_MATCH;
+        p = buf->parens[paren_i].pos;
+        if (get_visual_pos(frame, &p, &p_x, &p_y)) {
+            mvchgat(p_y, p_x, 1, get_attrib_of(hi), hi, NULL);
+        }
+        if (match_i != SIZE_MAX) {
+            p = buf->parens[match_i].pos;
             if (get_visual_pos(frame, &p, &p_x, &p_y)) {
                 mvchgat(p_y, p_x, 1, get_attrib_of(hi), hi, NULL);
             }
-            if (match_i != SIZE_MAX) {
-                p = buf->parens[match_i].pos;
-                if (get_visual_pos(frame, &p, &p_x, &p_y)) {
-                    mvchgat(p_y, p_x, 1, get_attrib_of(hi), hi, NULL);
-                }
-            }
         }
     }
 
@@ -382,10 +545,15 @@ void render_frame(struct frame *frame)
 
     mvwprintw(OffScreen, 0, 0, " %s%s (%s) (%s)",
               get_pretty_path(buf->path),
-              buf->event_i == buf->save_event_i ?  "" : "[+]",
+              buf->event_i == buf->save_event_i && buf->ins_n == 0 ?
+                "" : "[+]",
               buf->file.encoding,
               buf->file.eol == EOL_NL ? "NL" :
               buf->file.eol == EOL_CR ? "CR" : "CRNL");
+    if (buf->is_loading) {
+        wprintw(OffScreen, " loading %d%%",
+                (int) (100 * (double) buf->load_off / buf->text.orig_len));
+    }
     w = getcurx(OffScreen);
     if (w + orig_x > frame->w) {
         w = frame->w - orig_x;
@@ -446,8 +614,8 @@ bool get_visual_pos(const struct frame *frame, const struct pos *pos,
 
     get_text_rect(frame, &x, &y, &w, &h);
 
-    line = &frame->buf->text.lines[pos->line];
-    v_x = get_advance(line->s, line->n, frame->buf->rule.tab_size, pos->col);
+    line = get_text_line(&frame->buf->text, pos->line);
+    v_x = get_line_advance(frame->buf, pos->line, line->n, pos->col);
     *p_x = frame->x + x + v_x - frame->scroll.col;
     *p_y = frame->y + y + pos->line - frame->scroll.line;
 
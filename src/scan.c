@@ -0,0 +1,264 @@
+#include "scan.h"
+#include "purec.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAS_X86_KERNELS
+#endif
+
+/**
+ * Find a byte one byte at a time, this is used for the tails the wide kernels
+ * can not cover.
+ */
+static const char *find_byte_scalar(const char *s, const char *end, char c)
+{
+    for (; s != end; s++) {
+        if (s[0] == c) {
+            return s;
+        }
+    }
+    return end;
+}
+
+/**
+ * Find a byte eight bytes at a time using plain integer arithmetic.
+ */
+static const char *find_byte_word(const char *s, const char *end, char c)
+{
+    const uint64_t  ones = 0x0101010101010101;
+    const uint64_t  highs = 0x8080808080808080;
+    uint64_t        pattern, word, x;
+
+    pattern = ones * (unsigned char) c;
+    for (; end - s >= 8; s += 8) {
+        memcpy(&word, s, sizeof(word));
+        x = word ^ pattern;
+        /* this is non zero when any byte of `x` is zero */
+        if (((x - ones) & ~x & highs) != 0) {
+            break;
+        }
+    }
+    return find_byte_scalar(s, end, c);
+}
+
+#ifdef HAS_X86_KERNELS
+
+__attribute__((target("sse2")))
+static const char *find_byte_sse2(const char *s, const char *end, char c)
+{
+    __m128i         pattern, chunk;
+    int             mask;
+
+    pattern = _mm_set1_epi8(c);
+    for (; end - s >= 16; s += 16) {
+        chunk = _mm_loadu_si128((const __m128i*) s);
+        mask = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, pattern));
+        if (mask != 0) {
+            return s + __builtin_ctz(mask);
+        }
+    }
+    return find_byte_scalar(s, end, c);
+}
+
+__attribute__((target("avx2")))
+static const char *find_byte_avx2(const char *s, const char *end, char c)
+{
+    __m256i         pattern, chunk1, chunk2;
+    unsigned        mask1, mask2;
+
+    pattern = _mm256_set1_epi8(c);
+    /* check 64 bytes per iteration to keep the loads in flight */
+    for (; end - s >= 64; s += 64) {
+        chunk1 = _mm256_loadu_si256((const __m256i*) s);
+        chunk2 = _mm256_loadu_si256((const __m256i*) (s + 32));
+        mask1 = _mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk1, pattern));
+        mask2 = _mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk2, pattern));
+        if ((mask1 | mask2) != 0) {
+            if (mask1 != 0) {
+                return s + __builtin_ctz(mask1);
+            }
+            return s + 32 + __builtin_ctz(mask2);
+        }
+    }
+    for (; end - s >= 32; s += 32) {
+        chunk1 = _mm256_loadu_si256((const __m256i*) s);
+        mask1 = _mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk1, pattern));
+        if (mask1 != 0) {
+            return s + __builtin_ctz(mask1);
+        }
+    }
+    return find_byte_scalar(s, end, c);
+}
+
+#endif
+
+/**
+ * Pick the best kernel for this CPU and replace the function pointer with it.
+ */
+static const char *find_byte_detect(const char *s, const char *end, char c);
+
+static const char *(*find_byte_kernel)(const char *s, const char *end,
+                                       char c) = find_byte_detect;
+
+static const char *find_byte_detect(const char *s, const char *end, char c)
+{
+#ifdef HAS_X86_KERNELS
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        find_byte_kernel = find_byte_avx2;
+    } else if (__builtin_cpu_supports("sse2")) {
+        find_byte_kernel = find_byte_sse2;
+    } else {
+        find_byte_kernel = find_byte_word;
+    }
+#else
+    find_byte_kernel = find_byte_word;
+#endif
+    return find_byte_kernel(s, end, c);
+}
+
+const char *find_byte(const char *s, const char *end, char c)
+{
+    return find_byte_kernel(s, end, c);
+}
+
+/**
+ * Skip printable ascii one byte at a time, this is used for the tails the wide
+ * kernels can not cover.
+ */
+static const char *skip_plain_scalar(const char *s, const char *end)
+{
+    for (; s != end; s++) {
+        if (s[0] < ' ' || s[0] >= 0x7f) {
+            return s;
+        }
+    }
+    return end;
+}
+
+/**
+ * Skip printable ascii eight bytes at a time using plain integer arithmetic.
+ */
+static const char *skip_plain_word(const char *s, const char *end)
+{
+    const uint64_t  ones = 0x0101010101010101;
+    const uint64_t  highs = 0x8080808080808080;
+    uint64_t        word, x;
+
+    for (; end - s >= 8; s += 8) {
+        memcpy(&word, s, sizeof(word));
+        /* bytes with the high bit set */
+        if ((word & highs) != 0) {
+            break;
+        }
+        /* bytes below ' ', this is exact since no high bit is set */
+        if (((word - ones * ' ') & highs) != 0) {
+            break;
+        }
+        /* bytes equal to 0x7f */
+        x = word ^ (ones * 0x7f);
+        if (((x - ones) & ~x & highs) != 0) {
+            break;
+        }
+    }
+    return skip_plain_scalar(s, end);
+}
+
+#ifdef HAS_X86_KERNELS
+
+__attribute__((target("sse2")))
+static const char *skip_plain_sse2(const char *s, const char *end)
+{
+    __m128i         low, high, chunk, ok;
+    int             mask;
+
+    /* signed comparisons, so the bytes with the high bit set are below */
+    low = _mm_set1_epi8(' ' - 1);
+    high = _mm_set1_epi8(0x7f);
+    for (; end - s >= 16; s += 16) {
+        chunk = _mm_loadu_si128((const __m128i*) s);
+        ok = _mm_and_si128(_mm_cmpgt_epi8(chunk, low),
+                           _mm_cmplt_epi8(chunk, high));
+        mask = _mm_movemask_epi8(ok) ^ 0xffff;
+        if (mask != 0) {
+            return s + __builtin_ctz(mask);
+        }
+    }
+    return skip_plain_scalar(s, end);
+}
+
+__attribute__((target("avx2")))
+static const char *skip_plain_avx2(const char *s, const char *end)
+{
+    __m256i         low, high, chunk, ok;
+    unsigned        mask;
+
+    low = _mm256_set1_epi8(' ' - 1);
+    high = _mm256_set1_epi8(0x7f);
+    for (; end - s >= 32; s += 32) {
+        chunk = _mm256_loadu_si256((const __m256i*) s);
+        ok = _mm256_and_si256(_mm256_cmpgt_epi8(chunk, low),
+                              _mm256_cmpgt_epi8(high, chunk));
+        mask = ~(unsigned) _mm256_movemask_epi8(ok);
+        if (mask != 0) {
+            return s + __builtin_ctz(mask);
+        }
+    }
+    return skip_plain_sse2(s, end);
+}
+
+#endif
+
+/**
+ * Pick the best kernel for this CPU and replace the function pointer with it.
+ */
+static const char *skip_plain_detect(const char *s, const char *end);
+
+static const char *(*skip_plain_kernel)(const char *s, const char *end) =
+    skip_plain_detect;
+
+static const char *skip_plain_detect(const char *s, const char *end)
+{
+#ifdef HAS_X86_KERNELS
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        skip_plain_kernel = skip_plain_avx2;
+    } else if (__builtin_cpu_supports("sse2")) {
+        skip_plain_kernel = skip_plain_sse2;
+    } else {
+        skip_plain_kernel = skip_plain_word;
+    }
+#else
+    skip_plain_kernel = skip_plain_word;
+#endif
+    return skip_plain_kernel(s, end);
+}
+
+const char *skip_plain(const char *s, const char *end)
+{
+    return skip_plain_kernel(s, end);
+}
+
+const char *find_eol(const char *s, const char *end, int eol)
+{
+    const char      *e;
+
+    switch (eol) {
+    case EOL_CR:
+        return find_byte_kernel(s, end, '\r');
+
+    case EOL_CRNL:
+        for (e = s; (e = find_byte_kernel(e, end, '\n')) != end; e++) {
+            if (e != s && e[-1] == '\r') {
+                return e - 1;
+            }
+        }
+        return end;
+
+    default:
+        return find_byte_kernel(s, end, '\n');
+    }
+}
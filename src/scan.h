@@ -0,0 +1,59 @@
+#ifndef SCAN_H
+#define SCAN_H
+
+#include <stddef.h>
+
+/**
+ * Fast scanning kernels over raw bytes.
+ *
+ * The kernels use SSE2 or AVX2 when the CPU supports it, this is detected at
+ * runtime on the first call. On other CPUs, a scalar version is used.
+ */
+
+/**
+ * Find the first occurrence of a byte.
+ *
+ * @param s     The start of the bytes to search.
+ * @param end   The end of the bytes to search.
+ * @param c     The byte to look for.
+ *
+ * @return A pointer to the first occurrence or `end` if there is none.
+ */
+const char *find_byte(const char *s, const char *end, char c);
+
+/**
+ * Find the first byte that is not printable ascii.
+ *
+ * Printable ascii are the bytes from ' ' to '~', each of them is a glyph of
+ * width one. Tabs, control characters and utf8 sequences end such a run.
+ *
+ * @param s     The start of the bytes to search.
+ * @param end   The end of the bytes to search.
+ *
+ * @return A pointer to the first other byte or `end` if there is none.
+ */
+const char *skip_plain(const char *s, const char *end);
+
+/**
+ * Find the next line terminator according to an end of line rule.
+ *
+ * For `EOL_CRNL`, only a '\r' directly followed by a '\n' is a terminator.
+ *
+ * @param s     The start of the bytes to search.
+ * @param end   The end of the bytes to search.
+ * @param eol   The end of line rule (`EOL_NL`, `EOL_CR` or `EOL_CRNL`).
+ *
+ * @return A pointer to the first byte of the terminator or `end`.
+ */
+const char *find_eol(const char *s, const char *end, int eol);
+
+/**
+ * Get the length of a terminator starting at the result of `find_eol()`.
+ *
+ * @param eol   The end of line rule.
+ *
+ * @return The number of bytes the terminator has.
+ */
+#define get_eol_length(eol) ((eol) == EOL_CRNL ? 2 : 1)
+
+#endif
@@ -84,7 +84,7 @@ void c_char_hook(struct buf *buf, struct pos *pos, int c)
     if (c != '}' && c != ':') {
         return;
     }
-    line = &buf->text.lines[pos->line];
+    line = get_text_line(&buf->text, pos->line);
     (void) get_line_indent(buf, pos->line, &col);
     if ((c == '}' && pos->col == col + 1) ||
             (c == ':' &&
@@ -104,7 +104,8 @@ col_t c_indentor(struct buf *buf, line_t line_i)
     col_t           c;
     struct paren    *par;
     struct line     *line;
-    col_t           i;
+    col_t           i, j;
+    struct hi_span  *span;
 
     if (line_i == 0) {
         return 0;
@@ -127,7 +128,7 @@ col_t c_indentor(struct buf *buf, line_t line_i)
     }
 
     par = &buf->parens[index - 1];
-    line = &buf->text.lines[par->pos.line];
+    line = get_text_line(&buf->text, par->pos.line);
     if (par->pos.col + 1 != line->n) {
         return par->pos.col + 1;
     }
@@ -145,10 +146,14 @@ col_t c_indentor(struct buf *buf, line_t line_i)
         break;
     }
 
-    line = &buf->text.lines[line_i];
-    for (i = 1; i < line->n; i++) {
-        if (buf->attribs[line_i][i] == HI_OPERATOR) {
-            if (line->s[i - 1] != ' ' && line->s[i] == ':') {
+    line = get_text_line(&buf->text, line_i);
+    span = buf->attribs[line_i];
+    for (i = 0; span != NULL && span->n > 0; i += span->n, span++) {
+        if (span->hi != HI_OPERATOR) {
+            continue;
+        }
+        for (j = MAX(i, 1); j < i + span->n && j < line->n; j++) {
+            if (line->s[j - 1] != ' ' && line->s[j] == ':') {
                 return get_line_indent(buf, par->pos.line, NULL);
             }
         }
@@ -1,16 +1,103 @@
 #include "text.h"
 #include "xalloc.h"
 #include "purec.h"
+#include "scan.h"
 
 #include <magic.h>
 #include <iconv.h>
+#include <errno.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/**
+ * Check if the line borrows its data from the original block of the text.
+ *
+ * @param text  The text the line belongs to.
+ * @param line  The line to check.
+ *
+ * @return Whether the line is borrowed.
+ */
+static inline bool is_line_borrowed(const struct text *text,
+                                    const struct line *line)
+{
+    return text->orig != NULL && line->s >= text->orig &&
+        line->s < text->orig + text->orig_len;
+}
+
+/**
+ * Free the data of a line if it is owned by the line.
+ *
+ * @param text  The text the line belongs to.
+ * @param line  The line to free.
+ */
+static void free_line(const struct text *text, struct line *line)
+{
+    if (!is_line_borrowed(text, line)) {
+        free(line->s);
+    }
+}
+
+/**
+ * Move the gap of a text so that it starts at given line.
+ *
+ * Only the lines between the old and new gap position are moved.
+ *
+ * @param text  The text whose gap to move.
+ * @param line  The index the gap should start at.
+ */
+static void move_gap(struct text *text, line_t line)
+{
+    line_t          gap_len;
+
+    gap_len = text->a_lines - text->num_lines;
+    if (gap_len > 0) {
+        if (line < text->gap) {
+            memmove(&text->lines[line + gap_len], &text->lines[line],
+                    sizeof(*text->lines) * (text->gap - line));
+        } else if (line > text->gap) {
+            memmove(&text->lines[text->gap],
+                    &text->lines[text->gap + gap_len],
+                    sizeof(*text->lines) * (line - text->gap));
+        }
+    }
+    text->gap = line;
+}
+
+/**
+ * Make sure the gap of a text can hold given number of lines.
+ *
+ * @param text      The text to grow.
+ * @param num_lines The number of lines that are about to be inserted.
+ */
+static void grow_gap(struct text *text, line_t num_lines)
+{
+    line_t          old_a, tail;
+
+    if (text->num_lines + num_lines <= text->a_lines) {
+        return;
+    }
+    old_a = text->a_lines;
+    tail = text->num_lines - text->gap;
+    text->a_lines *= 2;
+    text->a_lines += num_lines + 8;
+    text->lines = xreallocarray(text->lines, text->a_lines,
+                                sizeof(*text->lines));
+    /* keep the lines after the gap at the end */
+    memmove(&text->lines[text->a_lines - tail], &text->lines[old_a - tail],
+            sizeof(*text->lines) * tail);
+}
 
 void init_text(struct text *text, size_t num_lines)
 {
     text->lines = xcalloc(num_lines, sizeof(*text->lines));
     text->num_lines = num_lines;
     text->a_lines = num_lines;
+    text->gap = num_lines;
+    text->orig = NULL;
+    text->orig_len = 0;
+    text->is_mapped = false;
 }
 
 void clear_text(struct text *text)
@@ -18,61 +105,120 @@ void clear_text(struct text *text)
     line_t          i;
 
     for (i = 0; i < text->num_lines; i++) {
-        free(text->lines[i].s);
+        free_line(text, get_text_line(text, i));
     }
     free(text->lines);
+    if (text->is_mapped) {
+        munmap(text->orig, text->orig_len);
+        close(text->map_fd);
+    } else {
+        free(text->orig);
+    }
     memset(text, 0, sizeof(*text));
 }
 
+void unshare_line(struct text *text, struct line *line)
+{
+    if (line->n > 0 && is_line_borrowed(text, line)) {
+        line->s = xmemdup(line->s, line->n);
+    }
+}
+
+void unmap_text(struct text *text)
+{
+    char            *orig;
+    line_t          i;
+    struct line     *line;
+
+    if (!text->is_mapped) {
+        return;
+    }
+
+    orig = xmemdup(text->orig, text->orig_len);
+    for (i = 0; i < text->num_lines; i++) {
+        line = get_text_line(text, i);
+        if (is_line_borrowed(text, line)) {
+            line->s = &orig[line->s - text->orig];
+        }
+    }
+    munmap(text->orig, text->orig_len);
+    close(text->map_fd);
+    text->orig = orig;
+    text->is_mapped = false;
+}
+
+bool check_mapping(struct text *text)
+{
+    struct stat     st;
+
+    if (!text->is_mapped) {
+        return false;
+    }
+    if (fstat(text->map_fd, &st) == 0 &&
+            (size_t) st.st_size == text->orig_len &&
+            st.st_mtim.tv_sec == text->map_mtime.tv_sec &&
+            st.st_mtim.tv_nsec == text->map_mtime.tv_nsec) {
+        return false;
+    }
+    unmap_text(text);
+    return true;
+}
+
 void make_text(struct text *text, struct line *lines, line_t num_lines)
 {
     text->lines = lines;
     text->num_lines = num_lines;
     text->a_lines = num_lines;
+    text->gap = num_lines;
+    text->orig = NULL;
+    text->orig_len = 0;
+    text->is_mapped = false;
 }
 
 void str_to_text(const char *str, size_t len, struct text *text)
 {
-    const char      *end;
+    const char      *end, *e;
 
-    while (len > 0) {
-        for (end = str; len > 0; end++, len--) {
-            if (end[0] == '\n') {
-                break;
-            }
-        }
+    text->num_lines = 0;
+    text->a_lines = 1;
+    text->lines = xmalloc(sizeof(*text->lines));
+    text->orig = NULL;
+    text->orig_len = 0;
+    text->is_mapped = false;
+
+    end = str + len;
+    do {
+        e = find_byte(str, end, '\n');
         if (text->num_lines == text->a_lines) {
             text->a_lines *= 2;
-            text->a_lines++;
             text->lines = xreallocarray(text->lines, text->a_lines,
                                         sizeof(*text->lines));
         }
-        text->lines[text->num_lines].n = end - str;
-        text->lines[text->num_lines].s = xmemdup(str, end - str);
+        init_line(&text->lines[text->num_lines], str, e - str);
         text->num_lines++;
-        str = end + 1;
-    }
-    text->lines = xreallocarray(text->lines, text->num_lines,
-                                sizeof(*text->lines));
-    text->a_lines = text->num_lines;
+        str = e + 1;
+    } while (e != end);
+    text->gap = text->num_lines;
 }
 
 char *text_to_str(struct text *text, size_t *p_len)
 {
     size_t          len;
     line_t          i;
+    const struct line *line;
     char            *str, *p;
 
     len = 0;
     for (i = 0; i < text->num_lines; i++) {
-        len += text->lines[i].n + 1;
+        len += get_text_line(text, i)->n + 1;
     }
 
     str = xmalloc(len);
     p = str;
     for (i = 0; i < text->num_lines; i++) {
-        memcpy(p, text->lines[i].s, text->lines[i].n);
-        p += text->lines[i].n;
+        line = get_text_line(text, i);
+        memcpy(p, line->s, line->n);
+        p += line->n;
         p[0] = '\n';
         p++;
     }
@@ -81,8 +227,81 @@ char *text_to_str(struct text *text, size_t *p_len)
     return str;
 }
 
-size_t read_text(FILE *fp, struct file_rule *rule, struct text *text,
-                 line_t max_lines)
+bool split_text(struct text *text, int eol, size_t *p_off, line_t max_lines)
+{
+    char            *s, *e, *end;
+    struct line     *line;
+
+    if (text->orig_len == 0) {
+        if (text->num_lines == 0) {
+            (void) insert_blank(text, 0, 1);
+        }
+        return true;
+    }
+
+    /* the new lines are appended at the gap */
+    move_gap(text, text->num_lines);
+    s = &text->orig[*p_off];
+    end = &text->orig[text->orig_len];
+    for (; max_lines > 0; max_lines--) {
+        /* the last line is only added when it is not empty */
+        if (s == end && text->num_lines > 0) {
+            *p_off = text->orig_len;
+            return true;
+        }
+        e = (char*) find_eol(s, end, eol);
+        grow_gap(text, 1);
+        line = &text->lines[text->num_lines++];
+        text->gap++;
+        line->n = e - s;
+        line->s = line->n == 0 ? NULL : s;
+        if (e == end) {
+            *p_off = text->orig_len;
+            return true;
+        }
+        s = e + get_eol_length(eol);
+    }
+    *p_off = s - text->orig;
+    return false;
+}
+
+/**
+ * Map a regular file into memory so that lines can point into it directly.
+ *
+ * @param fp    The file to map.
+ * @param text  The text to set `orig` of.
+ *
+ * @return 0 if the file was mapped, -1 otherwise.
+ */
+static int map_file(FILE *fp, struct text *text)
+{
+    struct stat     st;
+    void            *map;
+    int             fd;
+
+    if (fstat(fileno(fp), &st) == -1 || !S_ISREG(st.st_mode) ||
+            st.st_size == 0) {
+        return -1;
+    }
+    fd = dup(fileno(fp));
+    if (fd == -1) {
+        return -1;
+    }
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+        close(fd);
+        return -1;
+    }
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+    text->orig = map;
+    text->orig_len = st.st_size;
+    text->is_mapped = true;
+    text->map_fd = fd;
+    text->map_mtime = st.st_mtim;
+    return 0;
+}
+
+size_t load_text(FILE *fp, struct file_rule *rule, struct text *text)
 {
     static magic_t  magic;
     const char      *from_code;
@@ -90,12 +309,9 @@ size_t read_text(FILE *fp, struct file_rule *rule, struct text *text,
     int             eol;
     char            *ep;
     char            in_buf[1024];
-    char            out_buf[1024];
     char            *in_ptr, *out_ptr;
     size_t          in_len, out_len;
-    size_t          i, j;
-    size_t          num_bytes;
-    struct line     *line;
+    size_t          a_orig;
 
     if (magic == NULL) {
         magic = magic_open(MAGIC_MIME_ENCODING);
@@ -108,14 +324,14 @@ size_t read_text(FILE *fp, struct file_rule *rule, struct text *text,
     }
 
     in_len = fread(in_buf, 1, sizeof(in_buf), fp);
-    ep = strchr(in_buf, '\n');
+    ep = memchr(in_buf, '\n', in_len);
     if (ep != NULL) {
         if (ep > in_buf && ep[-1] == '\r') {
             eol = EOL_CRNL;
         } else {
             eol = EOL_NL;
         }
-    } else if (strchr(in_buf, '\r') != NULL) {
+    } else if (memchr(in_buf, '\r', in_len) != NULL) {
         eol = EOL_CR;
     } else {
         eol = EOL_NL;
@@ -124,7 +340,7 @@ size_t read_text(FILE *fp, struct file_rule *rule, struct text *text,
     from_code = NULL;
     if (magic != NULL) {
         from_code = magic_buffer(magic, in_buf, in_len);
-        if (strcmp(from_code, "us-ascii") == 0) {
+        if (from_code != NULL && strcmp(from_code, "us-ascii") == 0) {
             from_code = "utf-8";
         }
     }
@@ -136,82 +352,81 @@ size_t read_text(FILE *fp, struct file_rule *rule, struct text *text,
         icv = iconv_open("utf-8", from_code);
     }
 
-    text->a_lines = 8;
-    text->lines = xmalloc(sizeof(*text->lines) * text->a_lines);
-    line = &text->lines[0];
-    line->s = NULL;
-    line->n = 0;
-    text->num_lines = 1;
-    num_bytes = 0;
-    do {
+    text->orig = NULL;
+    text->orig_len = 0;
+    text->is_mapped = false;
+    a_orig = 0;
+    if ((icv == (iconv_t) -1 || strcmp(from_code, "utf-8") == 0) &&
+            map_file(fp, text) == 0) {
+        /* no conversion needed, the lines point into the mapping */
+        in_len = 0;
+    }
+
+    /* convert the entire file into one block the lines can borrow from */
+    while (in_len > 0) {
+        if (text->orig_len + sizeof(in_buf) * 4 > a_orig) {
+            a_orig *= 2;
+            a_orig += sizeof(in_buf) * 4;
+            text->orig = xrealloc(text->orig, a_orig);
+        }
+        out_ptr = &text->orig[text->orig_len];
         if (icv == (iconv_t) -1) {
-            memcpy(out_buf, in_buf, in_len);
-            out_len = in_len;
+            memcpy(out_ptr, in_buf, in_len);
+            text->orig_len += in_len;
             in_len = 0;
         } else {
             in_ptr = in_buf;
-            out_ptr = out_buf;
-            out_len = sizeof(out_buf);
+            out_len = a_orig - text->orig_len;
             if (iconv(icv, &in_ptr, &in_len, &out_ptr, &out_len) ==
-                    (size_t) -1) {
-                out_buf[0] = in_buf[0];
+                    (size_t) -1 && in_ptr == in_buf && errno != E2BIG) {
+                /* take over the invalid byte as is */
+                *out_ptr++ = *in_ptr++;
                 in_len--;
-                in_ptr++;
-                out_len = 1;
-            } else {
-                out_len = sizeof(out_buf) - out_len;
             }
+            text->orig_len = out_ptr - text->orig;
             memmove(in_buf, in_ptr, in_len);
         }
         in_len += fread(&in_buf[in_len], 1, sizeof(in_buf) - in_len, fp);
-        i = 0;
-        j = 0;
-        do {
-            for (; i < out_len; i++) {
-                if (eol == EOL_CRNL && i + 1 < out_len && out_buf[i] == '\r' &&
-                        out_buf[i + 1] == '\n') {
-                    break;
-                } else if (eol == EOL_CR && out_buf[i] == '\r') {
-                    break;
-                } else if (eol == EOL_NL && out_buf[i] == '\n') {
-                    break;
-                }
-            }
-            line->s = xrealloc(line->s, line->n + i - j);
-            memcpy(&line->s[line->n], &out_buf[j], i - j);
-            line->n += i - j;
-            if (i < out_len) {
-                num_bytes += line->n + 1;
-                if (text->num_lines == max_lines) {
-                    goto end;
-                }
-                if (text->num_lines == text->a_lines) {
-                    text->a_lines *= 2;
-                    text->lines = xreallocarray(text->lines, text->a_lines,
-                                                sizeof(*text->lines));
-                }
-                line = &text->lines[text->num_lines++];
-                line->s = NULL;
-                line->n = 0;
-                i += eol == EOL_CRNL ? 2 : 1;
-            }
-            j = i;
-        } while (i < out_len);
-    } while (in_len > 0);
+    }
 
     if (icv != (iconv_t) -1) {
         iconv_close(icv);
     }
 
-    num_bytes += line->n;
+    if (text->is_mapped) {
+        madvise(text->orig, text->orig_len, MADV_NORMAL);
+    } else if (text->orig_len == 0) {
+        free(text->orig);
+        text->orig = NULL;
+    } else {
+        text->orig = xrealloc(text->orig, text->orig_len);
+    }
 
-end:
-    if (line->n == 0 && text->num_lines > 1) {
-        text->num_lines--;
+    text->lines = NULL;
+    text->num_lines = 0;
+    text->a_lines = 0;
+    text->gap = 0;
+
+    rule->encoding = xstrdup(from_code);
+    rule->eol = eol;
+    return text->orig_len;
+}
+
+size_t read_text(FILE *fp, struct file_rule *rule, struct text *text,
+                 line_t max_lines)
+{
+    struct file_rule    tmp_rule;
+    size_t              num_bytes;
+    size_t              off;
+
+    if (rule == NULL) {
+        rule = &tmp_rule;
     }
-    if (rule != NULL) {
-        rule->encoding = xstrdup(from_code);
-        rule->eol = eol;
+    num_bytes = load_text(fp, rule, text);
+    off = 0;
+    (void) split_text(text, rule->eol, &off, max_lines);
+    if (rule == &tmp_rule) {
+        free(tmp_rule.encoding);
     }
     return num_bytes;
 }
@@ -237,7 +452,7 @@ size_t write_text(FILE *fp, const struct file_rule *rule,
 
     num_bytes = 0;
     for (; from <= to; from++) {
-        line = &text->lines[from];
+        line = get_text_line(text, from);
         in_ptr = line->s;
         in_len = line->n;
         while (in_len > 0) {
@@ -271,23 +486,26 @@ void get_text(const struct text *text,
               struct text *dest)
 {
     line_t          i;
+    const struct line *line;
 
+    dest->orig = NULL;
+    dest->orig_len = 0;
+    dest->is_mapped = false;
+    line = get_text_line(text, from->line);
     if (from->line != to->line) {
         dest->num_lines = to->line - from->line + 1;
         dest->a_lines = dest->num_lines;
         dest->lines = xreallocarray(NULL, dest->num_lines,
                                     sizeof(*dest->lines));
-        init_line(&dest->lines[0],
-                  &text->lines[from->line].s[from->col],
-                  text->lines[from->line].n - from->col);
+        init_line(&dest->lines[0], &line->s[from->col], line->n - from->col);
 
         for (i = from->line + 1; i < to->line; i++) {
-            init_line(&dest->lines[i - from->line],
-                      &text->lines[i].s[0], text->lines[i].n);
+            line = get_text_line(text, i);
+            init_line(&dest->lines[i - from->line], &line->s[0], line->n);
         }
         if (to->line != text->num_lines) {
             init_line(&dest->lines[dest->num_lines - 1],
-                      text->lines[to->line].s, to->col);
+                      get_text_line(text, to->line)->s, to->col);
         } else {
             init_zero_line(&dest->lines[dest->num_lines - 1]);
         }
@@ -295,10 +513,9 @@ void get_text(const struct text *text,
         dest->num_lines = 1;
         dest->a_lines = 1;
         dest->lines = xmalloc(sizeof(*dest->lines));
-        init_line(&dest->lines[0],
-                  &text->lines[from->line].s[from->col],
-                  to->col - from->col);
+        init_line(&dest->lines[0], &line->s[from->col], to->col - from->col);
     }
+    dest->gap = dest->num_lines;
 }
 
 void get_text_block(const struct text *text,
@@ -314,8 +531,12 @@ void get_text_block(const struct text *text,
     dest->a_lines = dest->num_lines;
     dest->lines = xreallocarray(NULL, dest->num_lines,
                                 sizeof(*dest->lines));
+    dest->gap = dest->num_lines;
+    dest->orig = NULL;
+    dest->orig_len = 0;
+    dest->is_mapped = false;
     for (i = from->line; i <= to->line; i++) {
-        line = &text->lines[i];
+        line = get_text_line(text, i);
         if (from->col >= line->n) {
             init_zero_line(&dest->lines[i - from->line]);
             continue;
@@ -353,12 +574,12 @@ bool clip_range(const struct text *text,
     }
 
     /* clip columns */
-    from.col = MIN(from.col, text->lines[from.line].n);
+    from.col = MIN(from.col, get_text_line(text, from.line)->n);
     if (to.line == text->num_lines) {
         to.line--;
-        to.col = text->lines[to.line].n;
+        to.col = get_text_line(text, to.line)->n;
     } else {
-        to.col = MIN(to.col, text->lines[to.line].n);
+        to.col = MIN(to.col, get_text_line(text, to.line)->n);
     }
 
     /* make sure there is text to delete */
@@ -390,19 +611,11 @@ bool clip_block(const struct text *text,
 
 struct line *insert_blank(struct text *text, line_t line, line_t num_lines)
 {
-    if (text->num_lines + num_lines > text->a_lines) {
-        text->a_lines *= 2;
-        text->a_lines += num_lines;
-        text->lines = xreallocarray(text->lines, text->a_lines,
-                                    sizeof(*text->lines));
-    }
-
-    /* move tail of the line list to form a gap */
-    memmove(&text->lines[line + num_lines],
-            &text->lines[line],
-            sizeof(*text->lines) * (text->num_lines - line));
+    grow_gap(text, num_lines);
+    /* the new lines are taken from the start of the gap */
+    move_gap(text, line);
     text->num_lines += num_lines;
-    /* zero initialize the gap */
+    text->gap += num_lines;
     memset(&text->lines[line], 0, sizeof(*text->lines) * num_lines);
     return &text->lines[line];
 }
@@ -417,8 +630,9 @@ void insert_text(struct text *text,
     col_t                   old_n;
 
     if (src->num_lines == 1) {
-        s_line = &src->lines[0];
-        line = &text->lines[pos->line];
+        s_line = get_text_line(src, 0);
+        line = get_text_line(text, pos->line);
+        unshare_line(text, line);
         line->s = xrealloc(line->s, line->n + s_line->n);
         memmove(&line->s[pos->col + s_line->n], &line->s[pos->col],
                 line->n - pos->col);
@@ -429,14 +643,14 @@ void insert_text(struct text *text,
 
     line = insert_blank(text, pos->line + 1, src->num_lines - 1);
     for (i = 1; i < src->num_lines; i++) {
-        s_line = &src->lines[i];
+        s_line = get_text_line(src, i);
         line->n = s_line->n;
         line->s = xmalloc(line->n);
         memcpy(line->s, s_line->s, s_line->n);
         line++;
     }
 
-    at_line = &text->lines[pos->line];
+    at_line = get_text_line(text, pos->line);
 
     /* add the end of the first line to the end of the last line */
     line--; /* `line` overshoots the last line, so decrement it */
@@ -446,9 +660,11 @@ void insert_text(struct text *text,
     memcpy(&line->s[old_n], &at_line->s[pos->col], at_line->n - pos->col);
 
     /* trim first line and insert first text segment */
-    at_line->n = pos->col + src->lines[0].n;
+    s_line = get_text_line(src, 0);
+    unshare_line(text, at_line);
+    at_line->n = pos->col + s_line->n;
     at_line->s = xrealloc(at_line->s, at_line->n);
-    memcpy(&at_line->s[pos->col], src->lines[0].s, src->lines[0].n);
+    memcpy(&at_line->s[pos->col], s_line->s, s_line->n);
 }
 
 void insert_text_block(struct text *text,
@@ -461,13 +677,14 @@ void insert_text_block(struct text *text,
     line_t                  col;
 
     for (i = 0; i < src->num_lines; i++) {
-        s_line = &src->lines[i];
-        line = &text->lines[pos->line + i];
+        s_line = get_text_line(src, i);
+        line = get_text_line(text, pos->line + i);
         col = pos->col;
         if (s_line->n == 0 || col > line->n) {
             continue;
         }
 
+        unshare_line(text, line);
         line->s = xrealloc(line->s, line->n + s_line->n);
         memmove(&line->s[col + s_line->n], &line->s[col], line->n - col);
         memcpy(&line->s[col], s_line->s, s_line->n);
@@ -482,7 +699,8 @@ void delete_text(struct text *text,
     line_t          i;
     struct line     *first, *last;
 
-    first = &text->lines[from->line];
+    first = get_text_line(text, from->line);
+    unshare_line(text, first);
     if (from->line == to->line) {
         first->n -= to->col;
         memmove(&first->s[from->col],
@@ -495,11 +713,13 @@ void delete_text(struct text *text,
         first->s = xrealloc(first->s, first->n);
         /* delete the remaining lines */
         for (i = from->line + 1; i < text->num_lines; i++) {
-            free(text->lines[i].s);
+            free_line(text, get_text_line(text, i));
         }
+        /* the deleted lines become part of the gap */
+        move_gap(text, from->line + 1);
         text->num_lines = from->line + 1;
     } else {
-        last = &text->lines[to->line];
+        last = get_text_line(text, to->line);
         /* join the current line with the last line */
         first->n = from->col + last->n - to->col;
         first->s = xrealloc(first->s, first->n);
@@ -507,13 +727,12 @@ void delete_text(struct text *text,
                &last->s[to->col], last->n - to->col);
         /* delete the remaining lines */
         for (i = from->line + 1; i <= to->line; i++) {
-            free(text->lines[i].s);
+            free_line(text, get_text_line(text, i));
         }
-        text->num_lines -= to->line;
-        memmove(&text->lines[from->line + 1],
-                &text->lines[to->line + 1],
-                sizeof(*text->lines) * (text->num_lines - 1));
-        text->num_lines += from->line;
+        /* the deleted lines become part of the gap */
+        move_gap(text, to->line + 1);
+        text->gap = from->line + 1;
+        text->num_lines -= to->line - from->line;
     }
 }
 
@@ -526,7 +745,7 @@ void delete_text_block(struct text *text,
     col_t           to_col;
 
     for (i = from->line; i <= to->line; i++) {
-        line = &text->lines[i];
+        line = get_text_line(text, i);
         if (from->col >= line->n) {
             continue;
         }
@@ -534,6 +753,7 @@ void delete_text_block(struct text *text,
         if (to_col == 0) {
             continue;
         }
+        unshare_line(text, line);
         line->n -= to_col;
         memmove(&line->s[from->col],
                 &line->s[to_col], line->n);
@@ -544,29 +764,37 @@ void delete_text_block(struct text *text,
 void repeat_text(struct text *text, const struct text *src, size_t count)
 {
     struct line     *line;
+    const struct line *s_line;
     line_t          r, i;
 
+    text->orig = NULL;
+    text->orig_len = 0;
+    text->is_mapped = false;
     if (src->num_lines == 1) {
         text->num_lines = 1;
         text->a_lines = text->num_lines;
+        text->gap = text->num_lines;
         text->lines = xmalloc(sizeof(*text->lines) * text->num_lines);
         line = &text->lines[0];
-        line->n = src->lines[0].n * count;
-        line->s = xmalloc(src->lines[0].n * count);
-        for (r = 0; r + src->lines[0].n <= line->n; ) {
-            memcpy(&line->s[r], src->lines[0].s, src->lines[0].n);
-            r += src->lines[0].n;
+        s_line = get_text_line(src, 0);
+        line->n = s_line->n * count;
+        line->s = xmalloc(s_line->n * count);
+        for (r = 0; r + s_line->n <= line->n; ) {
+            memcpy(&line->s[r], s_line->s, s_line->n);
+            r += s_line->n;
         }
         memset(&line->s[r], ' ', line->n - r);
     } else {
         text->num_lines = src->num_lines * count;
         text->a_lines = text->num_lines;
+        text->gap = text->num_lines;
         text->lines = xmalloc(sizeof(*text->lines) * text->num_lines);
         line = &text->lines[0];
         for (r = 0; r + src->num_lines <= text->num_lines;
              r += src->num_lines) {
             for (i = 0; i < src->num_lines; i++) {
-                init_line(line, src->lines[i].s, src->lines[i].n);
+                s_line = get_text_line(src, i);
+                init_line(line, s_line->s, s_line->n);
                 line++;
             }
         }
@@ -586,10 +814,14 @@ void repeat_text_block(struct text *text, const struct text *src, size_t count)
 
     text->num_lines = src->num_lines;
     text->a_lines = text->num_lines;
+    text->gap = text->num_lines;
     text->lines = xmalloc(sizeof(*text->lines) * text->num_lines);
+    text->orig = NULL;
+    text->orig_len = 0;
+    text->is_mapped = false;
     for (i = 0; i < text->num_lines; i++) {
         line = &text->lines[i];
-        s_line = &src->lines[i];
+        s_line = get_text_line(src, i);
         line->n = s_line->n * count;
         line->s = xmalloc(line->n);
         if (line->n == 0) {
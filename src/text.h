@@ -6,6 +6,7 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <time.h>
 
 struct line {
     /// data of the line in utf8 format
@@ -38,6 +39,19 @@ struct line {
     _l->s = NULL; \
 } while (0)
 
+/**
+ * A text is a list of lines.
+ *
+ * The lines may borrow their data from a single read-only block `orig` that
+ * holds the original content (for example a loaded file). Only when a line is
+ * modified, it gets its own allocation (see `unshare_line()`). This way, no
+ * per line allocation is needed when loading text. For files that need no
+ * conversion, `orig` is a direct mapping of the file.
+ *
+ * The unused entries of `lines` form a gap at `gap`, it is moved to where lines
+ * are inserted or deleted so that only the lines in between need to be moved.
+ * Use `get_text_line()` to access a line.
+ */
 struct text {
     /// the lines of text
     struct line *lines;
@@ -45,14 +59,120 @@ struct text {
     line_t num_lines;
     /// the number of allocated lines
     line_t a_lines;
+    /// the index of the first line stored after the gap, the gap is
+    /// `a_lines - num_lines` lines long
+    line_t gap;
+    /// read-only block unmodified lines point into, may be `NULL`
+    char *orig;
+    /// the size of `orig` in bytes
+    size_t orig_len;
+    /// whether `orig` is a read-only mapping of a file
+    bool is_mapped;
+    /// the mapped file, kept open to notice when it changes
+    int map_fd;
+    /// the modification time of the mapped file when it was mapped
+    struct timespec map_mtime;
 };
 
+/**
+ * Get a line of a text.
+ *
+ * @param text  The text to get the line of.
+ * @param i     The index of the line.
+ *
+ * @return The line at given index.
+ */
+static inline struct line *get_text_line(const struct text *text, line_t i)
+{
+    if (i >= text->gap) {
+        i += text->a_lines - text->num_lines;
+    }
+    return &text->lines[i];
+}
+
 void init_text(struct text *text, size_t num_lines);
 void clear_text(struct text *text);
+
+/**
+ * Make sure the line owns its data so that it can be modified in place.
+ *
+ * This must be called before writing into `line->s` directly.
+ *
+ * @param text  The text the line belongs to.
+ * @param line  The line to make writable.
+ */
+void unshare_line(struct text *text, struct line *line);
+
+/**
+ * Copy the mapped file a text points into to memory and unmap it.
+ *
+ * This must be called before the mapped file is overwritten, otherwise the
+ * lines would change or even become inaccessible.
+ *
+ * @param text  The text to unmap, nothing happens if it is not mapped.
+ */
+void unmap_text(struct text *text);
+
+/**
+ * Check if the file a text is mapped from was changed by another process.
+ *
+ * The lines that were not edited point into the mapping. When another process
+ * truncates the file, accessing them would raise `SIGBUS` and when it rewrites
+ * the file, they would silently change. So when the size or modification time
+ * of the file is different from when it was mapped, the text is unmapped.
+ *
+ * @param text  The text to check.
+ *
+ * @return Whether the text was unmapped.
+ */
+bool check_mapping(struct text *text);
+
 void make_text(struct text *text, struct line *lines, line_t num_lines);
 void str_to_text(const char *str, size_t len, struct text *text);
 char *text_to_str(struct text *text, size_t *p_len);
 struct file_rule;
+
+/**
+ * Load a file into the original block of a text without creating any lines.
+ *
+ * The encoding and end of line rule are detected and stored in `rule`. Files
+ * that need no conversion are mapped into memory. Use `split_text()` to create
+ * the lines afterwards.
+ *
+ * @param fp    The file to read.
+ * @param rule  Receives the detected encoding and end of line rule.
+ * @param text  The text to load into, it is overwritten.
+ *
+ * @return The number of bytes loaded.
+ */
+size_t load_text(FILE *fp, struct file_rule *rule, struct text *text);
+
+/**
+ * Split the original block of a text into lines.
+ *
+ * The new lines are appended to the text and borrow their data from
+ * `text->orig`. This can be called repeatedly to split a large text in steps.
+ *
+ * @param text      The text whose original block to split.
+ * @param eol       The end of line rule to split by.
+ * @param p_off     The offset to start splitting at, receives the offset where
+ *                  the next call should continue.
+ * @param max_lines The maximum number of lines to add.
+ *
+ * @return Whether the end of the original block was reached.
+ */
+bool split_text(struct text *text, int eol, size_t *p_off, line_t max_lines);
+
+/**
+ * Combination of `load_text()` and `split_text()`.
+ *
+ * @param fp        The file to read.
+ * @param rule      Receives the encoding and end of line rule, may be `NULL`.
+ * @param text      The text to read into, it is overwritten.
+ * @param max_lines The maximum number of lines to read.
+ *
+ * @return The number of bytes read.
+ */
 size_t read_text(FILE *fp, struct file_rule *rule, struct text *text,
                  line_t max_lines);
 size_t write_text(FILE *fp, const struct file_rule *rule,
@@ -1,9 +1,13 @@
 #include "buf.h"
 #include "frame.h"
+#include "lz.h"
 #include "xalloc.h"
 
+#include <inttypes.h>
 #include <string.h>
 
+#include <sys/mman.h>
+
 struct undo Undo;
 
 bool should_join(const struct undo_event *ev1, const struct undo_event *ev2)
@@ -26,30 +30,228 @@ bool should_join(const struct undo_event *ev1, const struct undo_event *ev2)
 }
 
 /**
- * Compares an already loaded segment with an existing segment.
+ * Checks if an already loaded segment has the same data as an existing
+ * segment.
  *
  * @param a A loaded undo segment.
  * @param b An unloaded undo segment.
  *
- * @return The comparison result.
+ * @return Whether the data is equal.
+ */
+static bool is_same_segment(struct undo_seg *a, struct undo_seg *b)
+{
+    bool            same;
+
+    if (a->hash != b->hash || a->data_len != b->data_len) {
+        return false;
+    }
+
+    /* only needs to go to the disk if the hashes are equal */
+    if (load_undo_data(b) != 0) {
+        return false;
+    }
+    same = memcmp(a->data, b->data, b->data_len) == 0;
+    unload_undo_data(b);
+
+    return same;
+}
+
+/**
+ * Finds a segment with the same data.
+ *
+ * @param seg   The loaded segment to look for.
+ *
+ * @return The existing segment or `NULL` if there is none.
+ */
+static struct undo_seg *find_segment(struct undo_seg *seg)
+{
+    size_t          i;
+    struct undo_seg *other;
+
+    if (Undo.a_table == 0) {
+        return NULL;
+    }
+
+    for (i = seg->hash & (Undo.a_table - 1); (other = Undo.table[i]) != NULL;
+         i = (i + 1) & (Undo.a_table - 1)) {
+        if (is_same_segment(seg, other)) {
+            return other;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Puts a segment into the hash table, the table grows when it gets half full.
+ *
+ * @param seg   The segment to add.
+ */
+static void index_segment(struct undo_seg *seg)
+{
+    size_t          i, j;
+
+    if (Undo.num_segments * 2 > Undo.a_table) {
+        free(Undo.table);
+        Undo.a_table = MAX(Undo.a_table * 2, 64);
+        Undo.table = xcalloc(Undo.a_table, sizeof(*Undo.table));
+        for (j = 0; j < Undo.num_segments; j++) {
+            i = Undo.segments[j]->hash & (Undo.a_table - 1);
+            while (Undo.table[i] != NULL) {
+                i = (i + 1) & (Undo.a_table - 1);
+            }
+            Undo.table[i] = Undo.segments[j];
+        }
+        return;
+    }
+
+    i = seg->hash & (Undo.a_table - 1);
+    while (Undo.table[i] != NULL) {
+        i = (i + 1) & (Undo.a_table - 1);
+    }
+    Undo.table[i] = seg;
+}
+
+/**
+ * Adds a segment to the list of all segments and indexes it.
+ *
+ * @param seg   The segment to add.
+ *
+ * @return The allocated copy of the segment that was added.
+ */
+static struct undo_seg *add_segment(const struct undo_seg *seg)
+{
+    struct undo_seg *p_seg;
+
+    if (Undo.num_segments + 1 > Undo.a_segments) {
+        Undo.a_segments *= 2;
+        Undo.a_segments++;
+        Undo.segments = xreallocarray(Undo.segments, Undo.a_segments,
+                sizeof(*Undo.segments));
+    }
+
+    p_seg = xmemdup(seg, sizeof(*seg));
+
+    Undo.segments[Undo.num_segments++] = p_seg;
+    index_segment(p_seg);
+    return p_seg;
+}
+
+/**
+ * Writes the data of a loaded segment, compressed if that saves at least an
+ * eighth of the size.
+ *
+ * @param seg           The segment to write.
+ * @param fp            The file to write to.
+ * @param p_comp_len    Set to the compressed length or 0 if the data was
+ *                      written raw.
+ *
+ * @return 0 if the data was written, -1 otherwise.
+ */
+static int write_segment(const struct undo_seg *seg, FILE *fp,
+                         size_t *p_comp_len)
+{
+    char            *comp;
+    const char      *out;
+    size_t          out_len;
+    int             r;
+
+    comp = xmalloc(seg->data_len);
+    *p_comp_len = lz_compress(seg->data, seg->data_len, comp,
+                              seg->data_len - seg->data_len / 8);
+    if (*p_comp_len > 0) {
+        out = comp;
+        out_len = *p_comp_len;
+    } else {
+        out = seg->data;
+        out_len = seg->data_len;
+    }
+    r = fwrite(out, 1, out_len, fp) == out_len ? 0 : -1;
+    free(comp);
+    return r;
+}
+
+/**
+ * Appends the data of a segment to the undo file, see `write_segment()`.
+ *
+ * @param seg   The segment to write, this sets its file and file offset.
+ *
+ * @return 0 if the data was written, -1 otherwise.
  */
-static int compare_segments(struct undo_seg *a, struct undo_seg *b)
+static int spill_segment(struct undo_seg *seg)
 {
-    int cmp;
+    time_t          cur_time;
+    struct tm       *tm;
+    char            *name;
+
+    if (Undo.fp == NULL) {
+        cur_time = time(NULL);
+        tm = localtime(&cur_time);
+
+        name = xasprintf("%s/undo_data_%04d-%02d-%02d_%02d-%02d-%02d",
+                Core.cache_dir,
+                tm->tm_year + 1900, tm->tm_mon + 1, tm->tm_mday,
+                tm->tm_hour, tm->tm_min, tm->tm_sec);
+        Undo.fp = fopen(name, "w+");
+        free(name);
+        if (Undo.fp == NULL) {
+            return -1;
+        }
+    }
 
-    if (a->data_len < b->data_len) {
+    /* reading data back moves the file position */
+    fseeko(Undo.fp, Undo.file_size, SEEK_SET);
+    /* flush right away so the data can be mapped */
+    if (write_segment(seg, Undo.fp, &seg->comp_len) != 0 ||
+            fflush(Undo.fp) != 0) {
+        clearerr(Undo.fp);
+        seg->comp_len = 0;
         return -1;
     }
+    seg->fp = Undo.fp;
+    seg->file_off = Undo.file_size;
+    Undo.file_size += seg->comp_len > 0 ? seg->comp_len : seg->data_len;
+    return 0;
+}
 
-    if (a->data_len > b->data_len) {
-        return 1;
+/**
+ * Maps a part of an undo file into memory.
+ *
+ * @param fp    The file to map.
+ * @param off   The offset within the file.
+ * @param len   The number of bytes to map.
+ *
+ * @return The mapped bytes or `NULL` if mapping failed.
+ */
+static char *map_undo_data(FILE *fp, off_t off, size_t len)
+{
+    static size_t   page_size;
+    size_t          delta;
+    char            *map;
+
+    if (page_size == 0) {
+        page_size = sysconf(_SC_PAGESIZE);
+    }
+    delta = off % page_size;
+    map = mmap(NULL, len + delta, PROT_READ, MAP_PRIVATE, fileno(fp),
+               off - delta);
+    if (map == MAP_FAILED) {
+        return NULL;
     }
+    return map + delta;
+}
 
-    load_undo_data(b);
-    cmp = memcmp(a->data, b->data, b->data_len);
-    unload_undo_data(b);
+/**
+ * Unmaps bytes mapped by `map_undo_data()`.
+ *
+ * @param data  The mapped bytes.
+ * @param len   The number of mapped bytes.
+ */
+static void unmap_undo_data(char *data, size_t len)
+{
+    size_t          delta;
 
-    return cmp;
+    delta = (size_t) data % sysconf(_SC_PAGESIZE);
+    munmap(data - delta, len + delta);
 }
 
 struct undo_seg *save_lines(struct text *text)
@@ -58,12 +260,14 @@ struct undo_seg *save_lines(struct text *text)
     line_t          i;
     col_t           j;
     char            *new_s;
-    size_t          l, m, r;
-    int             cmp;
-    time_t          cur_time;
-    struct tm       *tm;
     struct undo_seg *p_seg;
-    char            *name;
+
+    /* the segment takes over the lines, so they must not have a gap */
+    if (text->gap < text->num_lines) {
+        memmove(&text->lines[text->gap], get_text_line(text, text->gap),
+                sizeof(*text->lines) * (text->num_lines - text->gap));
+        text->gap = text->num_lines;
+    }
 
     new_seg.data = text->lines[0].s;
     new_seg.data_len = text->lines[0].n;
@@ -89,51 +293,22 @@ struct undo_seg *save_lines(struct text *text)
 
     new_seg.lines = text->lines;
     new_seg.num_lines = text->num_lines;
+    new_seg.fp = NULL;
     new_seg.load_count = 0;
+    new_seg.hash = hash_bytes(new_seg.data, new_seg.data_len, HASH_INIT);
 
-    l = 0;
-    r = Undo.num_segments;
-    while (l < r) {
-        m = (l + r) / 2;
-
-        cmp = compare_segments(&new_seg, Undo.segments[m]);
-
-        if (cmp == 0) {
-            /* do not need these anymore, already stored this information */
-            free(new_seg.data);
-            free(new_seg.lines);
-            return Undo.segments[m];
-        }
-
-        if (cmp > 0) {
-            l = m + 1;
-        } else {
-            r = m;
-        }
-    }
-
-    if (Undo.num_segments + 1 > Undo.a_segments) {
-        Undo.a_segments *= 2;
-        Undo.a_segments++;
-        Undo.segments = xreallocarray(Undo.segments, Undo.a_segments,
-                sizeof(*Undo.segments));
+    p_seg = find_segment(&new_seg);
+    if (p_seg != NULL) {
+        /* do not need these anymore, already stored this information */
+        free(new_seg.data);
+        free(new_seg.lines);
+        return p_seg;
     }
 
-    if (new_seg.data_len > HUGE_UNDO_THRESHOLD) {
-        if (Undo.fp == NULL) {
-            cur_time = time(NULL);
-            tm = localtime(&cur_time);
-
-            name = xasprintf("%s/undo_data_%04d-%02d-%02d_%02d-%02d-%02d",
-                    Core.cache_dir,
-                    tm->tm_year + 1900, tm->tm_mon + 1, tm->tm_mday,
-                    tm->tm_hour, tm->tm_min, tm->tm_sec);
-            Undo.fp = fopen(name, "w+");
-            free(name);
-        }
-        fseek(Undo.fp, 0, SEEK_END);
-        fgetpos(Undo.fp, &new_seg.file_pos);
-        fwrite(new_seg.data, 1, new_seg.data_len, Undo.fp);
+    new_seg.file_off = -1;
+    new_seg.comp_len = 0;
+    new_seg.is_mapped = false;
+    if (new_seg.data_len > HUGE_UNDO_THRESHOLD && spill_segment(&new_seg) == 0) {
         for (i = 0; i < new_seg.num_lines; i++) {
             new_seg.lines[i].s -= (size_t) new_seg.data;
         }
@@ -141,31 +316,129 @@ struct undo_seg *save_lines(struct text *text)
         new_seg.data = NULL;
     }
 
-    p_seg = xmemdup(&new_seg, sizeof(new_seg));
+    return add_segment(&new_seg);
+}
 
-    memmove(&Undo.segments[l + 1], &Undo.segments[l],
-            sizeof(*Undo.segments) * (Undo.num_segments - l));
-    Undo.segments[l] = p_seg;
-    Undo.num_segments++;
+/**
+ * Reads bytes from an undo file.
+ *
+ * @param fp    The file to read from.
+ * @param off   The offset within the file.
+ * @param dst   Where to store the bytes.
+ * @param len   The number of bytes to read.
+ *
+ * @return 0 if all bytes were read, -1 otherwise.
+ */
+static int read_undo_data(FILE *fp, off_t off, char *dst, size_t len)
+{
+    int             r;
 
-    return p_seg;
+    r = fseeko(fp, off, SEEK_SET) == 0 &&
+        fread(dst, 1, len, fp) == len ? 0 : -1;
+    clearerr(fp);
+    return r;
 }
 
-void load_undo_data(struct undo_seg *seg)
+/**
+ * Creates the lines of a segment read from an undo history file.
+ *
+ * The lines are stored as offsets into the data, just like the lines of an
+ * unloaded segment.
+ *
+ * @param seg   The segment to create the lines of.
+ * @param data  The data of the segment.
+ *
+ * @return 0 on success, -1 if the data has less lines than it should.
+ */
+static int split_segment(struct undo_seg *seg, const char *data)
 {
+    struct line     *lines;
     line_t          i;
+    const char      *s, *e, *end;
 
-    seg->load_count++;
-    if (seg->data == NULL) {
-        seg->data = xmalloc(seg->data_len);
+    lines = xreallocarray(NULL, seg->num_lines, sizeof(*lines));
+    s = data;
+    end = data + seg->data_len;
+    for (i = 0; i + 1 < seg->num_lines; i++) {
+        e = memchr(s, '\n', end - s);
+        if (e == NULL) {
+            free(lines);
+            return -1;
+        }
+        lines[i].s = (char*) (s - data);
+        lines[i].n = e - s;
+        s = e + 1;
+    }
+    lines[i].s = (char*) (s - data);
+    lines[i].n = end - s;
+    seg->lines = lines;
+    return 0;
+}
 
-        for (i = 0; i < seg->num_lines; i++) {
-            seg->lines[i].s += (size_t) seg->data;
+int load_undo_data(struct undo_seg *seg)
+{
+    line_t          i;
+    char            *data, *comp;
+    bool            is_mapped;
+    int             r;
+
+    if (seg->data != NULL || seg->file_off < 0) {
+        seg->load_count++;
+        return 0;
+    }
+
+    is_mapped = false;
+    data = NULL;
+    if (seg->comp_len == 0) {
+        data = map_undo_data(seg->fp, seg->file_off, seg->data_len);
+        is_mapped = data != NULL;
+    }
+
+    if (data == NULL) {
+        data = xmalloc(seg->data_len);
+        if (seg->comp_len == 0) {
+            r = read_undo_data(seg->fp, seg->file_off, data, seg->data_len);
+        } else {
+            comp = map_undo_data(seg->fp, seg->file_off, seg->comp_len);
+            if (comp == NULL) {
+                comp = xmalloc(seg->comp_len);
+                r = read_undo_data(seg->fp, seg->file_off, comp,
+                                   seg->comp_len);
+                if (r == 0) {
+                    r = lz_decompress(comp, seg->comp_len, data,
+                                      seg->data_len);
+                }
+                free(comp);
+            } else {
+                r = lz_decompress(comp, seg->comp_len, data, seg->data_len);
+                unmap_undo_data(comp, seg->comp_len);
+            }
         }
+    } else {
+        r = 0;
+    }
+
+    if (r == 0 && seg->lines == NULL) {
+        r = split_segment(seg, data);
+    }
 
-        fsetpos(Undo.fp, &seg->file_pos);
-        fread(seg->data, 1, seg->data_len, Undo.fp);
+    if (r != 0) {
+        if (is_mapped) {
+            unmap_undo_data(data, seg->data_len);
+        } else {
+            free(data);
+        }
+        set_error("could not read the undo data");
+        return -1;
     }
+
+    seg->data = data;
+    seg->is_mapped = is_mapped;
+    seg->load_count++;
+    for (i = 0; i < seg->num_lines; i++) {
+        seg->lines[i].s += (size_t) seg->data;
+    }
+    return 0;
 }
 
 void unload_undo_data(struct undo_seg *seg)
@@ -173,11 +446,16 @@ void unload_undo_data(struct undo_seg *seg)
     line_t          i;
 
     seg->load_count--;
-    if (seg->data_len > HUGE_UNDO_THRESHOLD && seg->load_count == 0) {
+    if (seg->file_off >= 0 && seg->load_count == 0) {
         for (i = 0; i < seg->num_lines; i++) {
             seg->lines[i].s -= (size_t) seg->data;
         }
-        free(seg->data);
+        if (seg->is_mapped) {
+            unmap_undo_data(seg->data, seg->data_len);
+            seg->is_mapped = false;
+        } else {
+            free(seg->data);
+        }
         seg->data = NULL;
     }
 }
@@ -196,7 +474,19 @@ struct undo_event *add_event(struct buf *buf, int flags, const struct pos *pos,
                 sizeof(*buf->events));
     }
 
-    ev = &buf->events[buf->event_i++];
+    if (buf->num_history + 1 > buf->a_history) {
+        buf->a_history *= 2;
+        buf->a_history++;
+        buf->history = xreallocarray(buf->history, buf->a_history,
+                sizeof(*buf->history));
+    }
+
+    /* the undone events stay within the history as another branch */
+    ev = xmalloc(sizeof(*ev));
+    ev->parent = buf->event_i == 0 ? NULL : buf->events[buf->event_i - 1];
+    ev->seq = buf->num_history;
+    buf->history[buf->num_history++] = ev;
+    buf->events[buf->event_i++] = ev;
     buf->num_events = buf->event_i;
 
     ev->flags = flags;
@@ -205,12 +495,12 @@ struct undo_event *add_event(struct buf *buf, int flags, const struct pos *pos,
         ev->end.line = ev->pos.line + text->num_lines - 1;
         max_n = 0;
         for (i = 0; i < text->num_lines; i++) {
-            max_n = MAX(max_n, text->lines[i].n);
+            max_n = MAX(max_n, get_text_line(text, i)->n);
         }
         ev->end.col = ev->pos.col + max_n - 1;
     } else {
         ev->end.line = ev->pos.line + text->num_lines - 1;
-        ev->end.col = text->lines[text->num_lines - 1].n;
+        ev->end.col = get_text_line(text, text->num_lines - 1)->n;
         if (ev->end.line == ev->pos.line) {
             ev->end.col += ev->pos.col;
         }
@@ -221,7 +511,16 @@ struct undo_event *add_event(struct buf *buf, int flags, const struct pos *pos,
     return ev;
 }
 
-static void do_event(struct buf *buf, const struct undo_event *ev, int flags)
+/**
+ * Applies an event to the buffer.
+ *
+ * @param buf   The buffer to change.
+ * @param ev    The event to apply.
+ * @param flags The flags to apply the event with, they may be reversed.
+ *
+ * @return 0 on success, -1 if the data of the event could not be loaded.
+ */
+static int do_event(struct buf *buf, const struct undo_event *ev, int flags)
 {
     struct undo_seg *seg;
     struct line     *line;
@@ -235,18 +534,22 @@ static void do_event(struct buf *buf, const struct undo_event *ev, int flags)
         } else {
             delete_range_no_event(buf, &ev->pos, &ev->end);
         }
-        return;
+        return 0;
     }
 
     seg = ev->seg;
-    load_undo_data(seg);
+    if (load_undo_data(seg) != 0) {
+        return -1;
+    }
     if ((flags & IS_REPLACE)) {
-        line = &buf->text.lines[ev->pos.line];
+        line = get_text_line(&buf->text, ev->pos.line);
+        unshare_line(&buf->text, line);
         for (j = 0; j < seg->lines[0].n; j++) {
             line->s[ev->pos.col + j] ^= seg->lines[0].s[j];
         }
         for (i = 1; i < seg->num_lines; i++) {
-            line = &buf->text.lines[ev->pos.line + i];
+            line = get_text_line(&buf->text, ev->pos.line + i);
+            unshare_line(&buf->text, line);
             for (j = 0; j < seg->lines[i].n; j++) {
                 line->s[j] ^= seg->lines[i].s[j];
             }
@@ -261,6 +564,7 @@ static void do_event(struct buf *buf, const struct undo_event *ev, int flags)
         }
     }
     unload_undo_data(seg);
+    return 0;
 }
 
 struct undo_event *undo_event_no_trans(struct buf *buf)
@@ -272,49 +576,946 @@ struct undo_event *undo_event_no_trans(struct buf *buf)
         return NULL;
     }
 
-    ev = &buf->events[--buf->event_i];
+    ev = buf->events[buf->event_i - 1];
     /* reverse the insertion/deletion flags to undo */
     flags = ev->flags;
     if ((flags & (IS_INSERTION | IS_DELETION))) {
         flags ^= (IS_INSERTION | IS_DELETION);
     }
-    do_event(buf, ev, flags);
+    if (do_event(buf, ev, flags) != 0) {
+        return NULL;
+    }
+    buf->event_i--;
     return ev;
 }
 
 struct undo_event *undo_event(struct buf *buf)
 {
-    struct undo_event *ev;
+    struct undo_event *ev, *done;
     int flags;
 
     if (buf->event_i == 0) {
-        return NULL;
+        load_undo_history(buf);
+        if (buf->event_i == 0) {
+            return NULL;
+        }
     }
 
+    /* if an event fails, stop there so the text stays at that event */
+    done = NULL;
+    begin_batch(buf);
     do {
-        ev = &buf->events[--buf->event_i];
+        ev = buf->events[buf->event_i - 1];
         /* reverse the insertion/deletion flags to undo */
         flags = ev->flags;
         if ((flags & (IS_INSERTION | IS_DELETION))) {
             flags ^= (IS_INSERTION | IS_DELETION);
         }
-        do_event(buf, ev, flags);
+        if (do_event(buf, ev, flags) != 0) {
+            break;
+        }
+        buf->event_i--;
+        done = ev;
     } while (buf->event_i > 0 &&
-            !(buf->events[buf->event_i - 1].flags & IS_STOP));
-    return ev;
+            !(buf->events[buf->event_i - 1]->flags & IS_STOP));
+    end_batch(buf);
+    return done;
 }
 
 struct undo_event *redo_event(struct buf *buf)
 {
-    struct undo_event *ev;
+    struct undo_event *ev, *done;
 
     if (buf->event_i == buf->num_events) {
-        return NULL;
+        load_undo_history(buf);
+        if (buf->event_i == buf->num_events) {
+            return NULL;
+        }
     }
 
+    done = NULL;
+    begin_batch(buf);
     do {
-        ev = &buf->events[buf->event_i++];
-        do_event(buf, ev, ev->flags);
+        ev = buf->events[buf->event_i];
+        if (do_event(buf, ev, ev->flags) != 0) {
+            break;
+        }
+        buf->event_i++;
+        done = ev;
     } while (!(ev->flags & IS_STOP) && buf->event_i != buf->num_events);
-    return ev;
+    end_batch(buf);
+    return done;
+}
+
+struct undo_event *get_event_by_count(struct buf *buf, long count)
+{
+    struct undo_event *cur;
+    size_t          seq;
+
+    cur = buf->event_i == 0 ? NULL : buf->events[buf->event_i - 1];
+    if (count < 0) {
+        for (seq = cur == NULL ? 0 : cur->seq; seq > 0; seq--) {
+            if ((buf->history[seq - 1]->flags & IS_STOP) && ++count == 0) {
+                return buf->history[seq - 1];
+            }
+        }
+        return NULL;
+    }
+
+    for (seq = cur == NULL ? 0 : cur->seq + 1;
+         seq < buf->num_history && count > 0; seq++) {
+        if ((buf->history[seq]->flags & IS_STOP)) {
+            cur = buf->history[seq];
+            count--;
+        }
+    }
+    return cur;
+}
+
+struct undo_event *get_event_by_time(struct buf *buf, time_t time)
+{
+    size_t          l, m, r;
+
+    /* find the first event made after `time` */
+    l = 0;
+    r = buf->num_history;
+    while (l < r) {
+        m = (l + r) / 2;
+        if (buf->history[m]->time <= time) {
+            l = m + 1;
+        } else {
+            r = m;
+        }
+    }
+    if (l == 0) {
+        return NULL;
+    }
+
+    /* go to the end of the change the event belongs to */
+    for (l--; l + 1 < buf->num_history; l++) {
+        if ((buf->history[l]->flags & IS_STOP)) {
+            break;
+        }
+    }
+    return buf->history[l];
+}
+
+size_t goto_event(struct buf *buf, struct undo_event *ev, struct pos *p_cur)
+{
+    struct undo_event **path;
+    size_t          depth, common;
+    struct undo_event *e;
+    size_t          count;
+    int             flags;
+
+    depth = 0;
+    for (e = ev; e != NULL; e = e->parent) {
+        depth++;
+    }
+    path = xreallocarray(NULL, depth, sizeof(*path));
+    for (e = ev, common = depth; e != NULL; e = e->parent) {
+        path[--common] = e;
+    }
+
+    /* find where the branches split */
+    while (common < depth && common < buf->num_events &&
+            buf->events[common] == path[common]) {
+        common++;
+    }
+
+    count = 0;
+    begin_batch(buf);
+    while (buf->event_i > common) {
+        e = buf->events[buf->event_i - 1];
+        /* reverse the insertion/deletion flags to undo */
+        flags = e->flags;
+        if ((flags & (IS_INSERTION | IS_DELETION))) {
+            flags ^= (IS_INSERTION | IS_DELETION);
+        }
+        if (do_event(buf, e, flags) != 0) {
+            /* stay on the current branch */
+            depth = common = buf->event_i;
+            break;
+        }
+        buf->event_i--;
+        *p_cur = e->cur;
+        count++;
+    }
+
+    if (common < depth) {
+        /* switch over to the other branch */
+        if (depth >= buf->a_events) {
+            buf->a_events = depth + 1;
+            buf->events = xreallocarray(buf->events, buf->a_events,
+                    sizeof(*buf->events));
+        }
+        memcpy(&buf->events[common], &path[common],
+               sizeof(*path) * (depth - common));
+        buf->num_events = depth;
+    }
+
+    while (buf->event_i < depth) {
+        e = buf->events[buf->event_i];
+        if (do_event(buf, e, e->flags) != 0) {
+            break;
+        }
+        buf->event_i++;
+        *p_cur = (e->flags & IS_DELETION) ? e->cur : e->end;
+        count++;
+    }
+    end_batch(buf);
+
+    free(path);
+    return count;
+}
+
+/// identifies an undo history file
+#define HISTORY_MAGIC   "purec-uh"
+
+/// the version of the undo history format, other versions are ignored
+#define HISTORY_VERSION 3
+
+/**
+ * The start of an undo history file. After it come the path and the data of
+ * the segments, the events and then the segments are at the end. Saving again
+ * appends the data of new segments and new tables, so data is never moved.
+ *
+ * All fields have a fixed width so that the layout does not depend on the
+ * types used in memory.
+ */
+struct history_header {
+    /// `HISTORY_MAGIC` without the null terminator
+    char magic[8];
+    /// `HISTORY_VERSION`
+    uint32_t version;
+    /// length of the path after the header
+    uint32_t path_len;
+    /// size of the file at the time of saving
+    int64_t size;
+    /// modification time of the file at the time of saving
+    int64_t mtime_sec;
+    /// nanoseconds of the modification time
+    int64_t mtime_nsec;
+    /// hash of the text, see `hash_text()`
+    uint64_t hash;
+    /// if the text ends with an empty line, which does not survive writing and
+    /// reading the file, the line before it, otherwise -1
+    int64_t cut_line;
+    /// length of the line `cut_line`
+    int64_t cut_col;
+    /// number of events
+    uint64_t num_events;
+    /// index of the event the text is at plus one, 0 for before all events
+    uint64_t cur_ev;
+    /// index of the last event on the current branch plus one, 0 for none
+    uint64_t tip_ev;
+    /// number of segments
+    uint64_t num_segments;
+    /// offset of the events within the file, all data comes before it
+    uint64_t events_off;
+    /// offset of the segments within the file
+    uint64_t segments_off;
+};
+
+/**
+ * A position within an undo history file.
+ */
+struct history_pos {
+    int64_t line;
+    int64_t col;
+};
+
+/**
+ * An event within an undo history file, the events are in the order they were
+ * made so a parent always comes before its children.
+ */
+struct history_event {
+    /// index of the parent event plus one or 0 if there is none
+    uint64_t parent;
+    /// index of the segment with the text of the event
+    uint64_t seg;
+    uint64_t flags;
+    int64_t time;
+    struct history_pos pos;
+    struct history_pos end;
+    struct history_pos cur;
+};
+
+/**
+ * A segment within an undo history file, the data is stored just like within
+ * the undo file.
+ */
+struct history_seg {
+    /// hash of the data
+    uint64_t hash;
+    /// length of the data
+    uint64_t data_len;
+    /// length of the compressed data or 0 if it is stored raw
+    uint64_t comp_len;
+    /// number of lines within the data
+    uint64_t num_lines;
+    /// offset of the data within the history file
+    uint64_t file_off;
+};
+
+/**
+ * Gets the path of the undo history file that belongs to a file.
+ *
+ * @param path  The absolute path of the file.
+ *
+ * @return The allocated path of the history file.
+ */
+static char *get_history_path(const char *path)
+{
+    return xasprintf("%s/undo_history_%016" PRIx64, Core.cache_dir,
+                     hash_bytes(path, strlen(path), HASH_INIT));
+}
+
+/**
+ * Hashes the lines of a text the way `write_text()` puts them into a file, so
+ * every line ends with '\n' except a last empty line.
+ *
+ * @param text  The text to hash.
+ *
+ * @return The hash of the text.
+ */
+static uint64_t hash_text(const struct text *text)
+{
+    uint64_t        hash;
+    line_t          i;
+    const struct line *line;
+
+    hash = HASH_INIT;
+    for (i = 0; i < text->num_lines; i++) {
+        line = get_text_line(text, i);
+        if (i + 1 == text->num_lines && line->n == 0) {
+            break;
+        }
+        hash = hash_bytes(line->s, line->n, hash);
+        hash = hash_bytes("\n", 1, hash);
+    }
+    return hash;
+}
+
+/**
+ * Compares two segment pointers by their address.
+ *
+ * @param a The first segment pointer.
+ * @param b The second segment pointer.
+ *
+ * @return The sign of the difference of the addresses.
+ */
+static int compare_segments(const void *a, const void *b)
+{
+    uintptr_t       x, y;
+
+    x = (uintptr_t) *(struct undo_seg *const*) a;
+    y = (uintptr_t) *(struct undo_seg *const*) b;
+    return x < y ? -1 : x > y;
+}
+
+/**
+ * Writes the data of an unloaded segment as it is stored, so compressed data
+ * need not be decompressed and compressed again.
+ *
+ * @param seg   The segment to write.
+ * @param fp    The file to write to.
+ *
+ * @return 0 if the data was written, -1 otherwise.
+ */
+static int copy_segment(const struct undo_seg *seg, FILE *fp)
+{
+    size_t          len;
+    char            *data;
+    int             r;
+
+    len = seg->comp_len > 0 ? seg->comp_len : seg->data_len;
+    data = map_undo_data(seg->fp, seg->file_off, len);
+    if (data != NULL) {
+        r = fwrite(data, 1, len, fp) == len ? 0 : -1;
+        unmap_undo_data(data, len);
+        return r;
+    }
+    data = xmalloc(len);
+    r = read_undo_data(seg->fp, seg->file_off, data, len) == 0 &&
+        fwrite(data, 1, len, fp) == len ? 0 : -1;
+    free(data);
+    return r;
+}
+
+/**
+ * Converts a position to the form used in an undo history file.
+ *
+ * @param hpos  The result.
+ * @param pos   The position to convert.
+ */
+static void put_history_pos(struct history_pos *hpos, const struct pos *pos)
+{
+    hpos->line = pos->line;
+    hpos->col = pos->col;
+}
+
+/**
+ * Converts a position read from an undo history file.
+ *
+ * @param pos   The result.
+ * @param hpos  The position to convert, it must be valid.
+ */
+static void get_history_pos(struct pos *pos, const struct history_pos *hpos)
+{
+    pos->line = hpos->line;
+    pos->col = hpos->col;
+}
+
+/**
+ * Finds where the data of a segment is within the history file of a buffer.
+ *
+ * @param buf   The buffer to look in.
+ * @param seg   The segment to look for.
+ *
+ * @return The reference to the data or `NULL` if it is not within the file.
+ */
+static struct history_ref *find_history_ref(struct buf *buf,
+                                            struct undo_seg *seg)
+{
+    /* the segment is the first member of a reference */
+    return bsearch(&seg, buf->history_refs, buf->num_history_refs,
+                   sizeof(*buf->history_refs), compare_segments);
+}
+
+/**
+ * Adds the location of segment data to the history file of a buffer, the
+ * references must be sorted again afterwards.
+ *
+ * @param buf       The buffer whose history file contains the data.
+ * @param seg       The segment.
+ * @param file_off  The offset of the data.
+ * @param comp_len  The length of the compressed data or 0 if it is raw.
+ */
+static void add_history_ref(struct buf *buf, struct undo_seg *seg,
+                            uint64_t file_off, uint64_t comp_len)
+{
+    struct history_ref  *ref;
+
+    if (buf->num_history_refs + 1 > buf->a_history_refs) {
+        buf->a_history_refs *= 2;
+        buf->a_history_refs++;
+        buf->history_refs = xreallocarray(buf->history_refs,
+                                          buf->a_history_refs,
+                                          sizeof(*buf->history_refs));
+    }
+    ref = &buf->history_refs[buf->num_history_refs++];
+    ref->seg = seg;
+    ref->file_off = file_off;
+    ref->comp_len = comp_len;
+}
+
+/**
+ * Closes a history file once no segment reads from it anymore.
+ *
+ * @param fp    The history file, may be `NULL`.
+ */
+static void release_history_file(FILE *fp)
+{
+    size_t          i;
+
+    if (fp == NULL) {
+        return;
+    }
+    for (i = 0; i < Undo.num_segments; i++) {
+        if (Undo.segments[i]->fp == fp) {
+            return;
+        }
+    }
+    fclose(fp);
+}
+
+/**
+ * Writes the data of all segments not yet within the history file, then the
+ * events and segments and last the header.
+ *
+ * @param buf       The buffer whose history to write, its `history_refs`
+ *                  describe the data already within `fp`.
+ * @param fp        The history file.
+ * @param hdr       The header, the counts and offsets are filled in.
+ * @param off       Where to write, everything after it is unused.
+ *
+ * @return 0 if the history was written, -1 otherwise.
+ */
+static int write_history(struct buf *buf, FILE *fp,
+                         struct history_header *hdr, uint64_t off)
+{
+    struct undo_seg         **segs, **p_seg, *seg;
+    size_t                  num_segs, num_refs;
+    struct history_seg      *hsegs;
+    struct history_event    hev;
+    struct history_ref      *ref;
+    struct undo_event       *ev;
+    size_t                  e, s, comp_len;
+    uint64_t                live;
+    int                     r;
+
+    /* events may share a segment, each segment is only written once */
+    segs = xreallocarray(NULL, buf->num_history + 1, sizeof(*segs));
+    for (e = 0; e < buf->num_history; e++) {
+        segs[e] = buf->history[e]->seg;
+    }
+    qsort(segs, buf->num_history, sizeof(*segs), compare_segments);
+    for (e = 0, num_segs = 0; e < buf->num_history; e++) {
+        if (num_segs == 0 || segs[num_segs - 1] != segs[e]) {
+            segs[num_segs++] = segs[e];
+        }
+    }
+    hsegs = xreallocarray(NULL, num_segs + 1, sizeof(*hsegs));
+
+    r = fseeko(fp, off, SEEK_SET) == 0 ? 0 : -1;
+    live = sizeof(*hdr) + hdr->path_len;
+    num_refs = buf->num_history_refs;
+    for (s = 0; r == 0 && s < num_segs; s++) {
+        seg = segs[s];
+        ref = find_history_ref(buf, seg);
+        if (ref == NULL) {
+            if (seg->data == NULL && seg->file_off >= 0) {
+                r = copy_segment(seg, fp);
+                comp_len = seg->comp_len;
+            } else {
+                r = write_segment(seg, fp, &comp_len);
+            }
+            add_history_ref(buf, seg, off, comp_len);
+            ref = &buf->history_refs[buf->num_history_refs - 1];
+            off += comp_len > 0 ? comp_len : seg->data_len;
+        }
+        hsegs[s].hash = seg->hash;
+        hsegs[s].data_len = seg->data_len;
+        hsegs[s].comp_len = ref->comp_len;
+        hsegs[s].num_lines = seg->num_lines;
+        hsegs[s].file_off = ref->file_off;
+        live += ref->comp_len > 0 ? ref->comp_len : seg->data_len;
+    }
+
+    hdr->num_events = buf->num_history;
+    hdr->num_segments = num_segs;
+    hdr->events_off = off;
+    for (e = 0; r == 0 && e < buf->num_history; e++) {
+        ev = buf->history[e];
+        p_seg = bsearch(&ev->seg, segs, num_segs, sizeof(*segs),
+                        compare_segments);
+
+        memset(&hev, 0, sizeof(hev));
+        hev.parent = ev->parent == NULL ? 0 : ev->parent->seq + 1;
+        hev.seg = p_seg - segs;
+        hev.flags = ev->flags;
+        hev.time = ev->time;
+        put_history_pos(&hev.pos, &ev->pos);
+        put_history_pos(&hev.end, &ev->end);
+        put_history_pos(&hev.cur, &ev->cur);
+        if (fwrite(&hev, sizeof(hev), 1, fp) != 1) {
+            r = -1;
+        }
+    }
+    off += sizeof(hev) * buf->num_history;
+
+    /* the header comes last so a failed write leaves the old one intact */
+    hdr->segments_off = off;
+    off += sizeof(*hsegs) * num_segs;
+    if (r == 0 && (fwrite(hsegs, sizeof(*hsegs), num_segs, fp) != num_segs ||
+                   fflush(fp) != 0 ||
+                   fseeko(fp, 0, SEEK_SET) != 0 ||
+                   fwrite(hdr, sizeof(*hdr), 1, fp) != 1 ||
+                   fflush(fp) != 0)) {
+        r = -1;
+    }
+
+    if (r == 0) {
+        live += off - hdr->events_off;
+        buf->history_size = off;
+        buf->history_garbage = off - live;
+    } else {
+        /* the data after the old end is not kept */
+        buf->num_history_refs = num_refs;
+        clearerr(fp);
+    }
+    qsort(buf->history_refs, buf->num_history_refs,
+          sizeof(*buf->history_refs), compare_segments);
+
+    free(hsegs);
+    free(segs);
+    return r;
+}
+
+/**
+ * Checks if the history can be appended to the history file of a buffer.
+ *
+ * @param buf   The buffer whose history to write.
+ * @param name  The path of the history file.
+ *
+ * @return Whether the file is still the one last read or written and it is
+ *         not mostly unused.
+ */
+static bool can_append_history(struct buf *buf, const char *name)
+{
+    struct stat     st, fp_st;
+
+    return buf->history_fp != NULL &&
+        buf->history_garbage <= buf->history_size / 2 &&
+        stat(name, &st) == 0 &&
+        fstat(fileno(buf->history_fp), &fp_st) == 0 &&
+        st.st_dev == fp_st.st_dev && st.st_ino == fp_st.st_ino &&
+        (uint64_t) st.st_size == buf->history_size;
+}
+
+void save_undo_history(struct buf *buf)
+{
+    char                    *name, *tmp;
+    FILE                    *fp;
+    struct history_header   hdr;
+    int                     r;
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, HISTORY_MAGIC, sizeof(hdr.magic));
+    hdr.version = HISTORY_VERSION;
+    hdr.path_len = strlen(buf->path);
+    hdr.size = buf->st.st_size;
+    hdr.mtime_sec = buf->st.st_mtim.tv_sec;
+    hdr.mtime_nsec = buf->st.st_mtim.tv_nsec;
+    hdr.hash = hash_text(&buf->text);
+    hdr.cut_line = -1;
+    hdr.cut_col = -1;
+    if (buf->text.num_lines > 1 &&
+            get_text_line(&buf->text, buf->text.num_lines - 1)->n == 0) {
+        hdr.cut_line = buf->text.num_lines - 2;
+        hdr.cut_col = get_text_line(&buf->text, hdr.cut_line)->n;
+    }
+    hdr.cur_ev = buf->event_i == 0 ? 0 :
+        buf->events[buf->event_i - 1]->seq + 1;
+    hdr.tip_ev = buf->num_events == 0 ? 0 :
+        buf->events[buf->num_events - 1]->seq + 1;
+
+    name = get_history_path(buf->path);
+    if (can_append_history(buf, name) &&
+            write_history(buf, buf->history_fp, &hdr,
+                          buf->history_size) == 0) {
+        free(name);
+        return;
+    }
+
+    /* start over with a file that only has the data still in use */
+    release_history_file(buf->history_fp);
+    buf->history_fp = NULL;
+    buf->num_history_refs = 0;
+
+    tmp = xasprintf("%s.tmp", name);
+    fp = fopen(tmp, "w+");
+    if (fp == NULL) {
+        free(tmp);
+        free(name);
+        return;
+    }
+
+    /* the header is written again once the offsets are known */
+    r = fwrite(&hdr, sizeof(hdr), 1, fp) == 1 &&
+        fwrite(buf->path, 1, hdr.path_len, fp) == hdr.path_len ? 0 : -1;
+    if (r == 0) {
+        r = write_history(buf, fp, &hdr, sizeof(hdr) + hdr.path_len);
+    }
+
+    /* replace the old history only once the new one is complete */
+    if (r != 0 || rename(tmp, name) != 0) {
+        fclose(fp);
+        remove(tmp);
+        buf->num_history_refs = 0;
+    } else {
+        buf->history_fp = fp;
+    }
+
+    free(tmp);
+    free(name);
+}
+
+/**
+ * Checks if a position read from an undo history file is valid.
+ *
+ * @param hpos  The position to check.
+ *
+ * @return Whether the position can be converted.
+ */
+static bool is_history_pos_valid(const struct history_pos *hpos)
+{
+    return hpos->line >= 0 && hpos->col >= 0 && hpos->col <= COL_MAX;
+}
+
+/**
+ * Checks that the events and segments of an undo history file fit together,
+ * so that they can be used without further checks.
+ *
+ * @param hdr   The header of the file.
+ * @param hevs  The events of the file.
+ * @param hsegs The segments of the file.
+ *
+ * @return Whether the history is consistent.
+ */
+static bool check_history(const struct history_header *hdr,
+                          const struct history_event *hevs,
+                          const struct history_seg *hsegs)
+{
+    const struct history_seg    *hseg;
+    const struct history_event  *hev;
+    uint64_t                    i, len;
+
+    for (i = 0; i < hdr->num_segments; i++) {
+        hseg = &hsegs[i];
+        len = hseg->comp_len > 0 ? hseg->comp_len : hseg->data_len;
+        /* a compressed byte expands to at most 255 bytes */
+        if (hseg->num_lines == 0 || hseg->num_lines - 1 > hseg->data_len ||
+                hseg->comp_len > hseg->data_len ||
+                (hseg->comp_len > 0 && hseg->data_len / 255 > hseg->comp_len) ||
+                hseg->file_off > hdr->events_off ||
+                len > hdr->events_off - hseg->file_off) {
+            return false;
+        }
+    }
+
+    for (i = 0; i < hdr->num_events; i++) {
+        hev = &hevs[i];
+        if (hev->parent > i || hev->seg >= hdr->num_segments ||
+                hev->flags > INT_MAX ||
+                !(hev->flags & (IS_INSERTION | IS_DELETION | IS_REPLACE)) ||
+                !is_history_pos_valid(&hev->pos) ||
+                !is_history_pos_valid(&hev->end) ||
+                !is_history_pos_valid(&hev->cur)) {
+            return false;
+        }
+    }
+
+    if (hdr->cut_line >= 0 && (hdr->cur_ev == 0 || hdr->cut_col < 0 ||
+                               hdr->cut_col > COL_MAX)) {
+        return false;
+    }
+
+    /* the text must be on the current branch */
+    for (i = hdr->tip_ev; i != hdr->cur_ev; i = hevs[i - 1].parent) {
+        if (i == 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Gets the number of events from the root up to an event.
+ *
+ * @param ev    The event or `NULL` for the root.
+ *
+ * @return The depth of the event.
+ */
+static size_t get_event_depth(const struct undo_event *ev)
+{
+    size_t          depth;
+
+    for (depth = 0; ev != NULL; ev = ev->parent) {
+        depth++;
+    }
+    return depth;
+}
+
+void load_undo_history(struct buf *buf)
+{
+    char                    *name;
+    FILE                    *fp;
+    struct stat             st;
+    struct history_header   hdr;
+    char                    *path;
+    struct history_event    *hevs;
+    struct history_seg      *hsegs;
+    struct undo_seg         seg, **segs;
+    struct undo_event       **history, **events;
+    struct undo_event       *ev, *at;
+    size_t                  num_loaded, e, depth, at_depth;
+    uint64_t                live;
+    struct text             text;
+
+    if (buf->is_history_loaded) {
+        return;
+    }
+    buf->is_history_loaded = true;
+
+    if (buf->path == NULL) {
+        return;
+    }
+
+    name = get_history_path(buf->path);
+    /* saving appends to the same file */
+    fp = fopen(name, "r+");
+    if (fp == NULL) {
+        fp = fopen(name, "r");
+    }
+    free(name);
+    if (fp == NULL) {
+        return;
+    }
+
+    /* the hash of the loaded lines is only complete once all are loaded */
+    finish_loading(buf);
+
+    hevs = NULL;
+    hsegs = NULL;
+    if (fstat(fileno(fp), &st) == -1 ||
+            fread(&hdr, sizeof(hdr), 1, fp) != 1 ||
+            memcmp(hdr.magic, HISTORY_MAGIC, sizeof(hdr.magic)) != 0 ||
+            hdr.version != HISTORY_VERSION ||
+            hdr.path_len != strlen(buf->path) ||
+            hdr.size != buf->st.st_size ||
+            hdr.mtime_sec != buf->st.st_mtim.tv_sec ||
+            hdr.mtime_nsec != buf->st.st_mtim.tv_nsec ||
+            hdr.hash != buf->load_hash ||
+            hdr.num_events == 0 ||
+            hdr.num_events > (uint64_t) st.st_size / sizeof(*hevs) ||
+            hdr.num_segments > (uint64_t) st.st_size / sizeof(*hsegs) ||
+            hdr.events_off > (uint64_t) st.st_size ||
+            hdr.segments_off > (uint64_t) st.st_size ||
+            hdr.cur_ev > hdr.num_events ||
+            hdr.tip_ev > hdr.num_events) {
+        goto fail;
+    }
+
+    path = xmalloc(hdr.path_len);
+    if (fread(path, 1, hdr.path_len, fp) != hdr.path_len ||
+            memcmp(path, buf->path, hdr.path_len) != 0) {
+        free(path);
+        goto fail;
+    }
+    free(path);
+
+    hevs = xreallocarray(NULL, hdr.num_events, sizeof(*hevs));
+    hsegs = xreallocarray(NULL, hdr.num_segments + 1, sizeof(*hsegs));
+    if (fseeko(fp, hdr.events_off, SEEK_SET) != 0 ||
+            fread(hevs, sizeof(*hevs), hdr.num_events, fp) != hdr.num_events ||
+            fseeko(fp, hdr.segments_off, SEEK_SET) != 0 ||
+            fread(hsegs, sizeof(*hsegs), hdr.num_segments, fp) !=
+                hdr.num_segments ||
+            !check_history(&hdr, hevs, hsegs)) {
+        goto fail;
+    }
+
+    /* the data stays within the file until an event needs it */
+    segs = xreallocarray(NULL, hdr.num_segments, sizeof(*segs));
+    live = sizeof(hdr) + hdr.path_len + sizeof(*hevs) * hdr.num_events +
+        sizeof(*hsegs) * hdr.num_segments;
+    for (e = 0; e < hdr.num_segments; e++) {
+        seg.data = NULL;
+        seg.data_len = hsegs[e].data_len;
+        seg.lines = NULL;
+        seg.num_lines = hsegs[e].num_lines;
+        seg.fp = fp;
+        seg.file_off = hsegs[e].file_off;
+        seg.comp_len = hsegs[e].comp_len;
+        seg.is_mapped = false;
+        seg.load_count = 0;
+        seg.hash = hsegs[e].hash;
+        segs[e] = add_segment(&seg);
+        add_history_ref(buf, segs[e], seg.file_off, seg.comp_len);
+        live += seg.comp_len > 0 ? seg.comp_len : seg.data_len;
+    }
+    qsort(buf->history_refs, buf->num_history_refs,
+          sizeof(*buf->history_refs), compare_segments);
+    buf->history_fp = fp;
+    buf->history_size = st.st_size;
+    /* segments may share data in a damaged file */
+    buf->history_garbage = live < buf->history_size ?
+        buf->history_size - live : 0;
+
+    /* the loaded events are older than all others */
+    num_loaded = hdr.num_events + (hdr.cut_line >= 0);
+    history = xreallocarray(NULL, num_loaded + buf->num_history + 1,
+                            sizeof(*history));
+    for (e = 0; e < hdr.num_events; e++) {
+        ev = xmalloc(sizeof(*ev));
+        ev->parent = hevs[e].parent == 0 ? NULL :
+            history[hevs[e].parent - 1];
+        ev->flags = hevs[e].flags;
+        ev->time = hevs[e].time;
+        get_history_pos(&ev->pos, &hevs[e].pos);
+        get_history_pos(&ev->end, &hevs[e].end);
+        get_history_pos(&ev->cur, &hevs[e].cur);
+        ev->seg = segs[hevs[e].seg];
+        history[e] = ev;
+    }
+    free(segs);
+
+    at = hdr.cur_ev == 0 ? NULL : history[hdr.cur_ev - 1];
+    if (hdr.cut_line >= 0) {
+        /* the empty last line was lost when writing the file, removing it
+         * becomes part of the change the text is at
+         */
+        init_text(&text, 2);
+        ev = xmalloc(sizeof(*ev));
+        ev->parent = at;
+        ev->flags = IS_DELETION | IS_STOP;
+        ev->time = history[hdr.num_events - 1]->time;
+        ev->pos.line = hdr.cut_line;
+        ev->pos.col = hdr.cut_col;
+        ev->end.line = hdr.cut_line + 1;
+        ev->end.col = 0;
+        ev->cur = ev->pos;
+        ev->seg = save_lines(&text);
+        at->flags &= ~IS_STOP;
+        history[hdr.num_events] = ev;
+        at = ev;
+    } else if (at != NULL) {
+        /* the text as it was loaded is a stopping point */
+        at->flags |= IS_STOP;
+    }
+
+    /* the events of this session were made on the loaded text */
+    for (e = 0; e < buf->num_history; e++) {
+        if (buf->history[e]->parent == NULL) {
+            buf->history[e]->parent = at;
+        }
+    }
+    if (buf->num_history > 0) {
+        memcpy(&history[num_loaded], buf->history,
+               sizeof(*history) * buf->num_history);
+    }
+    free(buf->history);
+    buf->history = history;
+    buf->num_history += num_loaded;
+    buf->a_history = buf->num_history + 1;
+    for (e = 0; e < buf->num_history; e++) {
+        buf->history[e]->seq = e;
+    }
+
+    /* without changes in this session, the undone events of the last session
+     * can still be redone
+     */
+    at_depth = get_event_depth(at);
+    ev = at;
+    if (buf->num_events == 0 && hdr.cut_line < 0 && hdr.tip_ev > 0) {
+        ev = history[hdr.tip_ev - 1];
+    }
+    depth = get_event_depth(ev);
+    events = xreallocarray(NULL, depth + buf->num_events + 1,
+                           sizeof(*events));
+    for (e = depth; ev != NULL; ev = ev->parent) {
+        events[--e] = ev;
+    }
+    if (buf->num_events > 0) {
+        memcpy(&events[depth], buf->events,
+               sizeof(*events) * buf->num_events);
+    }
+    free(buf->events);
+    buf->events = events;
+    buf->num_events += depth;
+    buf->a_events = buf->num_events + 1;
+    buf->event_i += at_depth;
+    buf->save_event_i += at_depth;
+
+    free(hsegs);
+    free(hevs);
+    /* the segments read their data from the file */
+    return;
+
+fail:
+    free(hsegs);
+    free(hevs);
+    fclose(fp);
 }
@@ -1,5 +1,6 @@
 #include "util.h"
 #include "purec.h"
+#include "scan.h"
 #include "xalloc.h"
 
 #include <ctype.h>
@@ -60,12 +61,20 @@ size_t move_back_glyph(const char *s, size_t i)
     return i - n;
 }
 
-size_t get_index(const char *s, size_t n, int ts, size_t target_x)
+size_t get_index_from(const char *s, size_t n, int ts, size_t i, size_t x,
+                      size_t target_x)
 {
     struct glyph    g;
-    size_t          i, x;
-
-    for (i = 0, x = 0; i < n && x < target_x; i += g.n, x += g.w) {
+    const char      *p;
+
+    for (; i < n && x < target_x; i += g.n, x += g.w) {
+        /* printable ascii takes one column per byte */
+        p = skip_plain(&s[i], &s[i + MIN(n - i, target_x - x)]);
+        if (p != &s[i]) {
+            g.n = p - &s[i];
+            g.w = g.n;
+            continue;
+        }
         if (s[i] == '\t') {
             g.n = 1;
             g.w = tab_adjust(x, ts);
@@ -76,13 +85,26 @@ size_t get_index(const char *s, size_t n, int ts, size_t target_x)
     return i;
 }
 
-size_t get_advance(const char *s, size_t n, int ts, size_t i)
+size_t get_index(const char *s, size_t n, int ts, size_t target_x)
+{
+    return get_index_from(s, n, ts, 0, 0, target_x);
+}
+
+size_t get_advance_from(const char *s, size_t n, int ts, size_t j, size_t x,
+                        size_t i)
 {
-    size_t          j, x;
     struct glyph    g;
+    const char      *p;
 
     i = MIN(i, n);
-    for (j = 0, x = 0; j < i; ) {
+    for (; j < i; ) {
+        /* printable ascii takes one column per byte */
+        p = skip_plain(&s[j], &s[i]);
+        x += p - &s[j];
+        j = p - s;
+        if (j == i) {
+            break;
+        }
         if (s[j] == '\t') {
             g.n = 1;
             g.w = tab_adjust(x, ts);
@@ -95,6 +117,11 @@ size_t get_advance(const char *s, size_t n, int ts, size_t i)
     return x;
 }
 
+size_t get_advance(const char *s, size_t n, int ts, size_t i)
+{
+    return get_advance_from(s, n, ts, 0, 0, i);
+}
+
 int wcwidth(wchar_t c);
 
 int get_glyph(const char *s, size_t n, struct glyph *g)
@@ -161,6 +188,12 @@ bool is_point_equal(const struct pos *p1, const struct pos *p2)
     return p1->line == p2->line && p1->col == p2->col;
 }
 
+bool is_point_before(const struct pos *p1, const struct pos *p2)
+{
+    return p1->line < p2->line ||
+        (p1->line == p2->line && p1->col < p2->col);
+}
+
 void sort_positions(struct pos *p1, struct pos *p2)
 {
     struct pos      tmp;
@@ -234,6 +267,17 @@ size_t safe_add(size_t a, size_t b)
     return c;
 }
 
+uint64_t hash_bytes(const void *data, size_t len, uint64_t hash)
+{
+    const unsigned char *s;
+
+    for (s = data; len > 0; len--, s++) {
+        hash ^= *s;
+        hash *= 1099511628211u;
+    }
+    return hash;
+}
+
 char *get_relative_path(const char *path)
 {
     char            *cwd;
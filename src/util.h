@@ -4,6 +4,7 @@
 #include <limits.h>
 #include <stddef.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 
 /**
@@ -105,6 +106,21 @@ size_t move_back_glyph(const char *s, size_t i);
  */
 size_t get_index(const char *s, size_t n, int ts, size_t x);
 
+/**
+ * Gets the index at given x position, starting from a known glyph.
+ *
+ * @param s         The multi byte sequence.
+ * @param n         The length of the multi byte sequence.
+ * @param ts        The tab size to use.
+ * @param i         The index of a glyph before the x position.
+ * @param x         The x position of that glyph.
+ * @param target_x  The x position.
+ *
+ * @return The index at given x position.
+ */
+size_t get_index_from(const char *s, size_t n, int ts, size_t i, size_t x,
+                      size_t target_x);
+
 /**
  * Gets the x position of given index.
  *
@@ -117,6 +133,21 @@ size_t get_index(const char *s, size_t n, int ts, size_t x);
  */
 size_t get_advance(const char *s, size_t n, int ts, size_t i);
 
+/**
+ * Gets the x position of given index, starting from a known glyph.
+ *
+ * @param s     The multi byte sequence.
+ * @param n     The length of the byte sequence.
+ * @param ts    The tab size to use.
+ * @param j     The index of a glyph before `i`.
+ * @param x     The x position of that glyph.
+ * @param i     The index.
+ *
+ * @return The x position.
+ */
+size_t get_advance_from(const char *s, size_t n, int ts, size_t j, size_t x,
+                        size_t i);
+
 /**
  * Gets the first glyph of the multi byte string `s`.
  *
@@ -151,6 +182,16 @@ struct pos {
  */
 bool is_point_equal(const struct pos *p1, const struct pos *p2);
 
+/**
+ * Checks if a point comes strictly before another point.
+ *
+ * @param p1    The first position.
+ * @param p2    The second position.
+ *
+ * @return Whether `p1` comes before `p2`.
+ */
+bool is_point_before(const struct pos *p1, const struct pos *p2);
+
 /**
  * Sets `p1` to the position that comes first and `p2` to last.
  *
@@ -215,6 +256,23 @@ size_t safe_mul(size_t a, size_t b);
  */
 size_t safe_add(size_t a, size_t b);
 
+/// the starting value for `hash_bytes()`
+#define HASH_INIT 14695981039346656037u
+
+/**
+ * Hashes bytes using FNV-1a.
+ *
+ * Hashing can be continued by passing the result of a previous call as
+ * `hash`, start with `HASH_INIT`.
+ *
+ * @param data  The bytes to hash.
+ * @param len   The number of bytes.
+ * @param hash  The hash to continue from.
+ *
+ * @return The new hash.
+ */
+uint64_t hash_bytes(const void *data, size_t len, uint64_t hash);
+
 /**
  * Gets the given path relative to the current working directory.
  *
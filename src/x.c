@@ -206,9 +206,10 @@ static void handle_sel_notify(XEvent *e)
 {
     unsigned long   nitems, ofs, rem;
     int             format;
-    unsigned char   *data, *last, *repl, *st;
+    unsigned char   *data;
     Atom            type, property = None;
-    struct line     *line;
+    char            *str;
+    size_t          len, a, n;
 
     ofs = 0;
     property = e->xselection.property;
@@ -216,34 +217,31 @@ static void handle_sel_notify(XEvent *e)
         return;
     }
 
+    /* collect all data first so lines crossing chunk borders stay intact */
+    str = NULL;
+    len = 0;
+    a = 0;
     do {
         if (XGetWindowProperty(X.dpy_paste, X.win_paste, property, ofs,
                     BUFSIZ / 4, False, AnyPropertyType,
                     &type, &format, &nitems, &rem, &data) != 0) {
-            return;
+            break;
         }
 
-        repl = data;
-        last = data + nitems * format / 8;
-        while (st = repl, repl = memchr(repl, '\n', last - repl), 1) {
-            if (repl == NULL) {
-                repl = last;
-            }
-            line = insert_blank(&X.text, X.text.num_lines, 1);
-            line->s = xmemdup(st, repl - st);
-            line->n = repl - st;
-            if (repl == last) {
-                break;
-            }
-            repl++;
+        n = nitems * format / 8;
+        if (len + n > a) {
+            a *= 2;
+            a += n;
+            str = xrealloc(str, a);
         }
+        memcpy(&str[len], data, n);
+        len += n;
 
         XFree(data);
         /* number of 32-bit chunks returned */
         ofs += nitems * format / 32;
     } while (rem > 0);
 
-    X.text.a_lines = 0;
-    X.text.lines = xreallocarray(X.text.lines, X.text.num_lines,
-                                 sizeof(*X.text.lines));
+    str_to_text(str, len, &X.text);
+    free(str);
 }
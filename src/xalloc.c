@@ -1,10 +1,261 @@
+/* the functions are defined here, so they must not be wrapped */
+#define XALLOC_INTERNAL
 #include "xalloc.h"
 
 #include <errno.h>
 #include <stdarg.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 
+#ifdef XALLOC_STATS
+
+#include <pthread.h>
+
+__thread const char *XallocFile;
+__thread const char *XallocFunc;
+__thread int XallocLine;
+
+/// the maximum number of call sites, a power of two
+#define XALLOC_MAX_SITES    4096
+
+struct xalloc_block {
+    /// the allocated memory, `NULL` for an empty slot
+    void                *ptr;
+    /// the number of bytes requested
+    size_t              size;
+    /// the site that made the allocation
+    struct xalloc_site  *site;
+};
+
+static struct xalloc_stats {
+    /// lock for all members, search threads allocate as well
+    pthread_mutex_t     lock;
+    /// hash table of the call sites
+    struct xalloc_site  sites[XALLOC_MAX_SITES];
+    /// the number of call sites
+    size_t              num_sites;
+    /// hash table of the live allocations
+    struct xalloc_block *blocks;
+    /// the number of live allocations
+    size_t              num_blocks;
+    /// the number of slots in `blocks`, a power of two
+    size_t              a_blocks;
+} Stats = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+/**
+ * Gets the site of the current call, the location is set by the wrapping
+ * macros.
+ *
+ * @return The site or `NULL` if there are too many sites.
+ */
+static struct xalloc_site *get_site(void)
+{
+    const char          *file;
+    size_t              i;
+    struct xalloc_site  *site;
+
+    file = XallocFile == NULL ? "?" : XallocFile;
+    i = ((size_t) XallocLine * 2654435761u) & (XALLOC_MAX_SITES - 1);
+    for (; site = &Stats.sites[i], site->file != NULL;
+         i = (i + 1) & (XALLOC_MAX_SITES - 1)) {
+        if (site->line == XallocLine && strcmp(site->file, file) == 0) {
+            return site;
+        }
+    }
+    /* keep one slot empty so that the search ends */
+    if (Stats.num_sites == XALLOC_MAX_SITES - 1) {
+        return NULL;
+    }
+    Stats.num_sites++;
+    site->file = file;
+    site->func = XallocFunc == NULL ? "?" : XallocFunc;
+    site->line = XallocLine;
+    return site;
+}
+
+/**
+ * Gets the home slot of a pointer within the block table.
+ */
+static size_t hash_block(const void *ptr)
+{
+    return (size_t) (((uintptr_t) ptr >> 4) * 2654435761u) &
+        (Stats.a_blocks - 1);
+}
+
+/**
+ * Finds the slot of a pointer or the empty slot it would go into.
+ */
+static size_t find_block(const void *ptr)
+{
+    size_t          i;
+
+    for (i = hash_block(ptr); Stats.blocks[i].ptr != NULL &&
+            Stats.blocks[i].ptr != ptr; i = (i + 1) & (Stats.a_blocks - 1)) {
+        (void) 0;
+    }
+    return i;
+}
+
+/**
+ * Doubles the size of the block table.
+ */
+static void grow_blocks(void)
+{
+    struct xalloc_block *old;
+    size_t              a_old, i;
+
+    old = Stats.blocks;
+    a_old = Stats.a_blocks;
+    Stats.a_blocks = a_old == 0 ? 1024 : a_old * 2;
+    Stats.blocks = calloc(Stats.a_blocks, sizeof(*Stats.blocks));
+    if (Stats.blocks == NULL) {
+        fprintf(stderr, "calloc(%zu, %zu): %s\n",
+                Stats.a_blocks, sizeof(*Stats.blocks), strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    for (i = 0; i < a_old; i++) {
+        if (old[i].ptr != NULL) {
+            Stats.blocks[find_block(old[i].ptr)] = old[i];
+        }
+    }
+    free(old);
+}
+
+/**
+ * Records an allocation at the current site.
+ *
+ * @param ptr   The allocated memory, may be `NULL`.
+ * @param size  The number of bytes requested.
+ */
+static void record_alloc(void *ptr, size_t size)
+{
+    struct xalloc_site  *site;
+    struct xalloc_block *block;
+
+    if (ptr == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&Stats.lock);
+    site = get_site();
+    if (site != NULL) {
+        site->calls++;
+        site->bytes += size;
+        site->live += size;
+    }
+    if ((Stats.num_blocks + 1) * 2 > Stats.a_blocks) {
+        grow_blocks();
+    }
+    block = &Stats.blocks[find_block(ptr)];
+    if (block->ptr == NULL) {
+        Stats.num_blocks++;
+    } else if (block->site != NULL) {
+        /* the memory was freed without this header and is now reused */
+        block->site->live -= block->size;
+    }
+    block->ptr = ptr;
+    block->size = size;
+    block->site = site;
+    pthread_mutex_unlock(&Stats.lock);
+}
+
+/**
+ * Forgets an allocation.
+ *
+ * @param ptr   The memory that is freed, may be `NULL` or memory that was not
+ *              recorded.
+ */
+static void record_free(void *ptr)
+{
+    size_t          i, j, mask;
+    struct xalloc_block *block;
+
+    if (ptr == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&Stats.lock);
+    if (Stats.num_blocks == 0) {
+        pthread_mutex_unlock(&Stats.lock);
+        return;
+    }
+    i = find_block(ptr);
+    block = &Stats.blocks[i];
+    if (block->ptr == NULL) {
+        pthread_mutex_unlock(&Stats.lock);
+        return;
+    }
+    if (block->site != NULL) {
+        block->site->live -= block->size;
+    }
+
+    /* move following blocks back instead of leaving a hole */
+    mask = Stats.a_blocks - 1;
+    for (j = (i + 1) & mask; Stats.blocks[j].ptr != NULL; j = (j + 1) & mask) {
+        if (((j - hash_block(Stats.blocks[j].ptr)) & mask) >=
+                ((j - i) & mask)) {
+            Stats.blocks[i] = Stats.blocks[j];
+            i = j;
+        }
+    }
+    Stats.blocks[i].ptr = NULL;
+    Stats.num_blocks--;
+    pthread_mutex_unlock(&Stats.lock);
+}
+
+void xfree(void *ptr)
+{
+    record_free(ptr);
+    free(ptr);
+}
+
+/**
+ * Compares two sites by their live bytes and then by their total bytes, the
+ * larger one comes first.
+ */
+static int compare_sites(const void *a, const void *b)
+{
+    const struct xalloc_site *s1 = a, *s2 = b;
+
+    if (s1->live != s2->live) {
+        return s1->live < s2->live ? 1 : -1;
+    }
+    if (s1->bytes != s2->bytes) {
+        return s1->bytes < s2->bytes ? 1 : -1;
+    }
+    return 0;
+}
+
+struct xalloc_site *get_xalloc_sites(size_t *p_num)
+{
+    struct xalloc_site  *sites;
+    size_t              i, n;
+
+    pthread_mutex_lock(&Stats.lock);
+    sites = malloc(sizeof(*sites) * (Stats.num_sites + 1));
+    if (sites == NULL) {
+        fprintf(stderr, "malloc(%zu): %s\n",
+                sizeof(*sites) * (Stats.num_sites + 1), strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    for (i = 0, n = 0; i < XALLOC_MAX_SITES; i++) {
+        if (Stats.sites[i].file != NULL) {
+            sites[n++] = Stats.sites[i];
+        }
+    }
+    pthread_mutex_unlock(&Stats.lock);
+    qsort(sites, n, sizeof(*sites), compare_sites);
+    *p_num = n;
+    return sites;
+}
+
+#else
+
+#define record_alloc(ptr, size) ((void) (ptr), (void) (size))
+#define record_free(ptr)        ((void) (ptr))
+#define xfree(ptr)              free(ptr)
+
+#endif
+
 void *xmalloc(size_t size)
 {
     void *ptr;
@@ -18,6 +269,7 @@ void *xmalloc(size_t size)
                 size, strerror(errno));
         exit(EXIT_FAILURE);
     }
+    record_alloc(ptr, size);
     return ptr;
 }
 
@@ -34,21 +286,24 @@ void *xcalloc(size_t nmemb, size_t size)
                 nmemb, size, strerror(errno));
         exit(EXIT_FAILURE);
     }
+    record_alloc(ptr, nmemb * size);
     return ptr;
 }
 
 void *xrealloc(void *ptr, size_t size)
 {
     if (size == 0) {
-        free(ptr);
+        xfree(ptr);
         return NULL;
     }
+    record_free(ptr);
     ptr = realloc(ptr, size);
     if (ptr == NULL) {
         fprintf(stderr, "realloc(%p, %zu): %s\n",
                 ptr, size, strerror(errno));
         exit(EXIT_FAILURE);
     }
+    record_alloc(ptr, size);
     return ptr;
 }
 
@@ -57,7 +312,7 @@ void *xreallocarray(void *ptr, size_t nmemb, size_t size)
     size_t n_bytes;
 
     if (nmemb == 0 || size == 0) {
-        free(ptr);
+        xfree(ptr);
         return NULL;
     }
     if (__builtin_mul_overflow(nmemb, size, &n_bytes)) {
@@ -65,12 +320,14 @@ void *xreallocarray(void *ptr, size_t nmemb, size_t size)
                 ptr, nmemb, size);
         exit(EXIT_FAILURE);
     }
+    record_free(ptr);
     ptr = realloc(ptr, n_bytes);
     if (ptr == NULL) {
         fprintf(stderr, "reallocarray(%p, %zu, %zu): %s\n",
                 ptr, nmemb, size, strerror(errno));
         exit(EXIT_FAILURE);
     }
+    record_alloc(ptr, n_bytes);
     return ptr;
 }
 
@@ -89,6 +346,7 @@ void *xmemdup(const void *ptr, size_t size)
         exit(EXIT_FAILURE);
     }
     memcpy(p_dup, ptr, size);
+    record_alloc(p_dup, size);
     return p_dup;
 }
 
@@ -102,6 +360,7 @@ void *xstrdup(const char *s)
                 s, strerror(errno));
         exit(EXIT_FAILURE);
     }
+    record_alloc(s_dup, strlen(s_dup) + 1);
     return s_dup;
 }
 
@@ -115,6 +374,7 @@ void *xstrndup(const char *s, size_t n)
                 (int) n, s, n, strerror(errno));
         exit(EXIT_FAILURE);
     }
+    record_alloc(s_dup, strlen(s_dup) + 1);
     return s_dup;
 }
 
@@ -122,13 +382,227 @@ char *xasprintf(const char *fmt, ...)
 {
     va_list l;
     char *s;
+    int n;
 
     va_start(l, fmt);
-    if (vasprintf(&s, fmt, l) == -1) {
+    n = vasprintf(&s, fmt, l);
+    if (n == -1) {
         fprintf(stderr, "vasprintf(%s): %s\n",
                 fmt, strerror(errno));
         exit(EXIT_FAILURE);
     }
     va_end(l);
+    record_alloc(s, n + 1);
     return s;
 }
+
+/// the size of a new arena chunk if no allocation needs more
+#define ARENA_CHUNK_SIZE    65536
+
+/// the alignment of all arena allocations
+#define ARENA_ALIGN         16
+
+struct arena_chunk {
+    /// the previously used chunk
+    struct arena_chunk  *prev;
+    /// the number of bytes in `data`
+    size_t              size;
+    /// the number of bytes handed out
+    size_t              used;
+    /// padding, so that `data` is aligned
+    size_t              pad;
+    /// the memory of the chunk
+    char                data[];
+};
+
+void *arena_alloc(struct arena *arena, size_t size)
+{
+    struct arena_chunk  *chunk;
+    size_t              chunk_size;
+    void                *ptr;
+
+    if (size == 0) {
+        return NULL;
+    }
+    size = (size + ARENA_ALIGN - 1) & ~(size_t) (ARENA_ALIGN - 1);
+    chunk = arena->chunk;
+    if (chunk == NULL || chunk->size - chunk->used < size) {
+        chunk_size = size > ARENA_CHUNK_SIZE ? size : ARENA_CHUNK_SIZE;
+        chunk = xmalloc(sizeof(*chunk) + chunk_size);
+        chunk->prev = arena->chunk;
+        chunk->size = chunk_size;
+        chunk->used = 0;
+        arena->chunk = chunk;
+    }
+    ptr = &chunk->data[chunk->used];
+    chunk->used += size;
+    return ptr;
+}
+
+void clear_arena(struct arena *arena)
+{
+    struct arena_chunk  *chunk, *prev;
+
+    for (chunk = arena->chunk; chunk != NULL; chunk = prev) {
+        prev = chunk->prev;
+        xfree(chunk);
+    }
+    arena->chunk = NULL;
+}
+
+/// the size of the smallest slab class as power of two
+#define SLAB_MIN_SHIFT      5
+
+/// the size of the largest slab class
+#define SLAB_MAX_SIZE       ((size_t) 1 << (SLAB_NUM_CLASSES - 1 + SLAB_MIN_SHIFT))
+
+struct slab_head {
+    /// the class of the block or `SLAB_NUM_CLASSES` for big blocks
+    size_t              cls;
+    /// the number of usable bytes of big blocks
+    size_t              size;
+};
+
+struct slab_big {
+    /// next big block
+    struct slab_big     *next;
+    /// previous big block
+    struct slab_big     *prev;
+    /// the head in front of the memory
+    struct slab_head    head;
+};
+
+/**
+ * Gets the head in front of memory handed out by a slab.
+ */
+#define slab_head_of(ptr) ((struct slab_head*) (ptr) - 1)
+
+/**
+ * Gets the links in front of a big block.
+ */
+#define slab_big_of(ptr) ((struct slab_big*) (ptr) - 1)
+
+void *slab_alloc(struct slab *slab, size_t size)
+{
+    size_t              cls;
+    struct slab_big     *big;
+    struct slab_head    *head;
+
+    if (size == 0) {
+        return NULL;
+    }
+
+    if (size + sizeof(*head) > SLAB_MAX_SIZE) {
+        big = xmalloc(sizeof(*big) + size);
+        big->next = slab->big;
+        big->prev = NULL;
+        if (slab->big != NULL) {
+            slab->big->prev = big;
+        }
+        slab->big = big;
+        big->head.cls = SLAB_NUM_CLASSES;
+        big->head.size = size;
+        return &big[1];
+    }
+
+    for (cls = 0; size + sizeof(*head) > (size_t) 1 << (cls + SLAB_MIN_SHIFT);
+         cls++) {
+        (void) 0;
+    }
+
+    /* free blocks link to the next one within their memory */
+    if (slab->free_blocks[cls] != NULL) {
+        head = slab_head_of(slab->free_blocks[cls]);
+        memcpy(&slab->free_blocks[cls], &head[1], sizeof(void*));
+    } else {
+        head = arena_alloc(&slab->arena, (size_t) 1 << (cls + SLAB_MIN_SHIFT));
+        head->cls = cls;
+        head->size = ((size_t) 1 << (cls + SLAB_MIN_SHIFT)) - sizeof(*head);
+    }
+    return &head[1];
+}
+
+void slab_free(struct slab *slab, void *ptr)
+{
+    struct slab_head    *head;
+    struct slab_big     *big;
+
+    if (ptr == NULL) {
+        return;
+    }
+    head = slab_head_of(ptr);
+    if (head->cls == SLAB_NUM_CLASSES) {
+        big = slab_big_of(ptr);
+        if (big->prev != NULL) {
+            big->prev->next = big->next;
+        } else {
+            slab->big = big->next;
+        }
+        if (big->next != NULL) {
+            big->next->prev = big->prev;
+        }
+        xfree(big);
+        return;
+    }
+    memcpy(ptr, &slab->free_blocks[head->cls], sizeof(void*));
+    slab->free_blocks[head->cls] = ptr;
+}
+
+void *slab_realloc(struct slab *slab, void *ptr, size_t size)
+{
+    struct slab_head    *head;
+    struct slab_big     *big;
+    void                *new_ptr;
+
+    if (ptr == NULL) {
+        return slab_alloc(slab, size);
+    }
+    if (size == 0) {
+        slab_free(slab, ptr);
+        return NULL;
+    }
+
+    head = slab_head_of(ptr);
+    if (head->cls == SLAB_NUM_CLASSES &&
+            size + sizeof(*head) > SLAB_MAX_SIZE) {
+        big = xrealloc(slab_big_of(ptr), sizeof(*big) + size);
+        if (big->prev != NULL) {
+            big->prev->next = big;
+        } else {
+            slab->big = big;
+        }
+        if (big->next != NULL) {
+            big->next->prev = big;
+        }
+        big->head.size = size;
+        return &big[1];
+    }
+
+    /* keep the block if it is not more than twice as large as needed */
+    if (head->cls < SLAB_NUM_CLASSES && size <= head->size &&
+            (head->cls == 0 || size + sizeof(*head) >
+                (size_t) 1 << (head->cls + SLAB_MIN_SHIFT - 1))) {
+        return ptr;
+    }
+
+    new_ptr = slab_alloc(slab, size);
+    memcpy(new_ptr, ptr, head->size < size ? head->size : size);
+    slab_free(slab, ptr);
+    return new_ptr;
+}
+
+void clear_slab(struct slab *slab)
+{
+    struct slab_big     *big, *next;
+    size_t              cls;
+
+    for (big = slab->big; big != NULL; big = next) {
+        next = big->next;
+        xfree(big);
+    }
+    slab->big = NULL;
+    for (cls = 0; cls < SLAB_NUM_CLASSES; cls++) {
+        slab->free_blocks[cls] = NULL;
+    }
+    clear_arena(&slab->arena);
+}
@@ -43,5 +43,166 @@ void *xstrndup(const char *s, size_t n);
  */
 char *xasprintf(const char *fmt, ...);
 
+/* * * Arenas * * */
+
+/**
+ * An arena hands out memory from large chunks. The allocations are not freed
+ * one by one, instead all of them are freed at once by `clear_arena()`.
+ *
+ * A zeroed arena is an empty arena.
+ */
+struct arena {
+    /// the chunk allocations are taken from, it links to the older chunks
+    struct arena_chunk *chunk;
+};
+
+/**
+ * Allocates memory from an arena, the memory is suitably aligned for any
+ * type.
+ *
+ * @param arena The arena to allocate from.
+ * @param size  The number of bytes to allocate.
+ *
+ * @return The allocated memory or `NULL` if `size` is 0.
+ */
+void *arena_alloc(struct arena *arena, size_t size);
+
+/**
+ * Frees all memory allocated from an arena.
+ *
+ * @param arena The arena to clear, it is empty afterwards.
+ */
+void clear_arena(struct arena *arena);
+
+/* * * Slabs * * */
+
+/// the number of size classes of a slab, from 32 to 4096 bytes
+#define SLAB_NUM_CLASSES    8
+
+/**
+ * A slab is an arena whose allocations can be freed and reallocated. Freed
+ * blocks are kept in a list per size class and handed out again. Blocks that
+ * are too large for all classes come from `malloc()` but are still freed by
+ * `clear_slab()`.
+ *
+ * A zeroed slab is an empty slab.
+ */
+struct slab {
+    /// the arena the blocks are taken from
+    struct arena arena;
+    /// the freed blocks of each class
+    void *free_blocks[SLAB_NUM_CLASSES];
+    /// the blocks that are too large for all classes
+    struct slab_big *big;
+};
+
+/**
+ * Allocates memory from a slab.
+ *
+ * @param slab  The slab to allocate from.
+ * @param size  The number of bytes to allocate.
+ *
+ * @return The allocated memory or `NULL` if `size` is 0.
+ */
+void *slab_alloc(struct slab *slab, size_t size);
+
+/**
+ * Like `xrealloc()` but for memory of a slab.
+ *
+ * @param slab  The slab `ptr` was allocated from.
+ * @param ptr   The memory to reallocate, may be `NULL`.
+ * @param size  The new size, 0 frees the memory.
+ *
+ * @return The reallocated memory.
+ */
+void *slab_realloc(struct slab *slab, void *ptr, size_t size);
+
+/**
+ * Gives memory back to a slab.
+ *
+ * @param slab  The slab `ptr` was allocated from.
+ * @param ptr   The memory to free, may be `NULL`.
+ */
+void slab_free(struct slab *slab, void *ptr);
+
+/**
+ * Frees all memory of a slab at once.
+ *
+ * @param slab  The slab to clear, it is empty afterwards.
+ */
+void clear_slab(struct slab *slab);
+
+/* * * Statistics * * */
+
+/*
+ * When compiled with `XALLOC_STATS` defined (for example with
+ * `make C_FLAGS="-Isrc -std=gnu99 -DXALLOC_STATS"`), every allocation records
+ * its call site. The functions above are then wrapped by macros that store
+ * the location of the call before calling the function. Memory that is freed
+ * by a file that does not include this header is still counted as live.
+ *
+ * Allocations from arenas and slabs are not counted one by one, instead the
+ * chunks and big blocks are counted at the site that made them necessary.
+ */
+#ifdef XALLOC_STATS
+
+struct xalloc_site {
+    /// the source file of the call
+    const char *file;
+    /// the function that made the call
+    const char *func;
+    /// the line of the call
+    int line;
+    /// the number of calls
+    size_t calls;
+    /// the total number of bytes requested
+    size_t bytes;
+    /// the number of bytes that are not freed yet
+    size_t live;
+};
+
+/**
+ * Like `free()` but also forgets the statistics of the memory.
+ */
+void xfree(void *ptr);
+
+/**
+ * Gets a copy of the statistics of all call sites, sorted by the number of
+ * live bytes.
+ *
+ * @param p_num Receives the number of sites.
+ *
+ * @return The sites, the caller must free them.
+ */
+struct xalloc_site *get_xalloc_sites(size_t *p_num);
+
+#ifndef XALLOC_INTERNAL
+
+extern __thread const char *XallocFile;
+extern __thread const char *XallocFunc;
+extern __thread int XallocLine;
+
+#define XALLOC_HERE \
+    (XallocFile = __FILE__, XallocFunc = __func__, XallocLine = __LINE__)
+
+#define xmalloc(size)       (XALLOC_HERE, xmalloc(size))
+#define xcalloc(nmemb, size) (XALLOC_HERE, xcalloc(nmemb, size))
+#define xrealloc(ptr, size) (XALLOC_HERE, xrealloc(ptr, size))
+#define xreallocarray(ptr, nmemb, size) \
+    (XALLOC_HERE, xreallocarray(ptr, nmemb, size))
+#define xmemdup(ptr, size)  (XALLOC_HERE, xmemdup(ptr, size))
+#define xstrdup(s)          (XALLOC_HERE, xstrdup(s))
+#define xstrndup(s, n)      (XALLOC_HERE, xstrndup(s, n))
+#define xasprintf(...)      (XALLOC_HERE, xasprintf(__VA_ARGS__))
+#define arena_alloc(arena, size) (XALLOC_HERE, arena_alloc(arena, size))
+#define slab_alloc(slab, size) (XALLOC_HERE, slab_alloc(slab, size))
+#define slab_realloc(slab, ptr, size) \
+    (XALLOC_HERE, slab_realloc(slab, ptr, size))
+#define free(ptr)           xfree(ptr)
+
+#endif
+
+#endif
+
 #endif
 